@@ -51,6 +51,18 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D_28b(benchmark::State& state)
+{
+    // 28-byte messages, the size of a v0.5 stake kernel
+    std::vector<uint8_t> in(28 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            SHA256DShort(out.data(), in.data(), 28, 1024);
+        }
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -75,4 +87,5 @@ BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D_28b);
 BENCHMARK(SipHash_32b);
@@ -0,0 +1,57 @@
+#include "bench.h"
+#include "crypto/MerkleTreeProof/simd.h"
+
+#include <string.h>
+#include <vector>
+
+/* Number of Argon2 blocks (1 KiB each) to fill or hash per iteration */
+static const size_t MTP_BLOCKS = 256;
+
+static void FillBlocks(benchmark::State& state, const char* name)
+{
+    if (!mtp_select(name))
+        return; // not built in or not supported by this CPU
+    std::vector<block> blocks(MTP_BLOCKS);
+    uint8_t h0[72];
+    memset(blocks.data(), 0x5a, blocks.size() * sizeof(block));
+    memset(h0, 0x42, sizeof(h0));
+    while (state.KeepRunning()) {
+        for (size_t j = 1; j < blocks.size(); j++)
+            fill_block_mtp(&blocks[j - 1], &blocks[((j * 0x9e3779b9u) >> 8) % j], &blocks[j], 1, j, h0);
+    }
+    mtp_autodetect();
+}
+
+static void HashBlocks(benchmark::State& state, const char* name)
+{
+    if (!mtp_select(name))
+        return;
+    std::vector<block> blocks(MTP_BLOCKS);
+    uint8_t digest[16];
+    memset(blocks.data(), 0x5a, blocks.size() * sizeof(block));
+    while (state.KeepRunning()) {
+        for (size_t j = 0; j < blocks.size(); j++) {
+            blake2b_state S;
+            blake2b_init(&S, sizeof(digest));
+            blake2b_4r_update(&S, &blocks[j], sizeof(block));
+            blake2b_4r_final(&S, digest, sizeof(digest));
+        }
+    }
+    mtp_autodetect();
+}
+
+static void MTP_FillBlock_Standard(benchmark::State& state) { FillBlocks(state, "standard"); }
+static void MTP_FillBlock_SSE41(benchmark::State& state) { FillBlocks(state, "sse4.1"); }
+static void MTP_FillBlock_AVX2(benchmark::State& state) { FillBlocks(state, "avx2"); }
+
+static void MTP_Blake2b_Standard(benchmark::State& state) { HashBlocks(state, "standard"); }
+static void MTP_Blake2b_SSE41(benchmark::State& state) { HashBlocks(state, "sse4.1"); }
+static void MTP_Blake2b_AVX2(benchmark::State& state) { HashBlocks(state, "avx2"); }
+
+BENCHMARK(MTP_FillBlock_Standard);
+BENCHMARK(MTP_FillBlock_SSE41);
+BENCHMARK(MTP_FillBlock_AVX2);
+
+BENCHMARK(MTP_Blake2b_Standard);
+BENCHMARK(MTP_Blake2b_SSE41);
+BENCHMARK(MTP_Blake2b_AVX2);
@@ -0,0 +1,56 @@
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "kernel.h"
+#include "random.h"
+#include "validation.h"
+
+#include <deque>
+
+/* Number of blocks of the synthetic proof-of-stake chain connected per iteration */
+static const int STAKE_CHAIN_BLOCKS = 5000;
+
+// Connect a chain of blocks with jittery timestamps, computing each block's
+// stake modifier on top of the active chain the way ConnectBlock() does
+static void ComputeStakeModifiers(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const int64_t nSpacing = Params().GetConsensus().nStakeTargetSpacing;
+
+    std::deque<uint256> hashes;
+    std::deque<CBlockIndex> blocks;
+    int64_t nTime = Params().GenesisBlock().nTime;
+    for (int i = 0; i < STAKE_CHAIN_BLOCKS; i++) {
+        hashes.push_back(GetRandHash());
+        blocks.emplace_back();
+        CBlockIndex& index = blocks.back();
+        index.phashBlock = &hashes.back();
+        index.pprev = i ? &blocks[i - 1] : NULL;
+        index.nHeight = i;
+        index.nTime = nTime;
+        index.SetProofOfStake();
+        index.hashProofOfStake = GetRandHash();
+        index.SetStakeEntropyBit(GetRand(2));
+        index.BuildSkip();
+        nTime += GetRand(3 * nSpacing) - nSpacing / 2;
+    }
+    blocks[0].SetStakeModifier(0, true);
+
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        chainActive.SetTip(&blocks[0]);
+        UpdateStakeModifierIndex();
+        for (int i = 1; i < STAKE_CHAIN_BLOCKS; i++) {
+            uint64_t nStakeModifier = 0;
+            bool fGeneratedStakeModifier = false;
+            assert(ComputeNextStakeModifier(&blocks[i], nStakeModifier, fGeneratedStakeModifier));
+            blocks[i].SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+            chainActive.SetTip(&blocks[i]);
+            UpdateStakeModifierIndex();
+        }
+    }
+    chainActive.SetTip(NULL);
+    UnloadStakeModifierIndex();
+}
+
+BENCHMARK(ComputeStakeModifiers);
@@ -147,6 +147,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_HAVE_MTP           =  256, //!< MTP proof of the block stored separately in mtp*.dat
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -178,6 +180,9 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
+    //! Byte offset within mtp?????.dat where this block's MTP proof is stored
+    unsigned int nMTPPos;
+
     //! (memory only) Total amount of trust score (ppcoin proof-of-stake difficulty) in the chain up to and including this block
     arith_uint256 nChainTrust;
 
@@ -274,6 +279,7 @@ public:
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
+        nMTPPos = 0;
         nChainTrust = arith_uint256();
         nTx = 0;
         nChainTx = 0;
@@ -336,6 +342,8 @@ public:
             READWRITE(VARINT(nDataPos));
         if (nStatus & BLOCK_HAVE_UNDO)
             READWRITE(VARINT(nUndoPos));
+        if (nStatus & BLOCK_HAVE_MTP)
+            READWRITE(VARINT(nMTPPos));
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -356,6 +364,15 @@ public:
         return ret;
     }
 
+    CDiskBlockPos GetMTPPos() const {
+        CDiskBlockPos ret;
+        if (nStatus & BLOCK_HAVE_MTP) {
+            ret.nFile = nFile;
+            ret.nPos  = nMTPPos;
+        }
+        return ret;
+    }
+
     CBlockHeader GetBlockHeader() const;
 
     uint256 GetBlockHash() const
@@ -21,6 +21,7 @@
 
 #include "blake2.h"
 #include "blake2-impl.h"
+#include "../simd.h"
 
 static const uint64_t blake2b_IV[8] = {
     UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
@@ -221,7 +222,7 @@ static void blake2b_compress(blake2b_state *S, const uint8_t *block) {
 #undef ROUND
 }
 
-static void blake2b_4r_compress(blake2b_state *S, const uint8_t *block) {
+void blake2b_4r_compress_ref(blake2b_state *S, const uint8_t *block) {
     uint64_t m[16];
     uint64_t v[16];
     unsigned int i, r;
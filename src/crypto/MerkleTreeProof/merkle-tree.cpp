@@ -2,6 +2,7 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <cstring>
 #include "blake2/blake2.h"
 
 std::ostream& operator<<(std::ostream& os, const MerkleTree::Buffer& buffer)
@@ -14,6 +15,11 @@ std::ostream& operator<<(std::ostream& os, const MerkleTree::Buffer& buffer)
     return os;
 }
 
+MerkleTree::MerkleTree()
+    : preserveOrder_(true)
+{
+}
+
 MerkleTree::MerkleTree(const Elements& elements, bool preserveOrder)
     : preserveOrder_(preserveOrder)
 {
@@ -21,6 +27,7 @@ MerkleTree::MerkleTree(const Elements& elements, bool preserveOrder)
         throw std::runtime_error("Empty elements list");
     }
 
+    Elements kept;
     for (   Elements::const_iterator it = elements.begin();
             it != elements.end();
             ++it) {
@@ -35,19 +42,29 @@ MerkleTree::MerkleTree(const Elements& elements, bool preserveOrder)
         }
         if (!preserveOrder_) {
             // Check that this element has not been pushed yet
-            if (std::find(elements_.begin(), elements_.end(), *it)
-                    != elements_.end()) {
+            if (std::find(kept.begin(), kept.end(), *it) != kept.end()) {
                 continue; // ignore duplicates
             }
         }
-        elements_.push_back(*it);
+        kept.push_back(*it);
     } // for each element
 
     if (!preserveOrder_) {
-        std::sort(elements_.begin(), elements_.end()); // sort elements
+        std::sort(kept.begin(), kept.end()); // sort elements
+    }
+
+    // The first layer is the elements themselves
+    layers_.resize(1);
+    layers_[0].reserve(kept.size() * MERKLE_TREE_ELEMENT_SIZE_B);
+    for (   Elements::const_iterator it = kept.begin();
+            it != kept.end();
+            ++it) {
+        layers_[0].insert(layers_[0].end(), it->begin(), it->end());
     }
 
-    getLayers();
+    if (!kept.empty()) {
+        build();
+    }
 }
 
 MerkleTree::~MerkleTree()
@@ -80,6 +97,20 @@ MerkleTree::Buffer MerkleTree::combinedHash(const Buffer& first,
     return hash(buffer);
 }
 
+void MerkleTree::combinedHash(const uint8_t* first, const uint8_t* second,
+        uint8_t* output)
+{
+    uint8_t buffer[MERKLE_TREE_ELEMENT_SIZE_B * 2];
+    std::memcpy(buffer, first, MERKLE_TREE_ELEMENT_SIZE_B);
+    std::memcpy(buffer + MERKLE_TREE_ELEMENT_SIZE_B, second,
+            MERKLE_TREE_ELEMENT_SIZE_B);
+
+    blake2b_state state;
+    blake2b_init(&state, MERKLE_TREE_ELEMENT_SIZE_B);
+    blake2b_4r_update(&state, buffer, sizeof(buffer));
+    blake2b_4r_final(&state, output, MERKLE_TREE_ELEMENT_SIZE_B);
+}
+
 MerkleTree::Buffer MerkleTree::merkleRoot(const Elements& elements,
         bool preserveOrder)
 {
@@ -88,18 +119,15 @@ MerkleTree::Buffer MerkleTree::merkleRoot(const Elements& elements,
 
 MerkleTree::Elements MerkleTree::getProof(const Buffer& element) const
 {
-    bool found = false;
-    size_t index;
-    for (size_t i = 0; (i < elements_.size()) && !found; ++i) {
-        if (elements_[i] == element) {
-            found = true;
-            index = i;
+    if (element.size() == MERKLE_TREE_ELEMENT_SIZE_B) {
+        for (size_t i = 0; i < size(); ++i) {
+            if (std::memcmp(leaf(i), element.data(),
+                        MERKLE_TREE_ELEMENT_SIZE_B) == 0) {
+                return getProof(i);
+            }
         }
     }
-    if (!found) {
-        throw std::runtime_error("Element not found");
-    }
-    return getProof(index);
+    throw std::runtime_error("Element not found");
 }
 
 std::string MerkleTree::getProofHex(const Buffer& element) const
@@ -114,7 +142,9 @@ MerkleTree::Elements MerkleTree::getProofOrdered(const Buffer& element,
         throw std::runtime_error("Index is zero");
     }
     index--;
-    if ((index >= elements_.size()) || (elements_[index] != element)) {
+    if ((index >= size()) || (element.size() != MERKLE_TREE_ELEMENT_SIZE_B) ||
+            (std::memcmp(leaf(index), element.data(),
+                         MERKLE_TREE_ELEMENT_SIZE_B) != 0)) {
         throw std::runtime_error("Index does not point to element");
     }
     return getProof(index);
@@ -126,6 +156,36 @@ std::string MerkleTree::getProofOrderedHex(const Buffer& element,
     return elementsToHex(getProofOrdered(element, index));
 }
 
+size_t MerkleTree::getProofOrderedSize(size_t index) const
+{
+    --index; // `index` argument starts at 1
+    size_t count = 0;
+    for (   Layers::const_iterator it = layers_.begin();
+            it != layers_.end();
+            ++it) {
+        if (getPair(*it, index)) {
+            ++count;
+        }
+        index = index / 2;
+    }
+    return count;
+}
+
+void MerkleTree::getProofOrdered(size_t index, uint8_t* proof) const
+{
+    --index; // `index` argument starts at 1
+    for (   Layers::const_iterator it = layers_.begin();
+            it != layers_.end();
+            ++it) {
+        const uint8_t* pair = getPair(*it, index);
+        if (pair) {
+            std::memcpy(proof, pair, MERKLE_TREE_ELEMENT_SIZE_B);
+            proof += MERKLE_TREE_ELEMENT_SIZE_B;
+        }
+        index = index / 2;
+    }
+}
+
 bool MerkleTree::checkProof(const Elements& proof, const Buffer& root,
         const Buffer& element)
 {
@@ -191,44 +251,104 @@ bool MerkleTree::checkProofOrdered(const Elements& proof,
     return tempHash == root;
 }
 
-void MerkleTree::getLayers()
+bool MerkleTree::checkProofOrdered(const uint8_t* proof, size_t proofSize,
+        const uint8_t* root, const uint8_t* element, size_t index)
 {
-    layers_.clear();
+    --index; // `index` argument starts at 1
+    uint8_t tempHash[MERKLE_TREE_ELEMENT_SIZE_B];
+    std::memcpy(tempHash, element, sizeof(tempHash));
+    for (size_t i = 0; i < proofSize; ++i) {
+        size_t remaining = proofSize - i;
+        const uint8_t* node = proof + (i * MERKLE_TREE_ELEMENT_SIZE_B);
 
-    // The first layer is the elements themselves
-    layers_.push_back(elements_);
+        // See the `Elements` version above for the index adjustment
+        while (((index & 1) == 0) && (index >= (1u << remaining))) {
+            index = index / 2;
+        }
 
-    if (elements_.empty()) {
-        return; // nothing left to do
+        if (index & 1) {
+            combinedHash(node, tempHash, tempHash);
+        } else {
+            combinedHash(tempHash, node, tempHash);
+        }
+        index = index / 2;
+    }
+    return std::memcmp(tempHash, root, sizeof(tempHash)) == 0;
+}
+
+uint8_t* MerkleTree::leaves(size_t count)
+{
+    preserveOrder_ = true;
+    if (layers_.empty()) {
+        layers_.resize(1);
+    }
+    layers_[0].resize(count * MERKLE_TREE_ELEMENT_SIZE_B);
+    return layers_[0].data();
+}
+
+void MerkleTree::build(const Executor& executor)
+{
+    if (size() == 0) {
+        throw std::runtime_error("Empty elements list");
     }
 
     // For subsequent layers, combine each pair of hashes in the previous
     // layer to build the current layer. Repeat until the current layer has
-    // only one hash (this will be the root of the tree).
-    while (layers_.back().size() > 1) {
-        getNextLayer();
+    // only one hash (this will be the root of the tree). Layer buffers left
+    // over from a previous build are reused.
+    size_t layer = 0;
+    while (layers_[layer].size() > MERKLE_TREE_ELEMENT_SIZE_B) {
+        getNextLayer(layer, executor);
+        ++layer;
     }
+    layers_.resize(layer + 1);
 }
 
-void MerkleTree::getNextLayer()
+void MerkleTree::getNextLayer(size_t layer, const Executor& executor)
 {
-    const Elements& previous_layer = layers_.back();
+    // Below this many pairs a layer is not worth splitting
+    static const size_t minParallelPairs = 1024;
 
-    // Create a new empty layer
-    layers_.push_back(Elements());
-    Elements& current_layer = layers_.back();
+    if (layers_.size() <= layer + 1) {
+        layers_.resize(layer + 2);
+    }
+    const std::vector<uint8_t>& previous_layer = layers_[layer];
+    std::vector<uint8_t>& current_layer = layers_[layer + 1];
+    const size_t count = previous_layer.size() / MERKLE_TREE_ELEMENT_SIZE_B;
+    const size_t pairs = count / 2;
+    current_layer.resize(((count + 1) / 2) * MERKLE_TREE_ELEMENT_SIZE_B);
+
+    const uint8_t* in = previous_layer.data();
+    uint8_t* out = current_layer.data();
+    const bool preserveOrder = preserveOrder_;
+    auto task = [=](unsigned part, unsigned parts) {
+        size_t begin = pairs * part / parts;
+        size_t end = pairs * (part + 1) / parts;
+        for (size_t i = begin; i < end; ++i) {
+            const uint8_t* first = in + (2*i) * MERKLE_TREE_ELEMENT_SIZE_B;
+            const uint8_t* second = first + MERKLE_TREE_ELEMENT_SIZE_B;
+            if (!preserveOrder && std::memcmp(first, second,
+                        MERKLE_TREE_ELEMENT_SIZE_B) <= 0) {
+                std::swap(first, second);
+            }
+            combinedHash(first, second, out + i * MERKLE_TREE_ELEMENT_SIZE_B);
+        }
+    };
 
     // For each pair of elements in the previous layer
     // NB: If there is an odd number of elements, we ignore the last one for now
-    for (size_t i = 0; i < (previous_layer.size() / 2); ++i) {
-        current_layer.push_back(combinedHash(previous_layer[2*i],
-                    previous_layer[2*i + 1], preserveOrder_));
+    if (executor && pairs >= minParallelPairs) {
+        executor(task);
+    } else {
+        task(0, 1);
     }
 
     // If there is an odd one out at the end, process it
     // NB: It's on its own, so we don't combine it with anything
-    if (previous_layer.size() & 1) {
-        current_layer.push_back(previous_layer.back());
+    if (count & 1) {
+        std::memcpy(out + pairs * MERKLE_TREE_ELEMENT_SIZE_B,
+                in + (count - 1) * MERKLE_TREE_ELEMENT_SIZE_B,
+                MERKLE_TREE_ELEMENT_SIZE_B);
     }
 }
 
@@ -238,16 +358,17 @@ MerkleTree::Elements MerkleTree::getProof(size_t index) const
     for (   Layers::const_iterator it = layers_.begin();
             it != layers_.end();
             ++it) {
-        Buffer pair;
-        if (getPair(*it, index, pair)) {
-            proof.push_back(pair);
+        const uint8_t* pair = getPair(*it, index);
+        if (pair) {
+            proof.push_back(Buffer(pair, pair + MERKLE_TREE_ELEMENT_SIZE_B));
         }
         index = index / 2; // point to correct hash in next layer
     } // for each layer
     return proof;
 }
 
-bool MerkleTree::getPair(const Elements& layer, size_t index, Buffer& pair)
+const uint8_t* MerkleTree::getPair(const std::vector<uint8_t>& layer,
+        size_t index)
 {
     size_t pairIndex;
     if (index & 1) {
@@ -255,11 +376,10 @@ bool MerkleTree::getPair(const Elements& layer, size_t index, Buffer& pair)
     } else {
         pairIndex = index + 1;
     }
-    if (pairIndex >= layer.size()) {
-        return false;
+    if (pairIndex >= layer.size() / MERKLE_TREE_ELEMENT_SIZE_B) {
+        return nullptr;
     }
-    pair = layer[pairIndex];
-    return true;
+    return layer.data() + pairIndex * MERKLE_TREE_ELEMENT_SIZE_B;
 }
 
 std::string MerkleTree::elementsToHex(const Elements& elements)
@@ -7,6 +7,7 @@ extern "C" {
 
 #include <vector>
 #include <deque>
+#include <functional>
 #include <string>
 #include <stdexcept>
 
@@ -35,6 +36,21 @@ public :
      */
     typedef std::deque<Buffer> Elements;
 
+    /** Parallel executor
+     *
+     * Calls `task(part, parts)` for every `part` in `[0, parts)`, possibly
+     * from several threads, and returns once all calls are done. `parts` is
+     * chosen by the executor.
+     */
+    typedef std::function<void(const std::function<void(unsigned, unsigned)>& task)> Executor;
+
+    /** Constructor for an empty tree with preserved order
+     *
+     * Use `leaves()` and `build()` to fill it. The buffers are kept when the
+     * tree is built again with the same number of leaves.
+     */
+    MerkleTree();
+
     /** Constructor
      *
      * If `preserveOrder` is set to `true`, the `elements` will be used in
@@ -75,10 +91,49 @@ public :
     static Buffer combinedHash(const Buffer& first, const Buffer& second,
             bool preserveOrder);
 
+    /** Combine two raw hashes into one, preserving their order
+     *
+     * \param first  [in]  First hash (i.e. the one on the left)
+     * \param second [in]  Second hash (i.e. the one on the right)
+     * \param output [out] The hash of the combined two hashes; may alias
+     *                     `first` or `second`
+     */
+    static void combinedHash(const uint8_t* first, const uint8_t* second,
+            uint8_t* output);
+
     /** Get the root hash of the Merkle Tree */
     Buffer getRoot() const
     {
-        return layers_.back()[0];
+        return Buffer(layers_.back().begin(),
+                layers_.back().begin() + MERKLE_TREE_ELEMENT_SIZE_B);
+    }
+
+    /** Resize the leaves of a tree with preserved order
+     *
+     * \param count [in] Number of leaves, at least one
+     *
+     * \return Buffer of `count` leaves laid out back to back, to be filled
+     *         by the caller before calling `build()`
+     */
+    uint8_t* leaves(size_t count);
+
+    /** Build the layers above the leaves set through `leaves()`
+     *
+     * Large layers are split in parts and hashed through `executor` if one is
+     * given.
+     */
+    void build(const Executor& executor = Executor());
+
+    /** Number of leaves */
+    size_t size() const
+    {
+        return layers_.empty() ? 0 : layers_[0].size() / MERKLE_TREE_ELEMENT_SIZE_B;
+    }
+
+    /** Get a leaf of the tree, `index` starting at 0 */
+    const uint8_t* leaf(size_t index) const
+    {
+        return layers_[0].data() + index * MERKLE_TREE_ELEMENT_SIZE_B;
     }
 
     /** Compute a root hash given a set of hashes
@@ -164,6 +219,23 @@ public :
      */
     std::string getProofOrderedHex(const Buffer& element, size_t index) const;
 
+    /** Number of nodes in the proof of an element of a tree with preserved order
+     *
+     * \param index [in] Index of the element, starting at 1
+     */
+    size_t getProofOrderedSize(size_t index) const;
+
+    /** Get proof for an element of a tree with preserved order, without allocating
+     *
+     * Same as `getProofOrdered()` above, but the nodes are written back to
+     * back into `proof`, which must have room for
+     * `getProofOrderedSize(index)` nodes.
+     *
+     * \param index [in]  Index of the element, starting at 1
+     * \param proof [out] Proof nodes, from lowest to root
+     */
+    void getProofOrdered(size_t index, uint8_t* proof) const;
+
     /** Check the given proof for the given element
      *
      * This function will check that the given proof is valid for the given
@@ -199,6 +271,22 @@ public :
     static bool checkProofOrdered(const Elements& proof, const Buffer& root,
             const Buffer& element, size_t index);
 
+    /** Check a proof stored as contiguous nodes, in a Merkle Tree with order preserved
+     *
+     * Same as above, but works on raw `MERKLE_TREE_ELEMENT_SIZE_B`-byte
+     * nodes and does not allocate.
+     *
+     * \param proof     [in] `proofSize` nodes laid out back to back
+     * \param proofSize [in] Number of nodes in `proof`
+     * \param root      [in] Root hash of the Merke Tree
+     * \param element   [in] Element for which the proof is checked
+     * \param index     [in] Index of above element, starting at 1
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkProofOrdered(const uint8_t* proof, size_t proofSize,
+            const uint8_t* root, const uint8_t* element, size_t index);
+
 private :
     /** Layers data structure
      *
@@ -207,18 +295,17 @@ private :
      * combination of the hashes of the first layer, etc. until the last layer
      * which is the top-level hash, aka the root. The last layer has a length
      * of one.
+     *
+     * Each layer is a single buffer of `MERKLE_TREE_ELEMENT_SIZE_B`-byte
+     * nodes laid out back to back.
      */
-    typedef std::deque<Elements> Layers;
+    typedef std::vector<std::vector<uint8_t>> Layers;
 
     bool     preserveOrder_; /**< Whether to preserve the initial order */
-    Elements elements_;      /**< Leaves of the Merkle Tree */
     Layers   layers_;        /**< The various layers of the Merkle Tree */
 
-    /** Build the Merkle Tree layers */
-    void getLayers();
-
-    /** Build the next Merkle Tree layer */
-    void getNextLayer();
+    /** Build the next Merkle Tree layer from layer `layer` */
+    void getNextLayer(size_t layer, const Executor& executor);
 
     /** Get proof given the index of the element
      *
@@ -230,15 +317,14 @@ private :
 
     /** Get the peer of an element
      *
-     * \param layer [in]  Layer to search
-     * \param index [in]  Index of element in layer
-     * \param pair  [out] Peer element
+     * \param layer [in] Layer to search
+     * \param index [in] Index of element in layer
      *
-     * \return `true` if OK, `false` if no peer element (this can happen if
-     *         the `layer` has an odd number of elements, and you are asking
-     *         for the last one, which obviously has no peer)
+     * \return The peer element, or `nullptr` if there is none (this can
+     *         happen if the `layer` has an odd number of elements, and you
+     *         are asking for the last one, which obviously has no peer)
      */
-    static bool getPair(const Elements& layer, size_t index, Buffer& pair);
+    static const uint8_t* getPair(const std::vector<uint8_t>& layer, size_t index);
 
     /** Converts a list of hashes into a hexadecimal string */
     static std::string elementsToHex(const Elements& elements);
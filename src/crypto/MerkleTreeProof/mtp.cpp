@@ -13,6 +13,10 @@ extern "C" {
 #include <string.h>
 }
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -21,13 +25,14 @@ extern "C" {
 #include "streams.h"
 #include <boost/multiprecision/cpp_int.hpp>
 #include <boost/numeric/conversion/cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 using boost::numeric_cast;
 using boost::numeric::bad_numeric_cast;
 using boost::numeric::positive_overflow;
 using boost::numeric::negative_overflow;
 
-extern int validate_inputs(const argon2_context *context);
 extern void clear_internal_memory(void *v, size_t n);
 
 namespace mtp
@@ -48,27 +53,6 @@ void StoreBlock(void *output, const block *src)
     }
 }
 
-int Argon2CtxMtp(argon2_context *context, argon2_type type,
-        argon2_instance_t *instance)
-{
-    int result = validate_inputs(context);
-    if (result != ARGON2_OK) {
-        return result;
-    }
-    if ((type != Argon2_d) && (type != Argon2_i) && (type != Argon2_id)) {
-        return ARGON2_INCORRECT_TYPE;
-    }
-    result = initialize(instance, context);
-    if (result != ARGON2_OK) {
-        return result;
-    }
-    result = fill_memory_blocks_mtp(instance, context);
-    if (result != ARGON2_OK) {
-        return result;
-    }
-    return ARGON2_OK;
-}
-
 uint32_t IndexBeta(const argon2_instance_t *instance,
         const argon2_position_t *position, uint32_t pseudo_rand,
         int same_lane)
@@ -203,23 +187,48 @@ struct TargetHelper
 
 } // unnamed namespace
 
+void ProofSet::clear()
+{
+    std::memset(offsets_, 0, sizeof(offsets_));
+    filled_ = 0;
+    arena_.clear();
+    arena_.reserve(COUNT * TYPICAL_DEPTH * MTP_PROOF_NODE_SIZE);
+}
+
+uint8_t* ProofSet::append(int i, size_t count)
+{
+    assert(i == filled_ && i < COUNT);
+    assert(count < 256);
+    offsets_[i + 1] = offsets_[i] + count;
+    filled_ = i + 1;
+    arena_.resize((size_t)offsets_[i + 1] * MTP_PROOF_NODE_SIZE);
+    return arena_.data() + (size_t)offsets_[i] * MTP_PROOF_NODE_SIZE;
+}
+
+void ProofSet::assign(const std::deque<std::vector<uint8_t>> proofs[COUNT])
+{
+    clear();
+    for (int i = 0; i < COUNT; ++i) {
+        uint8_t* out = append(i, proofs[i].size());
+        for (const std::vector<uint8_t>& node : proofs[i]) {
+            assert(node.size() == MTP_PROOF_NODE_SIZE);
+            std::memcpy(out, node.data(), MTP_PROOF_NODE_SIZE);
+            out += MTP_PROOF_NODE_SIZE;
+        }
+    }
+}
+
 namespace impl
 {
 
 bool mtp_verify(const char* input, const uint32_t target,
         const uint8_t hash_root_mtp[16], uint32_t nonce,
         const uint64_t block_mtp[MTP_L*2][128],
-        const std::deque<std::vector<uint8_t>> proof_mtp[MTP_L*3],
+        const ProofSet& proof_mtp,
         uint256 pow_limit,
         uint256 *mtpHashValue)
 {
-    MerkleTree::Elements proof_blocks[L * 3];
-    MerkleTree::Buffer root;
     block blocks[L * 2];
-    root.insert(root.begin(), &hash_root_mtp[0], &hash_root_mtp[16]);
-    for (int i = 0; i < (L * 3); ++i) {
-        proof_blocks[i] = proof_mtp[i];
-    }
     for(int i = 0; i < (L * 2); ++i) {
         std::memcpy(blocks[i].v, block_mtp[i],
                 sizeof(uint64_t) * ARGON2_QWORDS_IN_BLOCK);
@@ -339,10 +348,9 @@ bool mtp_verify(const char* input, const uint32_t target,
         //hash[prev_index]
         uint8_t digest_prev[MERKLE_TREE_ELEMENT_SIZE_B];
         compute_blake2b(prev_block, digest_prev);
-        MerkleTree::Buffer hash_prev(digest_prev,
-                digest_prev + sizeof(digest_prev));
-        if (!MerkleTree::checkProofOrdered(proof_blocks[(j * 3) - 2],
-                    root, hash_prev, ij_prev + 1)) {
+        if (!MerkleTree::checkProofOrdered(proof_mtp.data((j * 3) - 2),
+                    proof_mtp.size((j * 3) - 2), hash_root_mtp, digest_prev,
+                    ij_prev + 1)) {
             LogPrintf("error : checkProofOrdered in x[ij_prev]\n");
             return false;
         }
@@ -371,9 +379,9 @@ bool mtp_verify(const char* input, const uint32_t target,
 
         uint8_t digest_ref[MERKLE_TREE_ELEMENT_SIZE_B];
         compute_blake2b(ref_block, digest_ref);
-        MerkleTree::Buffer hash_ref(digest_ref, digest_ref + sizeof(digest_ref));
-        if (!MerkleTree::checkProofOrdered(proof_blocks[(j * 3) - 1],
-                    root, hash_ref, computed_ref_block + 1)) {
+        if (!MerkleTree::checkProofOrdered(proof_mtp.data((j * 3) - 1),
+                    proof_mtp.size((j * 3) - 1), hash_root_mtp, digest_ref,
+                    computed_ref_block + 1)) {
             LogPrintf("error : checkProofOrdered in x[ij_ref]\n");
             return false;
         }
@@ -387,10 +395,10 @@ bool mtp_verify(const char* input, const uint32_t target,
         // hash x[ij]
         uint8_t digest_ij[MERKLE_TREE_ELEMENT_SIZE_B];
         compute_blake2b(block_ij, digest_ij);
-        MerkleTree::Buffer hash_ij(digest_ij, digest_ij + sizeof(digest_ij));
 
-        if (!MerkleTree::checkProofOrdered(proof_blocks[(j * 3) - 3], root,
-                    hash_ij, ij + 1)) {
+        if (!MerkleTree::checkProofOrdered(proof_mtp.data((j * 3) - 3),
+                    proof_mtp.size((j * 3) - 3), hash_root_mtp, digest_ij,
+                    ij + 1)) {
             LogPrintf("error : checkProofOrdered in x[ij]\n");
             return false;
         }
@@ -431,229 +439,332 @@ bool mtp_verify(const char* input, const uint32_t target,
     return true;
 }
 
-namespace {
+}
 
-bool mtp_hash1(const char* input, uint32_t target, uint8_t hash_root_mtp[16],
-        unsigned int& nonce, uint64_t block_mtp[MTP_L*2][128],
-        std::deque<std::vector<uint8_t>> proof_mtp[MTP_L*3], uint256 pow_limit,
-        uint256& output)
+/** Argon2 memory, Merkle tree and lane threads behind a Solver */
+class Solver::Impl
 {
-#define TEST_OUTLEN 32
-#define TEST_PWDLEN 80
-#define TEST_SALTLEN 80
-#define TEST_SECRETLEN 0
-#define TEST_ADLEN 0
+public:
+    Impl();
+    ~Impl();
+
+    /** Fill the memory and build the tree for an 80-byte serialized header */
+    bool prepare(const char* input);
+
+    /** Find the lowest solving nonce in `[nonce, nonce + count)` */
+    bool search(uint32_t target, uint256 const& pow_limit, uint32_t& nonce,
+            uint32_t count, uint256& output);
+
+    /** Write the blocks and proofs of a solving nonce */
+    void store(uint32_t nonce, uint8_t hash_root_mtp[16],
+            uint64_t block_mtp[MTP_L*2][128], ProofSet& proof_mtp);
+
+private:
+    unsigned char input_[80];   //!< header the memory was filled for
+    bool filled_;               //!< whether memory, leaves and tree match input_
+    unsigned char pwd_[80];
+    unsigned char salt_[80];
+    unsigned char out_[32];
+    argon2_context context_;
+    argon2_instance_t instance_;
+    MerkleTree tree_;           //!< leaves are the blake2b digests of the blocks
+    uint8_t root_[MERKLE_TREE_ELEMENT_SIZE_B];
+
+    //! One thread per lane but the first, which runs on the caller
+    boost::thread_group threads_;
+    boost::mutex mutex_;
+    boost::condition_variable condWork_;
+    boost::condition_variable condDone_;
+    std::function<void(unsigned)> task_;
+    uint64_t generation_; //!< bumped for every task handed to the lanes
+    unsigned pending_;    //!< lane threads still busy with the current task
+    bool shutdown_;
+
+    /** Lane thread main loop */
+    void thread(unsigned lane);
+
+    /** Run `task(lane)` for every lane in parallel and wait for all of them */
+    void run(const std::function<void(unsigned)>& task);
+
+    /** Compute y[0..L] and the opened blocks of a nonce
+     *
+     * Returns `false` if one of the openings is the first or second block of
+     * a lane, which cannot be proven.
+     */
+    bool openings(uint32_t nonce, uint256 y[L + 1], uint32_t ij[L]) const;
+};
 
-    unsigned char out[TEST_OUTLEN];
-    unsigned char pwd[TEST_PWDLEN];
-    std::memcpy(pwd, input, TEST_PWDLEN);
-    unsigned char salt[TEST_SALTLEN];
-    std::memcpy(salt, input, TEST_SALTLEN);
+Solver::Impl::Impl() : filled_(false), generation_(0), pending_(0), shutdown_(false)
+{
+    std::memset(input_, 0, sizeof(input_));
+    std::memset(pwd_, 0, sizeof(pwd_));
+    std::memset(salt_, 0, sizeof(salt_));
+
+    // the header is both the password and the salt
+    context_.out = out_;
+    context_.outlen = sizeof(out_);
+    context_.version = ARGON2_VERSION_NUMBER;
+    context_.pwd = pwd_;
+    context_.pwdlen = sizeof(pwd_);
+    context_.salt = salt_;
+    context_.saltlen = sizeof(salt_);
+    context_.secret = NULL;
+    context_.secretlen = 0;
+    context_.ad = NULL;
+    context_.adlen = 0;
+    context_.t_cost = T_COST;
+    context_.m_cost = M_COST;
+    context_.lanes = LANES;
+    context_.threads = LANES;
+    context_.allocate_cbk = NULL;
+    context_.free_cbk = NULL;
+    context_.flags = ARGON2_DEFAULT_FLAGS;
+
+    uint32_t memory_blocks = context_.m_cost;
+    if (memory_blocks < (2 * ARGON2_SYNC_POINTS * context_.lanes)) {
+        memory_blocks = 2 * ARGON2_SYNC_POINTS * context_.lanes;
+    }
+    uint32_t segment_length = memory_blocks / (context_.lanes * ARGON2_SYNC_POINTS);
+
+    instance_.version = context_.version;
+    instance_.memory = NULL;
+    instance_.passes = context_.t_cost;
+    instance_.memory_blocks = context_.m_cost;
+    instance_.segment_length = segment_length;
+    instance_.lane_length = segment_length * ARGON2_SYNC_POINTS;
+    instance_.lanes = context_.lanes;
+    instance_.threads = context_.threads;
+    instance_.type = Argon2_d;
+    instance_.context_ptr = &context_;
+
+    for (unsigned lane = 1; lane < LANES; ++lane)
+        threads_.create_thread(boost::bind(&Solver::Impl::thread, this, lane));
+}
 
-    argon2_context context;
-    context.out = out;
-    context.outlen = TEST_OUTLEN;
-    context.version = ARGON2_VERSION_NUMBER;
-    context.pwd = pwd;
-    context.pwdlen = TEST_PWDLEN;
-    context.salt = salt;
-    context.saltlen = TEST_SALTLEN;
-    context.secret = NULL;
-    context.secretlen = TEST_SECRETLEN;
-    context.ad = NULL;
-    context.adlen = TEST_ADLEN;
-    context.t_cost = T_COST;
-    context.m_cost = M_COST;
-    context.lanes = LANES;
-    context.threads = LANES;
-    context.allocate_cbk = NULL;
-    context.free_cbk = NULL;
-    context.flags = ARGON2_DEFAULT_FLAGS;
+Solver::Impl::~Impl()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    condWork_.notify_all();
+    threads_.join_all();
 
-#undef TEST_OUTLEN
-#undef TEST_PWDLEN
-#undef TEST_SALTLEN
-#undef TEST_SECRETLEN
-#undef TEST_ADLEN
+    if (instance_.memory) {
+        free_memory(&context_, (uint8_t *)instance_.memory,
+                instance_.memory_blocks, sizeof(block));
+    }
+}
 
-    uint32_t memory_blocks = context.m_cost;
-    if (memory_blocks < (2 * ARGON2_SYNC_POINTS * context.lanes)) {
-        memory_blocks = 2 * ARGON2_SYNC_POINTS * context.lanes;
+void Solver::Impl::thread(unsigned lane)
+{
+    RenameThread("mfcoin-mtp");
+    uint64_t generation = 0;
+    while (true) {
+        std::function<void(unsigned)> task;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (generation_ == generation && !shutdown_)
+                condWork_.wait(lock);
+            if (shutdown_)
+                return;
+            generation = generation_;
+            task = task_;
+        }
+
+        task(lane);
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            if (--pending_ == 0)
+                condDone_.notify_all();
+        }
     }
-    uint32_t segment_length = memory_blocks / (context.lanes * ARGON2_SYNC_POINTS);
-    memory_blocks = segment_length * (context.lanes * ARGON2_SYNC_POINTS);
+}
 
-    argon2_instance_t instance;
-    instance.version = context.version;
-    instance.memory = NULL;
-    instance.passes = context.t_cost;
-    instance.memory_blocks = context.m_cost;
-    instance.segment_length = segment_length;
-    instance.lane_length = segment_length * ARGON2_SYNC_POINTS;
-    instance.lanes = context.lanes;
-    instance.threads = context.threads;
-    instance.type = Argon2_d;
-    if (instance.threads > instance.lanes) {
-        instance.threads = instance.lanes;
+void Solver::Impl::run(const std::function<void(unsigned)>& task)
+{
+    // the lanes work on our stack, so we must not unwind before they are done
+    boost::this_thread::disable_interruption noInterruption;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        task_ = task;
+        pending_ = LANES - 1;
+        ++generation_;
     }
+    condWork_.notify_all();
 
-    // step 1
-    Argon2CtxMtp(&context, Argon2_d, &instance);
+    task(0);
 
-    // step 2
-    MerkleTree::Elements elements;
-    for (long int i = 0; i < instance.memory_blocks; ++i) {
-        uint8_t digest[MERKLE_TREE_ELEMENT_SIZE_B];
-        compute_blake2b(instance.memory[i], digest);
-        elements.emplace_back(digest, digest + sizeof(digest));
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (pending_ > 0)
+        condDone_.wait(lock);
+}
+
+bool Solver::Impl::prepare(const char* input)
+{
+    if (filled_ && std::memcmp(input_, input, sizeof(input_)) == 0) {
+        return true;
     }
 
-    MerkleTree ordered_tree(elements, true);
-    MerkleTree::Buffer root = ordered_tree.getRoot();
-    std::copy(root.begin(), root.end(), hash_root_mtp);
+    filled_ = false;
+    std::memcpy(input_, input, sizeof(input_));
+    std::memcpy(pwd_, input, sizeof(pwd_));
+    std::memcpy(salt_, input, sizeof(salt_));
 
-    // step 3
-    unsigned int n_nonce_internal = 0;
-    TargetHelper const bn_target(target);
+    // the memory is allocated once and reused for every header
+    if (instance_.memory == NULL && allocate_memory(&context_,
+                (uint8_t **)&instance_.memory, instance_.memory_blocks,
+                sizeof(block)) != ARGON2_OK) {
+        instance_.memory = NULL;
+        return false;
+    }
 
-    // step 4
-    uint256 y[L + 1];
-    block blocks[L * 2];
-    MerkleTree::Elements proof_blocks[L * 3];
-    while (true) {
-        if (n_nonce_internal == UINT_MAX) {
-            // go to create a new merkle tree
-            return false;
+    // step 1: what initialize() and fill_memory_blocks_mtp() do, minus the
+    // allocation and the threads they spawn for every slice
+    uint8_t blockhash[ARGON2_PREHASH_SEED_LENGTH];
+    initial_hash(blockhash, &context_, instance_.type);
+    clear_internal_memory(blockhash + ARGON2_PREHASH_DIGEST_LENGTH,
+            ARGON2_PREHASH_SEED_LENGTH - ARGON2_PREHASH_DIGEST_LENGTH);
+    std::memcpy(instance_.hash_zero, blockhash, ARGON2_PREHASH_SEED_LENGTH);
+    fill_first_blocks(blockhash, &instance_);
+    clear_internal_memory(blockhash, ARGON2_PREHASH_SEED_LENGTH);
+
+    for (uint32_t r = 0; r < instance_.passes; ++r) {
+        for (uint32_t s = 0; s < ARGON2_SYNC_POINTS; ++s) {
+            run([this, r, s](unsigned lane) {
+                argon2_position_t position { r, lane, (uint8_t)s, 0 };
+                fill_segment_mtp(&instance_, position);
+            });
         }
+    }
 
-        std::memset(&y[0], 0, sizeof(y));
-        std::memset(&blocks[0], 0, sizeof(sizeof(block) * L * 2));
-
-        blake2b_state state;
-        blake2b_init(&state, 32); // 256 bit
-        blake2b_update(&state, input, 80);
-        blake2b_update(&state, hash_root_mtp, MERKLE_TREE_ELEMENT_SIZE_B);
-        blake2b_update(&state, &n_nonce_internal, sizeof(unsigned int));
-        blake2b_final(&state, &y[0], sizeof(uint256));
-
-        // step 5
-        bool init_blocks = false;
-        for (uint32_t j = 1; j <= L; ++j) {
-            std::string s = "0x" + y[j - 1].GetHex();
-            boost::multiprecision::uint256_t t(s);
-            uint32_t ij = numeric_cast<uint32_t>(t % M_COST);
-            uint32_t except_index = numeric_cast<uint32_t>(M_COST / LANES);
-            if (((ij % except_index) == 0) || ((ij % except_index) == 1)) {
-                init_blocks = true;
-                break;
-            }
-
-            block blockhash;
-            copy_block(&blockhash, &instance.memory[ij]);
-            uint8_t blockhash_bytes[ARGON2_BLOCK_SIZE];
-            StoreBlock(&blockhash_bytes, &blockhash);
-            blake2b_state ctx_yj;
-            blake2b_init(&ctx_yj, 32);
-            blake2b_update(&ctx_yj, &y[j - 1], 32);
-            blake2b_update(&ctx_yj, blockhash_bytes, ARGON2_BLOCK_SIZE);
-            blake2b_final(&ctx_yj, &y[j], 32);
-            clear_internal_memory(blockhash.v, ARGON2_BLOCK_SIZE);
-            clear_internal_memory(blockhash_bytes, ARGON2_BLOCK_SIZE);
-
-            //storing blocks
-            uint32_t prev_index;
-            uint32_t ref_index;
-            GetBlockIndex(ij, &instance, &prev_index, &ref_index);
-            //previous block
-            copy_block(&blocks[(j * 2) - 2], &instance.memory[prev_index]);
-            //ref block
-            copy_block(&blocks[(j * 2) - 1], &instance.memory[ref_index]);
-
-            //storing proof
-            //TODO : make it as function please
-            //current proof
-            uint8_t digest_curr[MERKLE_TREE_ELEMENT_SIZE_B];
-            compute_blake2b(instance.memory[ij], digest_curr);
-            MerkleTree::Buffer hash_curr(digest_curr,
-                    digest_curr + sizeof(digest_curr));
-            MerkleTree::Elements proof_curr = ordered_tree.getProofOrdered(
-                    hash_curr, ij + 1);
-            proof_blocks[(j * 3) - 3] = proof_curr;
-
-            //prev proof
-            uint8_t digest_prev[MERKLE_TREE_ELEMENT_SIZE_B];
-            compute_blake2b(instance.memory[prev_index], digest_prev);
-            MerkleTree::Buffer hash_prev(digest_prev,
-                    digest_prev + sizeof(digest_prev));
-            MerkleTree::Elements proof_prev = ordered_tree.getProofOrdered(
-                    hash_prev, prev_index + 1);
-            proof_blocks[(j * 3) - 2] = proof_prev;
-
-            //ref proof
-            uint8_t digest_ref[MERKLE_TREE_ELEMENT_SIZE_B];
-            compute_blake2b(instance.memory[ref_index], digest_ref);
-            MerkleTree::Buffer hash_ref(digest_ref,
-                    digest_ref + sizeof(digest_ref));
-            MerkleTree::Elements proof_ref = ordered_tree.getProofOrdered(
-                    hash_ref, ref_index + 1);
-            proof_blocks[(j * 3) - 1] = proof_ref;
+    // step 2
+    uint8_t* leaves = tree_.leaves(instance_.memory_blocks);
+    run([this, leaves](unsigned lane) {
+        uint32_t begin = (uint64_t)instance_.memory_blocks * lane / LANES;
+        uint32_t end = (uint64_t)instance_.memory_blocks * (lane + 1) / LANES;
+        for (uint32_t i = begin; i < end; ++i) {
+            compute_blake2b(instance_.memory[i],
+                    leaves + (size_t)i * MERKLE_TREE_ELEMENT_SIZE_B);
         }
+    });
 
-        if (init_blocks) {
-            n_nonce_internal++;
-            continue;
-        }
+    tree_.build([this](const std::function<void(unsigned, unsigned)>& task) {
+        run([&task](unsigned lane) { task(lane, LANES); });
+    });
+    MerkleTree::Buffer root = tree_.getRoot();
+    std::copy(root.begin(), root.end(), root_);
+
+    filled_ = true;
+    return true;
+}
 
-        // step 6
-        if (bn_target.m_negative || (bn_target.m_target == 0) || bn_target.m_overflow
-                || (bn_target.m_target > UintToArith256(pow_limit))
-                || (UintToArith256(y[L]) > bn_target.m_target)) {
-            n_nonce_internal++;
-            continue;
+bool Solver::Impl::openings(uint32_t nonce, uint256 y[L + 1], uint32_t ij[L]) const
+{
+    static_assert((M_COST & (M_COST - 1)) == 0, "y[j] % M_COST only needs the low bits");
+    const uint32_t except_index = M_COST / LANES;
+
+    blake2b_state state;
+    blake2b_init(&state, 32); // 256 bit
+    blake2b_update(&state, input_, 80);
+    blake2b_update(&state, root_, MERKLE_TREE_ELEMENT_SIZE_B);
+    blake2b_update(&state, &nonce, sizeof(unsigned int));
+    blake2b_final(&state, &y[0], sizeof(uint256));
+
+    for (uint32_t j = 1; j <= L; ++j) {
+        uint32_t index = static_cast<uint32_t>(UintToArith256(y[j - 1]).GetLow64() % M_COST);
+        if (((index % except_index) == 0) || ((index % except_index) == 1)) {
+            return false;
         }
+        ij[j - 1] = index;
 
-        break;
+        uint8_t blockhash_bytes[ARGON2_BLOCK_SIZE];
+        StoreBlock(&blockhash_bytes, &instance_.memory[index]);
+        blake2b_state ctx_yj;
+        blake2b_init(&ctx_yj, 32);
+        blake2b_update(&ctx_yj, &y[j - 1], 32);
+        blake2b_update(&ctx_yj, blockhash_bytes, ARGON2_BLOCK_SIZE);
+        blake2b_final(&ctx_yj, &y[j], 32);
     }
+    return true;
+}
 
-    // step 7
-    std::copy(root.begin(), root.end(), hash_root_mtp);
+bool Solver::Impl::search(uint32_t target, uint256 const& pow_limit,
+        uint32_t& nonce, uint32_t count, uint256& output)
+{
+    assert(filled_);
 
-    nonce = n_nonce_internal;
-    for (int i = 0; i < L * 2; ++i) {
-        std::memcpy(block_mtp[i], &blocks[i],
-                sizeof(uint64_t) * ARGON2_QWORDS_IN_BLOCK);
-    }
-    for (int i = 0; i < L * 3; ++i) {
-        proof_mtp[i] = proof_blocks[i];
+    // UINT_MAX itself is never tried
+    const uint64_t end = std::min<uint64_t>((uint64_t)nonce + count, UINT_MAX);
+
+    // step 3
+    TargetHelper const bn_target(target);
+    if (bn_target.m_negative || (bn_target.m_target == 0) || bn_target.m_overflow
+            || (bn_target.m_target > UintToArith256(pow_limit))) {
+        nonce = end;
+        return false;
     }
-    std::memcpy(&output, &y[L], sizeof(uint256));
 
-    uint8_t h0[ARGON2_PREHASH_SEED_LENGTH];
-    std::memcpy(h0, instance.hash_zero,
-            sizeof(uint8_t) * ARGON2_PREHASH_SEED_LENGTH);
+    // steps 4 to 6: lane `l` tries every LANES-th nonce from `nonce + l` and
+    // stops once a lower solution is known
+    const uint64_t first = nonce;
+    std::atomic<uint64_t> found(end);
+    run([&](unsigned lane) {
+        uint256 y[L + 1];
+        uint32_t ij[L];
+        for (uint64_t n = first + lane; n < found.load(std::memory_order_relaxed); n += LANES) {
+            if (!openings(n, y, ij) || (UintToArith256(y[L]) > bn_target.m_target)) {
+                continue;
+            }
+            uint64_t best = found.load();
+            while (n < best && !found.compare_exchange_weak(best, n)) {
+            }
+            break;
+        }
+    });
 
-    // get hash_zero
-    uint8_t h0_computed[ARGON2_PREHASH_SEED_LENGTH];
-    initial_hash(h0_computed, &context, instance.type);
-    
-    free_memory(&context, (uint8_t *)instance.memory, instance.memory_blocks, sizeof(block));
+    if (found.load() == end) {
+        nonce = end;
+        return false;
+    }
+
+    nonce = found.load();
+    uint256 y[L + 1];
+    uint32_t ij[L];
+    openings(nonce, y, ij);
+    output = y[L];
     return true;
 }
 
-} // unnamed namespace
-
-void mtp_hash(const char* input, uint32_t target, uint8_t hash_root_mtp[16],
-        unsigned int& nonce, uint64_t block_mtp[MTP_L*2][128],
-        std::deque<std::vector<uint8_t>> proof_mtp[MTP_L*3], uint256 pow_limit,
-        uint256& output)
+void Solver::Impl::store(uint32_t nonce, uint8_t hash_root_mtp[16],
+        uint64_t block_mtp[MTP_L*2][128], ProofSet& proof_mtp)
 {
-    bool done = false;
-    while (!done) {
-        done = mtp_hash1(input, target, hash_root_mtp, nonce, block_mtp,
-                proof_mtp, pow_limit, output);
+    uint256 y[L + 1];
+    uint32_t ij[L];
+    bool valid = openings(nonce, y, ij);
+    assert(valid);
+
+    // step 7: only the solution needs its blocks and proofs
+    proof_mtp.clear();
+    for (uint32_t j = 1; j <= L; ++j) {
+        uint32_t prev_index;
+        uint32_t ref_index;
+        GetBlockIndex(ij[j - 1], &instance_, &prev_index, &ref_index);
+        std::memcpy(block_mtp[(j * 2) - 2], instance_.memory[prev_index].v,
+                sizeof(uint64_t) * ARGON2_QWORDS_IN_BLOCK);
+        std::memcpy(block_mtp[(j * 2) - 1], instance_.memory[ref_index].v,
+                sizeof(uint64_t) * ARGON2_QWORDS_IN_BLOCK);
+
+        const uint32_t opened[3] = { ij[j - 1], prev_index, ref_index };
+        for (int k = 0; k < 3; ++k) {
+            size_t index = (size_t)opened[k] + 1;
+            tree_.getProofOrdered(index, proof_mtp.append((j * 3) - 3 + k,
+                    tree_.getProofOrderedSize(index)));
+        }
     }
-}
 
+    std::copy(root_, root_ + MERKLE_TREE_ELEMENT_SIZE_B, hash_root_mtp);
 }
 
 namespace 
@@ -675,22 +786,49 @@ void serializeMtpHeader(CDataStream & stream, CBlockHeader const & header)
 }
 }
 
-uint256 hash(CBlockHeader & blockHeader, uint256 const & powLimit)
+Solver::Solver() : impl_(new Impl())
+{
+}
+
+Solver::~Solver()
 {
-    if(!blockHeader.mtpHashData)
-        blockHeader.mtpHashData = std::make_shared<CMTPHashData>();
+}
 
+bool Solver::prepare(const CBlockHeader& blockHeader)
+{
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     serializeMtpHeader(ss, blockHeader);
-    
+    return impl_->prepare(reinterpret_cast<char*>(&ss[0]));
+}
+
+bool Solver::search(CBlockHeader& blockHeader, uint256 const& powLimit,
+        uint32_t& nonce, uint32_t count, uint256& output)
+{
+    if (!impl_->search(blockHeader.nBits, powLimit, nonce, count, output))
+        return false;
+
+    // a new object, the old one may be shared with copies of the header
+    blockHeader.mtpHashData = std::make_shared<CMTPHashData>();
+    impl_->store(nonce, blockHeader.mtpHashData->hashRootMTP,
+            blockHeader.mtpHashData->nBlockMTP, blockHeader.mtpHashData->nProofMTP);
+    blockHeader.nNonce = nonce;
+    return true;
+}
+
+uint256 hash(CBlockHeader & blockHeader, uint256 const & powLimit)
+{
+    Solver solver;
+    if (!solver.prepare(blockHeader))
+        throw std::bad_alloc();
+
     uint256 result;
-    impl::mtp_hash(reinterpret_cast<char*>(&ss[0]), blockHeader.nBits, blockHeader.mtpHashData->hashRootMTP
-            , blockHeader.nNonce, blockHeader.mtpHashData->nBlockMTP, blockHeader.mtpHashData->nProofMTP, powLimit, result);
-    
+    uint32_t nonce = 0;
+    while (!solver.search(blockHeader, powLimit, nonce, UINT_MAX - nonce, result)) {
+        nonce = 0;
+    }
     return result;
 }
 
-
 bool verify(uint32_t nonce, CBlockHeader const & blockHeader, uint256 const & powLimit, uint256 *mtpHashValue)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
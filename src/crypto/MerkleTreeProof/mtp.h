@@ -6,6 +6,7 @@ extern "C" {
 }
 #include "uint256.h"
 #include <deque>
+#include <memory>
 #include <vector>
 
 class CBlockHeader;
@@ -16,6 +17,111 @@ namespace mtp
 /** L parameter for the MTP hash */
 constexpr int8_t MTP_L = 64;
 
+/** Size of a single Merkle tree node in an MTP proof (128 bit of blake2b) */
+constexpr size_t MTP_PROOF_NODE_SIZE = 16;
+
+/** Merkle proofs for every opening of an MTP solution
+ *
+ * There are `MTP_L*3` proofs, each a short list of 16-byte nodes. Instead of
+ * one heap buffer per node, all nodes are kept back to back in a single arena
+ * and proof `i` is described by the node offsets `[offsets[i], offsets[i+1])`.
+ * Proofs have to be filled in order, from 0 to `COUNT - 1`.
+ */
+class ProofSet
+{
+public:
+    static constexpr int COUNT = MTP_L * 3;
+
+    /** Typical depth of a proof, used to size the arena up front */
+    static constexpr size_t TYPICAL_DEPTH = 24;
+
+    ProofSet()
+    {
+        clear();
+    }
+
+    /** Drop all proofs, keeping the arena capacity */
+    void clear();
+
+    /** Number of nodes in proof `i` */
+    size_t size(int i) const
+    {
+        return i < filled_ ? offsets_[i + 1] - offsets_[i] : 0;
+    }
+
+    /** Total number of nodes in all proofs */
+    size_t nodes() const
+    {
+        return offsets_[filled_];
+    }
+
+    /** Pointer to the first node of proof `i` (size(i) nodes follow) */
+    const uint8_t* data(int i) const
+    {
+        return arena_.data() + (size_t)offsets_[i] * MTP_PROOF_NODE_SIZE;
+    }
+
+    /** Append proof `i` with `count` nodes and return where to write them
+     *
+     * All proofs before `i` must already have been appended.
+     */
+    uint8_t* append(int i, size_t count);
+
+    /** Fill the set from per-proof node lists, e.g. MerkleTree output */
+    void assign(const std::deque<std::vector<uint8_t>> proofs[COUNT]);
+
+private:
+    uint16_t offsets_[COUNT + 1]; //!< in nodes; COUNT*255 nodes fit in 16 bits
+    int filled_;                  //!< number of proofs appended so far
+    std::vector<uint8_t> arena_;
+};
+
+/** Reusable MTP solver state for a mining thread
+ *
+ * Filling the Argon2 memory (4 GiB) and building the Merkle tree over it only
+ * depends on the header fields covered by MTP, not on the nonce. A Solver
+ * keeps the memory, the leaf hashes and a pool of one thread per Argon2 lane
+ * alive between calls, so mining a header again after a nonce batch or a new
+ * template does not pay for allocation and page faults every time.
+ *
+ * A Solver is not thread safe; use one per mining thread.
+ */
+class Solver
+{
+public:
+    Solver();
+    ~Solver();
+
+    /** Fill the memory and build the Merkle tree for a block header
+     *
+     * Does nothing if the header fields covered by MTP did not change since
+     * the last call.
+     *
+     * \return `false` if the memory could not be allocated
+     */
+    bool prepare(const CBlockHeader& blockHeader);
+
+    /** Try up to `count` nonces starting at `nonce`, on all lanes
+     *
+     * On success the lowest solving nonce is stored into `nonce` and
+     * `blockHeader`, together with the MTP proof, and `output` is set to its
+     * hash. Otherwise `nonce` is advanced past the tried nonces.
+     * `prepare()` must have been called for `blockHeader` first.
+     *
+     * \param blockHeader [in/out] Block header being mined
+     * \param powLimit    [in]     Network limit (hash must be less than that)
+     * \param nonce       [in/out] First nonce to try / solution
+     * \param count       [in]     Number of nonces to try
+     * \param output      [out]    Resulting hash value for the solution
+     */
+    bool search(CBlockHeader& blockHeader, uint256 const& powLimit,
+            uint32_t& nonce, uint32_t count, uint256& output);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
 /** Solve the hash problem
  *
  * This function will try different nonce until it finds one such that the
@@ -42,30 +148,6 @@ bool verify(uint32_t nonce, CBlockHeader const & blockHeader, uint256 const & po
 //Implementation details
 namespace impl
 {
-    /** Solve the hash problem
- *
- * This function will try different nonce until it finds one such that the
- * computed hash is less than the `target` difficulty.
- *
- * \param input         [in]  Serialized block header
- * \param target        [in]  Target difficulty to achieve
- * \param hash_root_mtp [out] Root hash of the merkle tree
- * \param nonce         [out] Found nonce that satisfied the `target`
- * \param block_mtp     [out] Merkle tree leaves against which the hash has
- *                            been computed: 72*2 leaves of 1KiB each
- * \param proof_mtp     [out] Merkle proofs for every element in `block_mtp`
- * \param pow_limit     [in]  Network limit (hash must be less than that)
- * \param output        [out] Resulting hash value for the given `nonce`
- */
-void mtp_hash(const char* input,
-        uint32_t target,
-        uint8_t hash_root_mtp[16],
-        unsigned int& nonce,
-        uint64_t block_mtp[MTP_L*2][128],
-        std::deque<std::vector<uint8_t>> proof_mtp[MTP_L*3],
-        uint256 pow_limit,
-        uint256& output);
-
 /** Verify the given nonce does satisfy the given difficulty
  *
  * This function verifies that the provided `nonce` does produce a hash value
@@ -86,7 +168,7 @@ bool mtp_verify(const char* input,
         const uint8_t hash_root_mtp[16],
         const uint32_t nonce,
         const uint64_t block_mtp[MTP_L*2][128],
-        const std::deque<std::vector<uint8_t>> proof_mtp[MTP_L*3],
+        const ProofSet& proof_mtp,
         uint256 pow_limit,
         uint256 *mtpHashValue=nullptr);
 }
@@ -0,0 +1,128 @@
+/*
+ * mtp_avx2.c
+ *
+ * AVX2 versions of the MTP kernels, four 64-bit words per register.
+ * Built with -mavx -mavx2 and only called after simd.c checked the CPU.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "simd.h"
+#include "blake2/blake2-impl.h"
+#include "blake2/blamka-round-opt.h"
+
+static const uint64_t blake2b_IV[8] = {
+    UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+    UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+    UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+    UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)};
+
+/* blake2b_4r_compress only runs the first four rounds */
+static const unsigned int blake2b_sigma[4][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+};
+
+void fill_block_mtp_avx2(const block *prev_block, const block *ref_block,
+                         block *next_block, int with_xor, uint32_t block_index,
+                         const uint8_t *hash_zero) {
+    __m256i state[ARGON2_HWORDS_IN_BLOCK];
+    __m256i block_XY[ARGON2_HWORDS_IN_BLOCK];
+    unsigned int i;
+
+    for (i = 0; i < ARGON2_HWORDS_IN_BLOCK; i++) {
+        state[i] = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)prev_block->v + i),
+            _mm256_loadu_si256((const __m256i *)ref_block->v + i));
+        block_XY[i] = state[i];
+        if (with_xor) {
+            block_XY[i] = _mm256_xor_si256(
+                block_XY[i], _mm256_loadu_si256((const __m256i *)next_block->v + i));
+        }
+    }
+
+    /* v[14] = {0, block_index} as two 32-bit halves, v[16..19] = hash_zero */
+    state[3] = _mm256_insert_epi32(state[3], 0, 4);
+    state[3] = _mm256_insert_epi32(state[3], (int)block_index, 5);
+    state[4] = _mm256_loadu_si256((const __m256i *)hash_zero);
+
+    for (i = 0; i < 4; ++i) {
+        BLAKE2_ROUND_1(state[8 * i + 0], state[8 * i + 4], state[8 * i + 1],
+                       state[8 * i + 5], state[8 * i + 2], state[8 * i + 6],
+                       state[8 * i + 3], state[8 * i + 7]);
+    }
+
+    for (i = 0; i < 4; ++i) {
+        BLAKE2_ROUND_2(state[0 + i], state[4 + i], state[8 + i], state[12 + i],
+                       state[16 + i], state[20 + i], state[24 + i], state[28 + i]);
+    }
+
+    for (i = 0; i < ARGON2_HWORDS_IN_BLOCK; i++) {
+        _mm256_storeu_si256((__m256i *)next_block->v + i,
+                            _mm256_xor_si256(state[i], block_XY[i]));
+    }
+}
+
+#define G_MSG(A, B, C, D, M0, M1)                                              \
+    do {                                                                       \
+        A = _mm256_add_epi64(_mm256_add_epi64(A, B), M0);                      \
+        D = rotr32(_mm256_xor_si256(D, A));                                    \
+        C = _mm256_add_epi64(C, D);                                            \
+        B = rotr24(_mm256_xor_si256(B, C));                                    \
+        A = _mm256_add_epi64(_mm256_add_epi64(A, B), M1);                      \
+        D = rotr16(_mm256_xor_si256(D, A));                                    \
+        C = _mm256_add_epi64(C, D);                                            \
+        B = rotr63(_mm256_xor_si256(B, C));                                    \
+    } while ((void)0, 0)
+
+void blake2b_4r_compress_avx2(blake2b_state *S, const uint8_t *block) {
+    uint64_t m[16];
+    __m256i A, B, C, D;
+    unsigned int i, r;
+
+    for (i = 0; i < 16; ++i) {
+        m[i] = load64(block + i * sizeof(m[i]));
+    }
+
+    A = _mm256_loadu_si256((const __m256i *)&S->h[0]);
+    B = _mm256_loadu_si256((const __m256i *)&S->h[4]);
+    C = _mm256_loadu_si256((const __m256i *)&blake2b_IV[0]);
+    D = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&blake2b_IV[4]),
+                         _mm256_set_epi64x(S->f[1], S->f[0], S->t[1], S->t[0]));
+
+    for (r = 0; r < 4; ++r) {
+        const unsigned int *s = blake2b_sigma[r];
+
+        /* columns: lane i is G_i */
+        G_MSG(A, B, C, D,
+              _mm256_set_epi64x(m[s[6]], m[s[4]], m[s[2]], m[s[0]]),
+              _mm256_set_epi64x(m[s[7]], m[s[5]], m[s[3]], m[s[1]]));
+
+        B = _mm256_permute4x64_epi64(B, _MM_SHUFFLE(0, 3, 2, 1));
+        C = _mm256_permute4x64_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+        D = _mm256_permute4x64_epi64(D, _MM_SHUFFLE(2, 1, 0, 3));
+
+        /* diagonals: lane i is G_(i+4) */
+        G_MSG(A, B, C, D,
+              _mm256_set_epi64x(m[s[14]], m[s[12]], m[s[10]], m[s[8]]),
+              _mm256_set_epi64x(m[s[15]], m[s[13]], m[s[11]], m[s[9]]));
+
+        B = _mm256_permute4x64_epi64(B, _MM_SHUFFLE(2, 1, 0, 3));
+        C = _mm256_permute4x64_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+        D = _mm256_permute4x64_epi64(D, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+
+    _mm256_storeu_si256((__m256i *)&S->h[0],
+                        _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&S->h[0]),
+                                         _mm256_xor_si256(A, C)));
+    _mm256_storeu_si256((__m256i *)&S->h[4],
+                        _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&S->h[4]),
+                                         _mm256_xor_si256(B, D)));
+}
+
+#undef G_MSG
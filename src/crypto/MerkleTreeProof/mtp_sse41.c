@@ -0,0 +1,143 @@
+/*
+ * mtp_sse41.c
+ *
+ * SSE4.1 versions of the MTP kernels, two 64-bit words per register.
+ * Built with -msse4.1 and only called after simd.c checked the CPU.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "simd.h"
+#include "blake2/blake2-impl.h"
+#include "blake2/blamka-round-opt.h"
+
+static const uint64_t blake2b_IV[8] = {
+    UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+    UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+    UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+    UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)};
+
+/* blake2b_4r_compress only runs the first four rounds */
+static const unsigned int blake2b_sigma[4][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+};
+
+void fill_block_mtp_sse41(const block *prev_block, const block *ref_block,
+                          block *next_block, int with_xor, uint32_t block_index,
+                          const uint8_t *hash_zero) {
+    __m128i state[ARGON2_OWORDS_IN_BLOCK];
+    __m128i block_XY[ARGON2_OWORDS_IN_BLOCK];
+    unsigned int i;
+
+    for (i = 0; i < ARGON2_OWORDS_IN_BLOCK; i++) {
+        state[i] = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)prev_block->v + i),
+            _mm_loadu_si128((const __m128i *)ref_block->v + i));
+        block_XY[i] = state[i];
+        if (with_xor) {
+            block_XY[i] = _mm_xor_si128(
+                block_XY[i], _mm_loadu_si128((const __m128i *)next_block->v + i));
+        }
+    }
+
+    /* v[14] = {0, block_index} as two 32-bit halves, v[16..19] = hash_zero */
+    state[7] = _mm_insert_epi32(state[7], 0, 0);
+    state[7] = _mm_insert_epi32(state[7], (int)block_index, 1);
+    state[8] = _mm_loadu_si128((const __m128i *)hash_zero);
+    state[9] = _mm_loadu_si128((const __m128i *)(hash_zero + 16));
+
+    for (i = 0; i < 8; ++i) {
+        BLAKE2_ROUND(state[8 * i + 0], state[8 * i + 1], state[8 * i + 2],
+                     state[8 * i + 3], state[8 * i + 4], state[8 * i + 5],
+                     state[8 * i + 6], state[8 * i + 7]);
+    }
+
+    for (i = 0; i < 8; ++i) {
+        BLAKE2_ROUND(state[8 * 0 + i], state[8 * 1 + i], state[8 * 2 + i],
+                     state[8 * 3 + i], state[8 * 4 + i], state[8 * 5 + i],
+                     state[8 * 6 + i], state[8 * 7 + i]);
+    }
+
+    for (i = 0; i < ARGON2_OWORDS_IN_BLOCK; i++) {
+        _mm_storeu_si128((__m128i *)next_block->v + i,
+                         _mm_xor_si128(state[i], block_XY[i]));
+    }
+}
+
+#define G_MSG(A0, B0, C0, D0, A1, B1, C1, D1, M0, M1, R1, R2)                  \
+    do {                                                                       \
+        A0 = _mm_add_epi64(_mm_add_epi64(A0, B0), M0);                         \
+        A1 = _mm_add_epi64(_mm_add_epi64(A1, B1), M1);                         \
+        D0 = _mm_roti_epi64(_mm_xor_si128(D0, A0), R1);                        \
+        D1 = _mm_roti_epi64(_mm_xor_si128(D1, A1), R1);                        \
+        C0 = _mm_add_epi64(C0, D0);                                            \
+        C1 = _mm_add_epi64(C1, D1);                                            \
+        B0 = _mm_roti_epi64(_mm_xor_si128(B0, C0), R2);                        \
+        B1 = _mm_roti_epi64(_mm_xor_si128(B1, C1), R2);                        \
+    } while ((void)0, 0)
+
+void blake2b_4r_compress_sse41(blake2b_state *S, const uint8_t *block) {
+    uint64_t m[16];
+    __m128i A0, A1, B0, B1, C0, C1, D0, D1;
+    unsigned int i, r;
+
+    for (i = 0; i < 16; ++i) {
+        m[i] = load64(block + i * sizeof(m[i]));
+    }
+
+    A0 = _mm_loadu_si128((const __m128i *)&S->h[0]);
+    A1 = _mm_loadu_si128((const __m128i *)&S->h[2]);
+    B0 = _mm_loadu_si128((const __m128i *)&S->h[4]);
+    B1 = _mm_loadu_si128((const __m128i *)&S->h[6]);
+    C0 = _mm_loadu_si128((const __m128i *)&blake2b_IV[0]);
+    C1 = _mm_loadu_si128((const __m128i *)&blake2b_IV[2]);
+    D0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV[4]),
+                       _mm_loadu_si128((const __m128i *)&S->t[0]));
+    D1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV[6]),
+                       _mm_loadu_si128((const __m128i *)&S->f[0]));
+
+    for (r = 0; r < 4; ++r) {
+        const unsigned int *s = blake2b_sigma[r];
+
+        /* columns: lanes of A0/A1 are G0..G3 */
+        G_MSG(A0, B0, C0, D0, A1, B1, C1, D1,
+              _mm_set_epi64x(m[s[2]], m[s[0]]), _mm_set_epi64x(m[s[6]], m[s[4]]),
+              -32, -24);
+        G_MSG(A0, B0, C0, D0, A1, B1, C1, D1,
+              _mm_set_epi64x(m[s[3]], m[s[1]]), _mm_set_epi64x(m[s[7]], m[s[5]]),
+              -16, -63);
+
+        DIAGONALIZE(A0, B0, C0, D0, A1, B1, C1, D1);
+
+        /* diagonals: lanes of A0/A1 are G4..G7 */
+        G_MSG(A0, B0, C0, D0, A1, B1, C1, D1,
+              _mm_set_epi64x(m[s[10]], m[s[8]]), _mm_set_epi64x(m[s[14]], m[s[12]]),
+              -32, -24);
+        G_MSG(A0, B0, C0, D0, A1, B1, C1, D1,
+              _mm_set_epi64x(m[s[11]], m[s[9]]), _mm_set_epi64x(m[s[15]], m[s[13]]),
+              -16, -63);
+
+        UNDIAGONALIZE(A0, B0, C0, D0, A1, B1, C1, D1);
+    }
+
+    _mm_storeu_si128((__m128i *)&S->h[0],
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[0]),
+                                   _mm_xor_si128(A0, C0)));
+    _mm_storeu_si128((__m128i *)&S->h[2],
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[2]),
+                                   _mm_xor_si128(A1, C1)));
+    _mm_storeu_si128((__m128i *)&S->h[4],
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[4]),
+                                   _mm_xor_si128(B0, D0)));
+    _mm_storeu_si128((__m128i *)&S->h[6],
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[6]),
+                                   _mm_xor_si128(B1, D1)));
+}
+
+#undef G_MSG
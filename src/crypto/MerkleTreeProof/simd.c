@@ -0,0 +1,87 @@
+/*
+ * simd.c
+ *
+ * Picks the MTP kernels at runtime, the same way on every x86 CPU the binary
+ * runs on, so release builds can carry all implementations at once.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <string.h>
+
+#include "simd.h"
+
+#if (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_BITCOIN_INTERNAL) && \
+    (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define MTP_USE_SIMD 1
+#include <cpuid.h>
+#endif
+
+fill_block_mtp_fn fill_block_mtp = fill_block_mtp_ref;
+blake2b_4r_compress_fn blake2b_4r_compress = blake2b_4r_compress_ref;
+
+#if defined(MTP_USE_SIMD)
+static int cpu_has_sse41(void) {
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return 0;
+    }
+    return (c >> 19) & 1;
+}
+
+static int cpu_has_avx2(void) {
+    unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return 0;
+    }
+    /* AVX and OSXSAVE, then check that the OS saves the ymm registers */
+    if (!((c >> 27) & 1) || !((c >> 28) & 1)) {
+        return 0;
+    }
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) {
+        return 0;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 5) & 1;
+}
+#endif
+
+int mtp_select(const char *name) {
+    if (strcmp(name, "standard") == 0) {
+        fill_block_mtp = fill_block_mtp_ref;
+        blake2b_4r_compress = blake2b_4r_compress_ref;
+        return 1;
+    }
+#if defined(MTP_USE_SIMD) && defined(ENABLE_SSE41)
+    if (strcmp(name, "sse4.1") == 0 && cpu_has_sse41()) {
+        fill_block_mtp = fill_block_mtp_sse41;
+        blake2b_4r_compress = blake2b_4r_compress_sse41;
+        return 1;
+    }
+#endif
+#if defined(MTP_USE_SIMD) && defined(ENABLE_AVX2)
+    if (strcmp(name, "avx2") == 0 && cpu_has_avx2()) {
+        fill_block_mtp = fill_block_mtp_avx2;
+        blake2b_4r_compress = blake2b_4r_compress_avx2;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+const char *mtp_autodetect(void) {
+    if (mtp_select("avx2")) {
+        return "avx2";
+    }
+    if (mtp_select("sse4.1")) {
+        return "sse4.1";
+    }
+    mtp_select("standard");
+    return "standard";
+}
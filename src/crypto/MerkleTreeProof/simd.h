@@ -0,0 +1,55 @@
+/*
+ * simd.h
+ *
+ * Runtime selection between the portable and the SSE4.1/AVX2 versions of the
+ * two kernels MTP spends its time in: filling an Argon2 block and the 4-round
+ * Blake2b compression used for block digests and the Merkle tree.
+ */
+
+#ifndef SRC_SIMD_H_
+#define SRC_SIMD_H_
+
+#include <stdint.h>
+
+#include "core.h"
+#include "blake2/blake2.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef void (*fill_block_mtp_fn)(const block *prev_block, const block *ref_block,
+                                  block *next_block, int with_xor, uint32_t block_index,
+                                  const uint8_t *hash_zero);
+typedef void (*blake2b_4r_compress_fn)(blake2b_state *S, const uint8_t *block);
+
+/* Implementations in use; the portable ones until mtp_autodetect() is called */
+extern fill_block_mtp_fn fill_block_mtp;
+extern blake2b_4r_compress_fn blake2b_4r_compress;
+
+void fill_block_mtp_ref(const block *prev_block, const block *ref_block,
+                        block *next_block, int with_xor, uint32_t block_index,
+                        const uint8_t *hash_zero);
+void fill_block_mtp_sse41(const block *prev_block, const block *ref_block,
+                          block *next_block, int with_xor, uint32_t block_index,
+                          const uint8_t *hash_zero);
+void fill_block_mtp_avx2(const block *prev_block, const block *ref_block,
+                         block *next_block, int with_xor, uint32_t block_index,
+                         const uint8_t *hash_zero);
+
+void blake2b_4r_compress_ref(blake2b_state *S, const uint8_t *block);
+void blake2b_4r_compress_sse41(blake2b_state *S, const uint8_t *block);
+void blake2b_4r_compress_avx2(blake2b_state *S, const uint8_t *block);
+
+/* Switch to the fastest implementation this build and CPU support, returns its name */
+const char *mtp_autodetect(void);
+
+/* Switch to the named implementation ("standard", "sse4.1" or "avx2"),
+ * returns 0 if it is not built in or not supported by the CPU */
+int mtp_select(const char *name);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* SRC_SIMD_H_ */
@@ -2,12 +2,37 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "crypto/sha256.h"
 
 #include "crypto/common.h"
 
+#include <assert.h>
 #include <string.h>
 
+#if (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_BITCOIN_INTERNAL) && \
+    (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define SHA256_USE_SIMD 1
+#include <cpuid.h>
+#endif
+
+#if defined(SHA256_USE_SIMD) && defined(ENABLE_SSE41)
+namespace sha256_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(SHA256_USE_SIMD) && defined(ENABLE_AVX2)
+namespace sha256_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -127,7 +152,48 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Pad a message of at most 55 bytes into a single block. */
+void inline PadBlock(unsigned char* block, const unsigned char* data, size_t len)
+{
+    memcpy(block, data, len);
+    block[len] = 0x80;
+    memset(block + len + 1, 0, 56 - len - 1);
+    WriteBE64(block + 56, (uint64_t)len << 3);
+}
+
 } // namespace sha256
+
+/** Multi-way transform of single padded blocks from the initial state, see SHA256DShort(). */
+typedef void (*TransformMultiType)(unsigned char* out, const unsigned char* in);
+
+TransformMultiType TransformMulti = nullptr;
+size_t nTransformWays = 1;
+
+#if defined(SHA256_USE_SIMD)
+bool HaveSSE41()
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    return (c >> 19) & 1;
+}
+
+bool HaveAVX2()
+{
+    unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    // AVX and OSXSAVE, then check that the OS saves the ymm registers
+    if (!((c >> 27) & 1) || !((c >> 28) & 1))
+        return false;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6 || __get_cpuid_max(0, nullptr) < 7)
+        return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 5) & 1;
+}
+#endif
+
 } // namespace
 
 
@@ -187,3 +253,64 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+bool SHA256Select(const std::string& name)
+{
+    if (name == "standard") {
+        TransformMulti = nullptr;
+        nTransformWays = 1;
+        return true;
+    }
+#if defined(SHA256_USE_SIMD) && defined(ENABLE_AVX2)
+    if (name == "avx2(8way)" && HaveAVX2()) {
+        TransformMulti = sha256_avx2::Transform_8way;
+        nTransformWays = 8;
+        return true;
+    }
+#endif
+#if defined(SHA256_USE_SIMD) && defined(ENABLE_SSE41)
+    if (name == "sse4.1(4way)" && HaveSSE41()) {
+        TransformMulti = sha256_sse41::Transform_4way;
+        nTransformWays = 4;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string SHA256AutoDetect()
+{
+    if (SHA256Select("avx2(8way)"))
+        return "avx2(8way)";
+    if (SHA256Select("sse4.1(4way)"))
+        return "sse4.1(4way)";
+    SHA256Select("standard");
+    return "standard";
+}
+
+void SHA256DShort(unsigned char* output, const unsigned char* input, size_t len, size_t count)
+{
+    assert(len <= 55);
+    if (TransformMulti) {
+        unsigned char blocks[64 * 8];
+        const size_t ways = nTransformWays;
+        while (count >= ways) {
+            for (size_t i = 0; i < ways; i++)
+                sha256::PadBlock(blocks + 64 * i, input + len * i, len);
+            TransformMulti(output, blocks);
+            for (size_t i = 0; i < ways; i++)
+                sha256::PadBlock(blocks + 64 * i, output + 32 * i, 32);
+            TransformMulti(output, blocks);
+            input += len * ways;
+            output += 32 * ways;
+            count -= ways;
+        }
+    }
+    while (count--) {
+        unsigned char hash[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(input, len).Finalize(hash);
+        CSHA256().Write(hash, sizeof(hash)).Finalize(output);
+        input += len;
+        output += 32;
+    }
+}
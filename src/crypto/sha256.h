@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,22 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available SHA256 implementation for SHA256DShort().
+ *  Returns the name of the implementation.
+ */
+std::string SHA256AutoDetect();
+
+/** Switch SHA256DShort() to the named implementation ("standard",
+ *  "sse4.1(4way)" or "avx2(8way)"). Returns false if it is not built in or
+ *  not supported by the CPU.
+ */
+bool SHA256Select(const std::string& name);
+
+/** Compute the double-SHA256 of `count` messages of `len` bytes each, stored
+ *  back to back in `input`, into `count` 32-byte hashes in `output`.
+ *  `len` must be at most 55, so that each message fits a single block; the
+ *  messages are hashed 4 or 8 at a time when the CPU allows it.
+ */
+void SHA256DShort(unsigned char* output, const unsigned char* input, size_t len, size_t count);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
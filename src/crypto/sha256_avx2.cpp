@@ -0,0 +1,98 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way SHA-256 of single padded blocks, one message per 32-bit lane.
+// Built with -mavx -mavx2 and only called after sha256.cpp checked the CPU.
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256_avx2
+{
+namespace
+{
+__m256i inline K(uint32_t x) { return _mm256_set1_epi32(x); }
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w) { return Add(Add(x, y), Add(z, w)); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+__m256i inline ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+
+__m256i inline Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+__m256i inline Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m256i inline Sigma0(__m256i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+__m256i inline Sigma1(__m256i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+__m256i inline sigma0(__m256i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+__m256i inline sigma1(__m256i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+/** One round of SHA-256. */
+void inline Round(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, __m256i k)
+{
+    __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g), k);
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Word `offset` of the eight 64-byte blocks at `in`, one per lane */
+__m256i inline Read8(const unsigned char* in, int offset)
+{
+    return _mm256_set_epi32(ReadBE32(in + 448 + offset), ReadBE32(in + 384 + offset), ReadBE32(in + 320 + offset), ReadBE32(in + 256 + offset),
+                            ReadBE32(in + 192 + offset), ReadBE32(in + 128 + offset), ReadBE32(in + 64 + offset), ReadBE32(in + offset));
+}
+
+void inline Write8(unsigned char* out, int offset, __m256i v)
+{
+    WriteBE32(out + offset, _mm256_extract_epi32(v, 0));
+    WriteBE32(out + 32 + offset, _mm256_extract_epi32(v, 1));
+    WriteBE32(out + 64 + offset, _mm256_extract_epi32(v, 2));
+    WriteBE32(out + 96 + offset, _mm256_extract_epi32(v, 3));
+    WriteBE32(out + 128 + offset, _mm256_extract_epi32(v, 4));
+    WriteBE32(out + 160 + offset, _mm256_extract_epi32(v, 5));
+    WriteBE32(out + 192 + offset, _mm256_extract_epi32(v, 6));
+    WriteBE32(out + 224 + offset, _mm256_extract_epi32(v, 7));
+}
+
+const uint32_t k256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        s[i] = K(init[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read8(in, 4 * i);
+
+    for (int r = 0; r < 64; r++) {
+        if (r >= 16)
+            w[r & 15] = Add(w[r & 15], sigma1(w[(r - 2) & 15]), w[(r - 7) & 15], sigma0(w[(r - 15) & 15]));
+        // a..h rotate by one register per round
+        Round(s[(64 - r) & 7], s[(65 - r) & 7], s[(66 - r) & 7], s[(67 - r) & 7],
+              s[(68 - r) & 7], s[(69 - r) & 7], s[(70 - r) & 7], s[(71 - r) & 7],
+              Add(K(k256[r]), w[r & 15]));
+    }
+
+    for (int i = 0; i < 8; i++)
+        Write8(out, 4 * i, Add(s[i], K(init[i])));
+}
+}
@@ -16,9 +16,12 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/MerkleTreeProof/simd.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
+#include "mtpcache.h"
 #include "validation.h"
 #include "netbase.h"
 #include "net.h"
@@ -44,6 +47,7 @@
 #include "warnings.h"
 #include "mfcdns.h"
 #include "hooks.h"
+#include "namecoin.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -152,9 +156,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -245,6 +249,8 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pnameindex;
+        pnameindex = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -355,8 +361,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
+    strUsage += HelpMessageOpt("-mtpstore", strprintf(_("Keep MTP proofs of new blocks in separate mtp*.dat files, so that reading blocks for their transactions skips them. Can not be disabled again without deleting the block files (default: %u)"), DEFAULT_MTPSTORE));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parmtp=<n>", strprintf(_("Set the number of threads verifying MTP proofs of received blocks (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_MTPCHECK_THREADS, DEFAULT_MTPCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -465,6 +474,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxmtpcachesize=<n>", strprintf("Limit size of MTP proof verification cache to <n> MiB (default: %u)", DEFAULT_MAX_MTP_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
@@ -993,6 +1003,18 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -parmtp=0 means autodetect, a single core verifies MTP proofs on the message handler thread
+    nMTPCheckThreads = GetArg("-parmtp", DEFAULT_MTPCHECK_THREADS);
+    if (nMTPCheckThreads <= 0)
+        nMTPCheckThreads += GetNumCores();
+    if (nMTPCheckThreads <= 1)
+        nMTPCheckThreads = 0;
+    else if (nMTPCheckThreads > MAX_MTPCHECK_THREADS)
+        nMTPCheckThreads = MAX_MTPCHECK_THREADS;
+
+    // stays enabled when the block index says it was used before
+    fMTPStore = GetBoolArg("-mtpstore", DEFAULT_MTPSTORE);
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     // mfc - disabled until correctly implemented
     // int64_t nPruneArg = GetArg("-prune", 0);
@@ -1133,6 +1155,10 @@ bool AppInitSanityChecks()
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
+    // mfcoin: pick the fastest MTP and batched SHA256 kernels this CPU supports
+    LogPrintf("Using the '%s' MTP implementation\n", mtp_autodetect());
+    LogPrintf("Using the '%s' SHA256 implementation\n", SHA256AutoDetect());
+
     // mfcoin: init hash seed
     mfcoinRandseed = GetRand(1 << 30);
 
@@ -1184,6 +1210,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
     InitSignatureCache();
+    InitMTPCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
@@ -1191,6 +1218,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    LogPrintf("Using %u threads for MTP verification\n", nMTPCheckThreads);
+    for (int i=0; i<nMTPCheckThreads; i++)
+        threadGroup.create_thread(&ThreadMTPCheck);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1422,6 +1453,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nNameDBCache = std::min(nTotalCache / 8, nMaxNameDBCache << 20);
+    nTotalCache -= nNameDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1430,8 +1463,16 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for name index database\n", nNameDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
+    // mfcoin: name index used to be kept in BerkeleyDB files
+    {
+        boost::system::error_code err;
+        boost::filesystem::remove(GetDataDir() / "nameindex" / "nameindexV2.dat", err);
+        boost::filesystem::remove(GetDataDir() / "nameindex" / "nameaddress.dat", err);
+    }
+
     bool fLoaded = false;
     int fAuxReindex = 0;   // mfcoin: used when upgrading pre-auxpow blockindex
     while (!fLoaded) {
@@ -1448,16 +1489,19 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pnameindex;
 
-                if (fReindex)
-                {
-                    boost::system::error_code err;
-                    boost::filesystem::remove(GetDataDir() / "nameindex/nameindexV2.dat", err);
-                    boost::filesystem::remove(GetDataDir() / "nameindex/nameaddress.dat", err);
-                }
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
+                pnameindex = new CNameDB(nNameDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+
+                // mfcoin: convert a chainstate of the per-transaction format, if needed
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 if (fReindex) {
@@ -1543,6 +1587,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
+        // an interrupted chainstate upgrade resumes on the next start
+        if (!fLoaded && ShutdownRequested())
+            break;
+
         if (!fLoaded) {
             // first suggest a reindex
             if (!fReset) {
@@ -1585,37 +1633,38 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
-    if (!boost::filesystem::exists(GetDataDir() / "nameindex"))
-        boost::filesystem::create_directory(GetDataDir() / "nameindex");
-
-    // mfcoin: check if indexes need to be created or recreated
+    // mfcoin: (re)create name index if it does not match the chainstate
     // we should have block index fully loaded by now
-    boost::filesystem::path pathNameIndex = GetDataDir() / "nameindex" / "nameindexV2.dat";
-    boost::filesystem::path pathNameAddress = GetDataDir() / "nameindex" / "nameaddress.dat";
     extern bool createNameIndexes();
-    if (!boost::filesystem::exists(pathNameIndex))
+    if (pnameindex->GetVersion() != NAMEINDEX_VERSION)
+        pnameindex->SetCorrupt(); // written in another format, rebuild it
+    if (pnameindex->GetBestBlock() != pcoinsTip->GetBestBlock())
     {
-        // mfcoin: remove secondary index if we are re-creating first one (both will be re-created)
-        if (boost::filesystem::exists(pathNameAddress))
-            boost::filesystem::remove(pathNameAddress);
-
         uiInterface.InitMessage(_("Creating nameindex (do not close app!)..."));
+        bool fResume;
+        {
+            // an interrupted rebuild is continued from its last checkpoint
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(pnameindex->GetBestBlock());
+            fResume = mi != mapBlockIndex.end() && chainActive.Contains(mi->second);
+        }
+        if (!fResume)
+        {
+            delete pnameindex;
+            pnameindex = new CNameDB(nNameDBCache, false, true);
+        }
         if (!createNameIndexes())
         {
+            if (fRequestShutdown)
+            {
+                LogPrintf("Shutdown requested. Exiting.\n");
+                return false;
+            }
             LogPrintf("Fatal error: Failed to create name indexes.\n");
             return false;
         }
     }
 
-    // mfcoin: recreate secondary (address -> name) index if it was deleted
-    // it should only be created if primary index already exists
-    extern bool createNameAddressFile();
-    if (!boost::filesystem::exists(GetDataDir() / "nameindex" / "nameaddress.dat") && !createNameAddressFile())
-    {
-        LogPrintf("Fatal error: Failed to create secondary index nameaddress.dat.\n");
-        return false;
-    }
-
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1746,10 +1795,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         string tf      = GetArg("-enumtollfree", "");
 	uint32_t dapzs = GetArg("-dapsize", 0);
 	uint32_t dapth = GetArg("-daptreshold", MFCDNS_DAPTRESHOLD);
+        int threads = GetArg("-mfcdnsthreads", MFCDNS_THREADS);
+        uint32_t cachesize = GetArg("-mfcdnscachesize", MFCDNS_CACHESIZE);
         mfcdns = new MfcDns(bind_ip.c_str(), port,
         suffix.c_str(), allowed.c_str(), localcf.c_str(),
 	dapzs, dapth,
-	enums.c_str(), tf.c_str(), verbose);
+	enums.c_str(), tf.c_str(), verbose, threads, cachesize);
         LogPrintf("DNS server started\n");
     }
 
@@ -7,11 +7,18 @@
 #include "chainparams.h"
 #include "validation.h"
 #include "streams.h"
-#include "uint256hm.h"
-#include "wallet/wallet.h"
+#include "script/interpreter.h"
 #include "timedata.h"
 #include "consensus/validation.h"
 #include "txdb.h"
+#include "txreader.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <set>
 
 using namespace std;
 
@@ -54,91 +61,166 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
-static bool SelectBlockFromCandidates(
-    vector<pair<const CBlockIndex*, arith_uint256> >& vSortedByTimestamp,
-    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev,
-    const CBlockIndex** pindexSelected)
+// Order of the candidate blocks for stake modifier selection: by timestamp,
+// then by block hash as a number
+struct CStakeCandidateOrder
 {
-    arith_uint256 zero = 0;
-    pair<const CBlockIndex*, arith_uint256> *itemSelected = NULL;
+    bool operator()(const CBlockIndex* a, const CBlockIndex* b) const
+    {
+        if (a->GetBlockTime() != b->GetBlockTime())
+            return a->GetBlockTime() < b->GetBlockTime();
+        return UintToArith256(a->GetBlockHash()) < UintToArith256(b->GetBlockHash());
+    }
+};
 
-    for (auto& item : vSortedByTimestamp) {
-        const CBlockIndex* pindex = item.first;
-        if (pindex == NULL)
-            continue; // This block already has been selected
+// Selection of the blocks contributing to a new stake modifier. Each round
+// selects, among the candidates not yet selected with timestamp up to the
+// round's nSelectionIntervalStop, the one with the lowest selection hash
+// (the first in candidate order on a tie), or the next candidate if there
+// is none. As the stop time only grows, candidates are hashed once, when
+// they come within it, and kept in a pool ordered by selection hash.
+class CStakeModifierSelection
+{
+private:
+    const vector<const CBlockIndex*>& vSortedByTimestamp;
+    uint64_t nStakeModifierPrev;
+    size_t nNext; // first candidate not in the pool nor selected
+    std::set<pair<arith_uint256, size_t> > setPool;
+
+    // compute the selection hash by hashing its proof-hash and the
+    // previous proof-of-stake modifier
+    arith_uint256 GetSelectionHash(const CBlockIndex* pindex) const
+    {
+        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
+        CDataStream ss(SER_GETHASH, 0);
+        ss << hashProof << nStakeModifierPrev;
+        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
+        // the selection hash is divided by 2**32 so that proof-of-stake block
+        // is always favored over proof-of-work block. this is to preserve
+        // the energy efficiency property
+        if (pindex->IsProofOfStake())
+            hashSelection >>= 32;
+        return hashSelection;
+    }
 
-        if (itemSelected != NULL && pindex->GetBlockTime() > nSelectionIntervalStop)
-            break;
+public:
+    CStakeModifierSelection(const vector<const CBlockIndex*>& vSortedByTimestampIn, uint64_t nStakeModifierPrevIn) :
+        vSortedByTimestamp(vSortedByTimestampIn), nStakeModifierPrev(nStakeModifierPrevIn), nNext(0) {}
 
-        if (itemSelected == NULL || item.second < itemSelected->second) {
-            // compute the selection hash by hashing its proof-hash and the
-            // previous proof-of-stake modifier
-            if (item.second == zero) {
-                uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-                CDataStream ss(SER_GETHASH, 0);
-                ss << hashProof << nStakeModifierPrev;
-                item.second = UintToArith256(Hash(ss.begin(), ss.end()));
-                // the selection hash is divided by 2**32 so that proof-of-stake block
-                // is always favored over proof-of-work block. this is to preserve
-                // the energy efficiency property
-                if (pindex->IsProofOfStake())
-                    item.second >>= 32;
-
-                if (itemSelected != NULL && item.second >= itemSelected->second)
-                    continue;
-            }
-            itemSelected = &item;
+    bool Select(int64_t nSelectionIntervalStop, const CBlockIndex** pindexSelected)
+    {
+        for (; nNext < vSortedByTimestamp.size() && vSortedByTimestamp[nNext]->GetBlockTime() <= nSelectionIntervalStop; nNext++)
+            setPool.insert(make_pair(GetSelectionHash(vSortedByTimestamp[nNext]), nNext));
+
+        if (!setPool.empty()) {
+            *pindexSelected = vSortedByTimestamp[setPool.begin()->second];
+            setPool.erase(setPool.begin());
+            return true;
+        }
+        if (nNext < vSortedByTimestamp.size()) {
+            *pindexSelected = vSortedByTimestamp[nNext++];
+            return true;
         }
-    } // for
- 
-    if (itemSelected) {
-        *pindexSelected = itemSelected->first;
-        itemSelected->first = NULL;
-        return true;
-    } else {
         *pindexSelected = (const CBlockIndex*) 0;
         return false;
     }
+};
 
-  //  if (fDebug && GetBoolArg("-printstakemodifier", false))
-  //      LogPrintf("%s: selection hash=%s\n", __func__, hashBest.ToString());
+// Start of the selection interval of the modifier that would follow pindexPrev
+static int64_t GetStakeModifierSelectionIntervalStart(const CBlockIndex* pindexPrev)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    return (pindexPrev->GetBlockTime() / params.nStakeModifierInterval) * params.nStakeModifierInterval - GetStakeModifierSelectionInterval();
 }
 
-static void SwapSort(vector<pair<const CBlockIndex*, arith_uint256> > &v, unsigned pos) {
-  if(pos >= v.size() - 1)
-	  return;
-
-  pair<const CBlockIndex*, arith_uint256> &a = v[pos];
-  pair<const CBlockIndex*, arith_uint256> &b = v[pos + 1];
-
-  if (a.first->GetBlockTime() < b.first->GetBlockTime())
-    return;
-  
-  if (a.first->GetBlockTime() == b.first->GetBlockTime()) {
- 
-    const uint256& ha = a.first->GetBlockHash(); // needed because of weird g++ (5.4.0 20160609) bug
-    const uint256& hb = b.first->GetBlockHash();
-    const uint32_t *pa = ha.GetDataPtr();
-    const uint32_t *pb = hb.GetDataPtr();
-    int cnt = 256 / 32;
-    for( ; ; ) {
-      --cnt;
-      if(pa[cnt] < pb[cnt])
-	return;
-      if(pa[cnt] > pb[cnt]) 
-        break; // go to swap
-      if(cnt == 0)
-	return;
-    }
-  }
-
-  std::swap(a, b);
-  SwapSort(v, pos - 1);
-  SwapSort(v, pos + 1);
-} // SwapSort
+// mfcoin: the candidate blocks for the next stake modifier after the tip of
+// the active chain, that is the blocks walking back from the tip down to the
+// first one older than the selection interval start, kept sorted in
+// CStakeCandidateOrder as blocks are connected and disconnected, so that
+// generating a modifier needs neither a walk nor a sort
+class CStakeModifierCandidates
+{
+private:
+    std::deque<const CBlockIndex*> vByHeight;
+    std::set<const CBlockIndex*, CStakeCandidateOrder> setSorted;
+    const CBlockIndex* pindexTip;
+
+    void PushBack(const CBlockIndex* pindex)
+    {
+        vByHeight.push_back(pindex);
+        setSorted.insert(pindex);
+    }
+
+    void PopBack()
+    {
+        setSorted.erase(vByHeight.back());
+        vByHeight.pop_back();
+    }
+
+    // Fit the window to the selection interval start of a new tip
+    void Rebase()
+    {
+        if (!pindexTip) {
+            vByHeight.clear();
+            setSorted.clear();
+            return;
+        }
+        int64_t nSelectionIntervalStart = GetStakeModifierSelectionIntervalStart(pindexTip);
+
+        // drop the last block older than the start and everything below it
+        int nHeightBreak = -1;
+        for (auto it = setSorted.begin(); it != setSorted.end() && (*it)->GetBlockTime() < nSelectionIntervalStart; ++it)
+            nHeightBreak = std::max(nHeightBreak, (*it)->nHeight);
+        while (!vByHeight.empty() && vByHeight.front()->nHeight <= nHeightBreak) {
+            setSorted.erase(vByHeight.front());
+            vByHeight.pop_front();
+        }
+
+        // or take in the blocks below that are now recent enough
+        const CBlockIndex* pindex = vByHeight.empty() ? pindexTip : vByHeight.front()->pprev;
+        for (; pindex && pindex->GetBlockTime() >= nSelectionIntervalStart; pindex = pindex->pprev) {
+            vByHeight.push_front(pindex);
+            setSorted.insert(pindex);
+        }
+    }
+
+public:
+    CStakeModifierCandidates() : pindexTip(NULL) {}
+
+    const CBlockIndex* Tip() const { return pindexTip; }
+
+    void Clear()
+    {
+        vByHeight.clear();
+        setSorted.clear();
+        pindexTip = NULL;
+    }
+
+    void Sync(const CChain& chain)
+    {
+        if (pindexTip == chain.Tip())
+            return;
+        const CBlockIndex* pindexFork = pindexTip ? chain.FindFork(pindexTip) : NULL;
+        while (!vByHeight.empty() && (!pindexFork || vByHeight.back()->nHeight > pindexFork->nHeight))
+            PopBack();
+        if (!vByHeight.empty() && vByHeight.back() == pindexFork) {
+            for (int nHeight = pindexFork->nHeight + 1; nHeight <= chain.Height(); nHeight++)
+                PushBack(chain[nHeight]);
+        } else {
+            vByHeight.clear();
+            setSorted.clear();
+        }
+        pindexTip = chain.Tip();
+        Rebase();
+    }
+
+    void GetSorted(vector<const CBlockIndex*>& vSortedByTimestamp) const
+    {
+        vSortedByTimestamp.assign(setSorted.begin(), setSorted.end());
+    }
+};
+
+static CStakeModifierCandidates stakeModifierCandidates;
 
 
 // Stake Modifier (hash modifier of proof-of-stake):
@@ -198,68 +280,31 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     }
 
     // Sort candidate blocks by timestamp
-    vector<pair<const CBlockIndex*, arith_uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * params.nStakeModifierInterval / params.nStakeTargetSpacing + 1);
-    int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
-    int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / params.nStakeModifierInterval) * params.nStakeModifierInterval - nSelectionInterval;
-    const CBlockIndex* pindex = pindexPrev;
-    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    vector<const CBlockIndex*> vSortedByTimestamp;
+    int64_t nSelectionIntervalStart = GetStakeModifierSelectionIntervalStart(pindexPrev);
+    UpdateStakeModifierIndex();
+    if (stakeModifierCandidates.Tip() == pindexPrev)
+        stakeModifierCandidates.GetSorted(vSortedByTimestamp);
+    else
     {
-        if (!mapBlockIndex.count(pindex->GetBlockHash()))
-            return error("%s: failed to find block index for candidate block %s", __func__, pindex->GetBlockHash().ToString());
-        vSortedByTimestamp.push_back(make_pair(pindex, 0));
-        pindex = pindex->pprev;
+        // not connecting on top of the active chain
+        vSortedByTimestamp.reserve(64 * params.nStakeModifierInterval / params.nStakeTargetSpacing + 1);
+        for (const CBlockIndex* pindex = pindexPrev; pindex && pindex->GetBlockTime() >= nSelectionIntervalStart; pindex = pindex->pprev)
+            vSortedByTimestamp.push_back(pindex);
+        sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(), CStakeCandidateOrder());
     }
 
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    for(int i = 0; i < (int)vSortedByTimestamp.size() - 1; i++)
-	    SwapSort(vSortedByTimestamp, i);
-
-#if 0
-
-    vs2 = vSortedByTimestamp;
-    reverse(vs2.begin(), vs2.end());
-    for(int i = 0; i < vs2.size() - 1; i++)
-	    SwapSort(vs2, i);
-
-
-    // Shuffle before sort
-    uint32_t rnd = GetRand(1 << 30);
-    for (int i = vSortedByTimestamp.size() - 1, j = (i >> 2) | 1; i > j; --i)
-        std::swap(vSortedByTimestamp[i], vSortedByTimestamp[(rnd = rnd * 22695477 + 1) % i]);
-
-
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(), [] (const pair<const CBlockIndex*, arith_uint256> &a, const pair<const CBlockIndex*, arith_uint256> &b)
-    {
-        if (a.first->GetBlockTime() != b.first->GetBlockTime())
-            return a.first->GetBlockTime() < b.first->GetBlockTime();
-        // Timestamp equals - compare block hashes
-        const uint256& ha = a.first->GetBlockHash(); // needed because of weird g++ (5.4.0 20160609) bug
-        const uint256& hb = b.first->GetBlockHash();
-        const uint32_t *pa = ha.GetDataPtr();
-        const uint32_t *pb = hb.GetDataPtr();
-        int cnt = 256 / 32;
-        do {
-            --cnt;
-            if(pa[cnt] != pb[cnt])
-                return pa[cnt] < pb[cnt];
-        } while(cnt);
-        return false; // Elements are equal
-    });
-
-
-    // LogPrintf("DBG: ArrSZ=%u, sor1=%u sor2=%u\n", (unsigned)vSortedByTimestamp.size(), sor1, sor2);
-#endif
-
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
+    CStakeModifierSelection selection(vSortedByTimestamp, nStakeModifier);
+    const CBlockIndex* pindex = NULL;
     for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, nSelectionIntervalStop, nStakeModifier, &pindex))
+        if (!selection.Select(nSelectionIntervalStop, &pindex))
             return error("%s: unable to select block at round %d", __func__, nRound);
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
@@ -277,50 +322,194 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     return true;
 }
 
-struct StakeMod
+// mfcoin: blocks of the active chain that generated a stake modifier, in
+// height order, with a segment tree of the min and max of their block times.
+// Block times are not monotonic, so the tree is what lets the kernel
+// modifier lookups below find "last generated at or before time T" and
+// "first generated at or after time T" in O(log n) instead of walking the
+// chain. It is derived from the stake modifier fields that are stored with
+// the block index, rebuilt from chainActive once the block index is loaded
+// and kept up to date from UpdateTip() on every connect and disconnect.
+class CStakeModifierIndex
 {
-    uint64_t nStakeModifier;
-    int64_t nStakeModifierTime;
-    int nStakeModifierHeight;
+private:
+    std::vector<const CBlockIndex*> vGenerated;
+    std::vector<int64_t> vMinTime; // tree nodes, root at 1, leaves at nCapacity + i
+    std::vector<int64_t> vMaxTime;
+    size_t nCapacity;
+    const CBlockIndex* pindexSynced;
+
+    void SetLeaf(size_t i, const CBlockIndex* pindex)
+    {
+        size_t node = nCapacity + i;
+        vMinTime[node] = pindex ? pindex->GetBlockTime() : std::numeric_limits<int64_t>::max();
+        vMaxTime[node] = pindex ? pindex->GetBlockTime() : std::numeric_limits<int64_t>::min();
+        for (node /= 2; node > 0; node /= 2) {
+            vMinTime[node] = std::min(vMinTime[2 * node], vMinTime[2 * node + 1]);
+            vMaxTime[node] = std::max(vMaxTime[2 * node], vMaxTime[2 * node + 1]);
+        }
+    }
+
+    void Push(const CBlockIndex* pindex)
+    {
+        if (vGenerated.size() == nCapacity) {
+            nCapacity = std::max<size_t>(2 * nCapacity, 1024);
+            vMinTime.assign(2 * nCapacity, std::numeric_limits<int64_t>::max());
+            vMaxTime.assign(2 * nCapacity, std::numeric_limits<int64_t>::min());
+            for (size_t i = 0; i < vGenerated.size(); i++) {
+                vMinTime[nCapacity + i] = vMaxTime[nCapacity + i] = vGenerated[i]->GetBlockTime();
+            }
+            for (size_t node = nCapacity - 1; node > 0; node--) {
+                vMinTime[node] = std::min(vMinTime[2 * node], vMinTime[2 * node + 1]);
+                vMaxTime[node] = std::max(vMaxTime[2 * node], vMaxTime[2 * node + 1]);
+            }
+        }
+        vGenerated.push_back(pindex);
+        SetLeaf(vGenerated.size() - 1, pindex);
+    }
+
+    void Pop()
+    {
+        SetLeaf(vGenerated.size() - 1, NULL);
+        vGenerated.pop_back();
+    }
+
+    // Position of the first generating block above nHeight
+    size_t Position(int nHeight) const
+    {
+        return std::upper_bound(vGenerated.begin(), vGenerated.end(), nHeight,
+            [](int h, const CBlockIndex* pindex) { return h < pindex->nHeight; }) - vGenerated.begin();
+    }
+
+    // Last leaf in [lo, hi) of node, before nEnd, with time <= nTime
+    size_t FindLast(size_t node, size_t lo, size_t hi, size_t nEnd, int64_t nTime) const
+    {
+        if (lo >= nEnd || vMinTime[node] > nTime)
+            return SIZE_MAX;
+        if (hi - lo == 1)
+            return lo;
+        size_t mid = (lo + hi) / 2;
+        size_t n = FindLast(2 * node + 1, mid, hi, nEnd, nTime);
+        return n != SIZE_MAX ? n : FindLast(2 * node, lo, mid, nEnd, nTime);
+    }
+
+    // First leaf in [lo, hi) of node, within [nBegin, nEnd), with time >= nTime
+    size_t FindFirst(size_t node, size_t lo, size_t hi, size_t nBegin, size_t nEnd, int64_t nTime) const
+    {
+        if (hi <= nBegin || lo >= nEnd || vMaxTime[node] < nTime)
+            return SIZE_MAX;
+        if (hi - lo == 1)
+            return lo;
+        size_t mid = (lo + hi) / 2;
+        size_t n = FindFirst(2 * node, lo, mid, nBegin, nEnd, nTime);
+        return n != SIZE_MAX ? n : FindFirst(2 * node + 1, mid, hi, nBegin, nEnd, nTime);
+    }
+
+public:
+    CStakeModifierIndex() : nCapacity(0), pindexSynced(NULL) {}
+
+    void Clear()
+    {
+        vGenerated.clear();
+        vMinTime.clear();
+        vMaxTime.clear();
+        nCapacity = 0;
+        pindexSynced = NULL;
+    }
+
+    // Follow the chain from the tip seen last time: drop the blocks that
+    // were disconnected since and add the ones that were connected
+    void Sync(const CChain& chain)
+    {
+        if (pindexSynced == chain.Tip())
+            return;
+        const CBlockIndex* pindexFork = pindexSynced ? chain.FindFork(pindexSynced) : NULL;
+        int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+        while (!vGenerated.empty() && vGenerated.back()->nHeight > nForkHeight)
+            Pop();
+        for (int nHeight = nForkHeight + 1; nHeight <= chain.Height(); nHeight++)
+            if (chain[nHeight]->GeneratedStakeModifier())
+                Push(chain[nHeight]);
+        pindexSynced = chain.Tip();
+    }
+
+    // Last generating block at or below nHeight with block time <= nTime
+    const CBlockIndex* FindLastBefore(int nHeight, int64_t nTime) const
+    {
+        size_t n = vGenerated.empty() ? SIZE_MAX : FindLast(1, 0, nCapacity, Position(nHeight), nTime);
+        return n != SIZE_MAX ? vGenerated[n] : NULL;
+    }
+
+    // First generating block in (nHeightFrom, nHeightTo] with block time >= nTime
+    const CBlockIndex* FindFirstAfter(int nHeightFrom, int nHeightTo, int64_t nTime) const
+    {
+        size_t n = vGenerated.empty() ? SIZE_MAX : FindFirst(1, 0, nCapacity, Position(nHeightFrom), Position(nHeightTo), nTime);
+        return n != SIZE_MAX ? vGenerated[n] : NULL;
+    }
 };
 
+static CStakeModifierIndex stakeModifierIndex;
+
+void UpdateStakeModifierIndex()
+{
+    AssertLockHeld(cs_main);
+    stakeModifierIndex.Sync(chainActive);
+    stakeModifierCandidates.Sync(chainActive);
+}
+
+void UnloadStakeModifierIndex()
+{
+    AssertLockHeld(cs_main);
+    stakeModifierIndex.Clear();
+    stakeModifierCandidates.Clear();
+}
+
 // V0.5: Stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier that is (nStakeMinAge minus a selection interval) earlier than the
 // stake, thus at least a selection interval later than the coin generating the // kernel, as the generating coin is from at least nStakeMinAge ago.
 static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     const Consensus::Params& params = Params().GetConsensus();
-    const CBlockIndex* pindex = pindexPrev;
-    nStakeModifierHeight = pindex->nHeight;
-    nStakeModifierTime = pindex->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
+    // the modifier must be generated at or before this time
+    int64_t nTimeModifierMax = (int64_t) nTimeTx - params.nStakeMinAge + nStakeModifierSelectionInterval;
 
-    if (nStakeModifierTime + params.nStakeMinAge - nStakeModifierSelectionInterval <= (int64_t) nTimeTx)
+    if (pindexPrev->GetBlockTime() <= nTimeModifierMax)
     {
         // Best block is still more than
         // (nStakeMinAge minus a selection interval) older than kernel timestamp
         if (fPrintProofOfStake)
             return error("GetKernelStakeModifier() : best block %s at height %d too old for stake",
-                pindex->GetBlockHash().ToString(), pindex->nHeight);
+                pindexPrev->GetBlockHash().ToString(), pindexPrev->nHeight);
         else
             return false;
     }
-    // loop to find the stake modifier earlier by
-    // (nStakeMinAge minus a selection interval)
-    while (nStakeModifierTime + params.nStakeMinAge - nStakeModifierSelectionInterval >(int64_t) nTimeTx)
+
+    // Find the last modifier earlier by (nStakeMinAge minus a selection
+    // interval) among the blocks before pindexPrev: first in the blocks of
+    // its branch that are not in the active chain, then in the index
+    const CBlockIndex* pindexGenerated = NULL;
+    const CBlockIndex* pindex = pindexPrev->pprev;
+    for (; pindex && !chainActive.Contains(pindex); pindex = pindex->pprev)
     {
-        if (!pindex->pprev)
-        {   // reached genesis block; should not happen
-            return error("GetKernelStakeModifier() : reached genesis block");
-        }
-        pindex = pindex->pprev;
-        if (pindex->GeneratedStakeModifier())
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() <= nTimeModifierMax)
         {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
+            pindexGenerated = pindex;
+            break;
         }
     }
-    nStakeModifier = pindex->nStakeModifier;
+    if (!pindexGenerated && pindex)
+    {
+        UpdateStakeModifierIndex();
+        pindexGenerated = stakeModifierIndex.FindLastBefore(pindex->nHeight, nTimeModifierMax);
+    }
+    if (!pindexGenerated)
+    {   // reached genesis block; should not happen
+        return error("GetKernelStakeModifier() : reached genesis block");
+    }
+    nStakeModifierHeight = pindexGenerated->nHeight;
+    nStakeModifierTime = pindexGenerated->GetBlockTime();
+    nStakeModifier = pindexGenerated->nStakeModifier;
     return true;
 }
 
@@ -329,110 +518,57 @@ static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTim
 static bool GetKernelStakeModifierV03(CBlockIndex* pindexPrev, uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     const Consensus::Params& params = Params().GetConsensus();
-#ifdef ENABLE_WALLET
-    // init internal cache for stake modifiers (this is used only to reduce CPU usage)
-    static uint256HashMap<StakeMod> StakeModCache;
-    static bool initCache = false;
-    if (initCache == false)
-    {
-        if (pwalletMain) {
-            std::vector<COutput> vCoins;
-            pwalletMain->AvailableCoins(vCoins, false);
-            StakeModCache.Set(vCoins.size() + 1000);
-        } else
-            StakeModCache.Set(100);
-        initCache = true;
-    }
-
-    // Clear cache after every new block.
-    // If cache is not cleared here it will result in blockchain unable to be downloaded.
-    static int nClrHeight = 0;
-    bool fSameBlock;
-
-    if (nClrHeight != pindexPrev->nHeight)
-    {
-        nClrHeight = pindexPrev->nHeight;
-        StakeModCache.clear();
-        fSameBlock = false;
-    }
-    else
-    {
-        uint256HashMap<StakeMod>::Data *pcache = StakeModCache.Search(hashBlockFrom);
-        if (pcache != NULL)
-        {
-            nStakeModifier = pcache->value.nStakeModifier;
-            nStakeModifierHeight = pcache->value.nStakeModifierHeight;
-            nStakeModifierTime = pcache->value.nStakeModifierTime;
-            return true;
-        }
-        fSameBlock = true;
-    }
-#endif
 
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end())
         return error("%s: block not indexed", __func__);
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
-    nStakeModifierHeight = pindexFrom->nHeight;
-    nStakeModifierTime = pindexFrom->GetBlockTime();
+    const CBlockIndex* pindexFrom = mi->second;
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
+    // the modifier must be generated at or after this time
+    int64_t nTimeModifierMin = pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval;
 
-    // mfcoin: we need to iterate index forward but we cannot use chainActive.Next()
-    // because there is no guarantee that we are checking blocks in active chain.
-    // So, we construct a temporary chain that we will iterate over.
+    // mfcoin: pindexPrev need not be in the active chain, so the blocks of its
+    // branch above the fork point are searched apart from the index; as with
+    // the forward walk this replaces, a pindexPrev in the active chain is
+    // searched up to the tip.
     // pindexFrom - this block contains coins that are used to generate PoS
     // pindexPrev - this is a block that is previous to PoS block that we are checking, you can think of it as tip of our chain
-    // tmpChain should contain all indexes in [pindexFrom..pindexPrev] (inclusive)
-    std::vector<CBlockIndex*> tmpChain;
-    int32_t nDepth = pindexPrev->nHeight - (pindexFrom->nHeight-1); // -1 is used to also include pindexFrom
-    tmpChain.reserve(nDepth);
-    CBlockIndex* it = pindexPrev;
-    for (int i=1; i<=nDepth && !chainActive.Contains(it); i++) {
-        tmpChain.push_back(it);
-        it = it->pprev;
-    }
-
-    std::reverse(tmpChain.begin(), tmpChain.end());
-
-    size_t n = 0;
-    const CBlockIndex* pindex = pindexFrom;
-    // loop to find the stake modifier later by a selection interval
-    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval)
-    {
-        const CBlockIndex* old_pindex = pindex;
-        pindex = (!tmpChain.empty() && pindex->nHeight >= tmpChain[0]->nHeight - 1)? tmpChain[n++] : chainActive.Next(pindex); 
-        if (n > tmpChain.size() || pindex == NULL) // check if tmpChain[n+1] exists
-        {   // reached best block; may happen if node is behind on block chain
-            if (fPrintProofOfStake || (old_pindex->GetBlockTime() + params.nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
-                return error("%s: reached best block %s at height %d from block %s", __func__,
-                    old_pindex->GetBlockHash().ToString(), old_pindex->nHeight, hashBlockFrom.ToString());
-            else
-                return false;
-        }
-        if (pindex->GeneratedStakeModifier())
-        {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
-        }
+    std::vector<const CBlockIndex*> vBranch;
+    const CBlockIndex* pindexFork = pindexPrev;
+    for (; pindexFork && !chainActive.Contains(pindexFork); pindexFork = pindexFork->pprev)
+        vBranch.push_back(pindexFork);
+    const CBlockIndex* pindexLast = vBranch.empty() ? chainActive.Tip() : pindexPrev;
+    int nHeightActive = vBranch.empty() ? chainActive.Height() : (pindexFork ? pindexFork->nHeight : -1);
+
+    const CBlockIndex* pindexGenerated = NULL;
+    if (nHeightActive > pindexFrom->nHeight)
+    {
+        UpdateStakeModifierIndex();
+        pindexGenerated = stakeModifierIndex.FindFirstAfter(pindexFrom->nHeight, nHeightActive, nTimeModifierMin);
     }
-    nStakeModifier = pindex->nStakeModifier;
-
-#ifdef ENABLE_WALLET
-    // Save to cache only at minting phase
-    if (fSameBlock)
+    for (auto it = vBranch.rbegin(); !pindexGenerated && it != vBranch.rend(); ++it)
     {
-        struct StakeMod sm;
-        sm.nStakeModifier = nStakeModifier;
-        sm.nStakeModifierHeight = nStakeModifierHeight;
-        sm.nStakeModifierTime = nStakeModifierTime;
-        StakeModCache.Insert(hashBlockFrom, sm);
+        const CBlockIndex* pindex = *it;
+        if (pindex->nHeight > pindexFrom->nHeight && pindex->GeneratedStakeModifier() && pindex->GetBlockTime() >= nTimeModifierMin)
+            pindexGenerated = pindex;
     }
-#endif
+    if (!pindexGenerated)
+    {   // reached best block; may happen if node is behind on block chain
+        if (fPrintProofOfStake || (pindexLast->GetBlockTime() + params.nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
+            return error("%s: reached best block %s at height %d from block %s", __func__,
+                pindexLast->GetBlockHash().ToString(), pindexLast->nHeight, hashBlockFrom.ToString());
+        else
+            return false;
+    }
+    nStakeModifierHeight = pindexGenerated->nHeight;
+    nStakeModifierTime = pindexGenerated->GetBlockTime();
+    nStakeModifier = pindexGenerated->nStakeModifier;
     return true;
 }
 
 // Get the stake modifier specified by the protocol to hash for a stake kernel
-static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     if (IsProtocolV05(nTimeTx, Params()))
         return GetKernelStakeModifierV05(pindexPrev, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
@@ -467,23 +603,37 @@ static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFro
 //   a proof-of-work situation.
 //
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
+    return CheckStakeKernelHash(nBits, pindexPrev, blockFrom.GetHash(), blockFrom.GetBlockTime(), nTxPrevOffset, txPrev, prevout, nTimeTx, hashProofOfStake, fPrintProofOfStake);
+}
+
+// Coin day weight of a kernel, checking the time and min age requirements
+static bool GetKernelCoinDayWeight(const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, arith_uint256& bnCoinDayWeight)
 {
     const Consensus::Params& params = Params().GetConsensus();
     if (nTimeTx < txPrev->nTime)  // Transaction timestamp violation
         return error("%s: nTime violation", __func__);
 
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
     if (txPrev->nTime + params.nStakeMinAge > nTimeTx) // Min age requirement
         return error("%s: min age violation", __func__);
 
-    arith_uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
     int64_t nValueIn = txPrev->vout[prevout.n].nValue;
     // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
     // this change increases active coins participating the hash and helps
     // to secure the network when proof-of-stake difficulty is low
     int64_t nTimeWeight = min((int64_t)nTimeTx - txPrev->nTime, params.nStakeMaxAge) - (IsProtocolV03(nTimeTx)? params.nStakeMinAge : 0);
-    arith_uint256 bnCoinDayWeight = arith_uint256(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+    bnCoinDayWeight = arith_uint256(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+    return true;
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const uint256& hashBlockFrom, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
+    arith_uint256 bnCoinDayWeight;
+    if (!GetKernelCoinDayWeight(txPrev, prevout, nTimeTx, bnCoinDayWeight))
+        return false;
+
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
     uint64_t nStakeModifier = 0;
@@ -491,7 +641,7 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
     int64_t nStakeModifierTime = 0;
     if (IsProtocolV03(nTimeTx))  // v0.3 protocol
     {
-        if (!GetKernelStakeModifier(pindexPrev, blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
+        if (!GetKernelStakeModifier(pindexPrev, hashBlockFrom, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
             return false;
         ss << nStakeModifier;
     }
@@ -512,8 +662,8 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
             LogPrintf("%s: using modifier 0x%016x at height=%d timestamp=%s for block from height=%d timestamp=%s\n", __func__,
                 nStakeModifier, nStakeModifierHeight,
                 DateTimeStrFormat(nStakeModifierTime),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat(blockFrom.GetBlockTime()));
+                mapBlockIndex[hashBlockFrom]->nHeight,
+                DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("%s: check protocol=%s modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n", __func__,
             IsProtocolV05(nTimeTx, Params())? "0.5" : (IsProtocolV03(nTimeTx)? "0.3" : "0.2"),
             IsProtocolV03(nTimeTx)? nStakeModifier : (uint64_t) nBits,
@@ -530,8 +680,8 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
             LogPrintf("%s: using modifier 0x%016x at height=%d timestamp=%s for block from height=%d timestamp=%s\n", __func__,
                 nStakeModifier, nStakeModifierHeight,
                 DateTimeStrFormat(nStakeModifierTime),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat(blockFrom.GetBlockTime()));
+                mapBlockIndex[hashBlockFrom]->nHeight,
+                DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("%s: pass protocol=%s modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n", __func__,
             IsProtocolV03(nTimeTx)? "0.3" : "0.2",
             IsProtocolV03(nTimeTx)? nStakeModifier : (uint64_t) nBits,
@@ -541,6 +691,70 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
     return true;
 }
 
+// mfcoin: v0.5 kernels with the stake modifier already looked up, see
+// GetKernelStakeModifier(); they use no chain state, so need no lock
+bool GetStakeKernelV05(unsigned int nBits, uint64_t nStakeModifier, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, CStakeKernelV05& kernel)
+{
+    arith_uint256 bnCoinDayWeight;
+    if (!GetKernelCoinDayWeight(txPrev, prevout, nTimeTx, bnCoinDayWeight))
+        return false;
+
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    kernel.nStakeModifier = nStakeModifier;
+    kernel.nTimeBlockFrom = nTimeBlockFrom;
+    kernel.nTxPrevOffset = nTxPrevOffset;
+    kernel.nTimeTxPrev = txPrev->nTime;
+    kernel.nPrevout = prevout.n;
+    kernel.nTimeTx = nTimeTx;
+    kernel.bnTarget = bnCoinDayWeight * bnTargetPerCoinDay;
+    return true;
+}
+
+// mfcoin: the v0.5 kernel serializes to 28 bytes, which fits a single SHA256
+// block, so SHA256DShort() can hash a whole batch of them side by side
+static const size_t STAKE_KERNEL_V05_SIZE = 28;
+static const size_t STAKE_KERNEL_V05_BATCH = 256;
+
+size_t CheckStakeKernelHashesV05(const std::vector<CStakeKernelV05>& vKernels, size_t nStart, uint256& hashProofOfStake)
+{
+    unsigned char data[STAKE_KERNEL_V05_BATCH * STAKE_KERNEL_V05_SIZE];
+    unsigned char hashes[STAKE_KERNEL_V05_BATCH * 32];
+
+    for (size_t nBatch = nStart; nBatch < vKernels.size(); nBatch += STAKE_KERNEL_V05_BATCH)
+    {
+        size_t nCount = std::min(STAKE_KERNEL_V05_BATCH, vKernels.size() - nBatch);
+        for (size_t i = 0; i < nCount; i++)
+        {
+            // Same layout as ss << nStakeModifier << nTimeBlockFrom << nTxPrevOffset << nTimeTxPrev << nPrevout << nTimeTx
+            const CStakeKernelV05& kernel = vKernels[nBatch + i];
+            unsigned char* p = data + i * STAKE_KERNEL_V05_SIZE;
+            WriteLE64(p, kernel.nStakeModifier);
+            WriteLE32(p + 8, kernel.nTimeBlockFrom);
+            WriteLE32(p + 12, kernel.nTxPrevOffset);
+            WriteLE32(p + 16, kernel.nTimeTxPrev);
+            WriteLE32(p + 20, kernel.nPrevout);
+            WriteLE32(p + 24, kernel.nTimeTx);
+        }
+        SHA256DShort(hashes, data, STAKE_KERNEL_V05_SIZE, nCount);
+
+        for (size_t i = 0; i < nCount; i++)
+        {
+            const CStakeKernelV05& kernel = vKernels[nBatch + i];
+            memcpy(hashProofOfStake.begin(), hashes + i * 32, 32);
+            if (UintToArith256(hashProofOfStake) > kernel.bnTarget)
+                continue;
+            if (fDebug)
+                LogPrintf("%s: pass protocol=0.5 modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n", __func__,
+                    kernel.nStakeModifier, kernel.nTimeBlockFrom, kernel.nTxPrevOffset, kernel.nTimeTxPrev, kernel.nPrevout, kernel.nTimeTx,
+                    hashProofOfStake.ToString());
+            return nBatch + i;
+        }
+    }
+    return vKernels.size();
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(CValidationState& state, CBlockIndex* pindexPrev, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake)
 {
@@ -562,9 +776,10 @@ bool CheckProofOfStake(CValidationState& state, CBlockIndex* pindexPrev, const C
         return state.DoS(1, false, REJECT_INVALID, "prev-tx-not-found", false, strprintf("%s: txPrev not found", __func__));
 
     // Verify signature
-    CCoins coins(*txTmp, 0);
+    if (txin.prevout.n >= txTmp->vout.size())
+        return state.DoS(100, false, REJECT_INVALID, "invalid-pos-script", false, strprintf("%s: coinstake %s spends a missing output", __func__, tx->GetHash().ToString()));
     PrecomputedTransactionData txdata(*tx);
-    if (!CScriptCheck(coins, *tx, 0, SCRIPT_VERIFY_P2SH, true, &txdata)())
+    if (!CScriptCheck(txTmp->vout[txin.prevout.n], *tx, 0, SCRIPT_VERIFY_P2SH, true, &txdata)())
         return state.DoS(100, false, REJECT_INVALID, "invalid-pos-script", false, strprintf("%s: VerifyScript failed on coinstake %s", __func__, tx->GetHash().ToString()));
 
     // Get transaction index for the previous transaction
@@ -575,18 +790,10 @@ bool CheckProofOfStake(CValidationState& state, CBlockIndex* pindexPrev, const C
     // Read txPrev and header of its block
     CBlockHeader header;
     CTransactionRef txPrev;
-    {
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> txPrev;
-        } catch (std::exception& e) {
-            return error("%s: deserialize or I/O error", __func__);
-        }
-        if (txPrev->GetHash() != txin.prevout.hash)
-            return error("%s: txid mismatch", __func__);
-    }
+    if (!ReadTxFromDisk(postx, txPrev, header))
+        return error("%s: deserialize or I/O error", __func__);
+    if (txPrev->GetHash() != txin.prevout.hash)
+        return error("%s: txid mismatch", __func__);
 
     if (!CheckStakeKernelHash(nBits, pindexPrev, header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, txPrev, txin.prevout, tx->nTime, hashProofOfStake, fDebug))
         // may occur during initial download or if behind on block chain sync
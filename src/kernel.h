@@ -4,7 +4,10 @@
 #ifndef PPCOIN_KERNEL_H
 #define PPCOIN_KERNEL_H
 
+#include "arith_uint256.h"
+
 #include <memory>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
@@ -22,9 +25,40 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Bring the index of stake modifier generating blocks in line with
+// chainActive, or drop it with the block index; both need cs_main
+void UpdateStakeModifierIndex();
+void UnloadStakeModifierIndex();
+
+// Get the stake modifier specified by the protocol to hash for a stake kernel
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
+// Same, with the block of txPrev given by its hash and time instead of its header
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const uint256& hashBlockFrom, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
+
+// A protocol v0.5 stake kernel queued for CheckStakeKernelHashesV05(), with
+// the stake modifier in effect at nTimeTx; checking it does not need cs_main
+struct CStakeKernelV05
+{
+    uint64_t nStakeModifier;
+    unsigned int nTimeBlockFrom;
+    unsigned int nTxPrevOffset;
+    unsigned int nTimeTxPrev;
+    unsigned int nPrevout;
+    unsigned int nTimeTx;
+    arith_uint256 bnTarget; // coin day weight times target per coin day
+};
+
+// Fill a batched v0.5 kernel for txPrev/prevout at nTimeTx
+bool GetStakeKernelV05(unsigned int nBits, uint64_t nStakeModifier, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, CStakeKernelV05& kernel);
+
+// Hash vKernels from nStart on, several at a time where the CPU allows it;
+// returns the index of the first kernel meeting its target, with its
+// hashProofOfStake, or vKernels.size() if none does
+size_t CheckStakeKernelHashesV05(const std::vector<CStakeKernelV05>& vKernels, size_t nStart, uint256& hashProofOfStake);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
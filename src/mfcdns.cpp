@@ -31,8 +31,12 @@
 #else
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
+#include <climits>
+#include <new>
+
 #include <ctype.h>
 
 #include "namecoin.h"
@@ -58,6 +62,7 @@
 
 #define MAX_OUT  512	// Old DNS restricts UDP to 512 bytes; keep compatible
 #define BUF_SIZE (2 * MAX_OUT)
+#define PKT_SIZE (BUF_SIZE + 2)	// Packet buffer with terminal, MFCDNS_BATCH of them per worker
 #define MAX_TOK  64	// Maximal TokenQty in the vsl_list, like A=IP1,..,IPn
 #define MAX_DOM  20	// Maximal domain level; min 10 is needed for NAPTR E164
 
@@ -68,6 +73,11 @@
 // HT offset contains it for ENUM SPFUN
 #define ENUM_FLAG	(1 << 14)
 
+// Receive and answer batches of packets with one syscall
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define USE_MMSG
+#endif
+
 /*---------------------------------------------------*/
 
 #ifdef WIN32
@@ -103,6 +113,8 @@ const char *inet_ntop(int af, const void *src, char *dst, socklen_t size) {
   dst[-1] = 0;
 }
 
+#define strtok_r strtok_s
+
 char *strsep(char **s, const char *ct)
 {
     char *sstart = *s;
@@ -121,21 +133,48 @@ char *strsep(char **s, const char *ct)
 
 /*---------------------------------------------------*/
 
+// Create UDP socket bound to sin6; with reuseport, workers can bind own sockets to the same port
+static SOCKET OpenSocket(const struct sockaddr_in6 &sin6, bool reuseport) {
+    int ret = socket(PF_INET6, SOCK_DGRAM, 0);
+    if(ret < 0) 
+      throw runtime_error("MfcDns::MfcDns: Cannot create socket");
+    SOCKET sockfd = ret;
+
+    int no = 0;
+#ifdef WIN32
+    if(setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&no, sizeof(no)) < 0)
+#else
+    if(setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&no, sizeof(no)) < 0)
+#endif
+      throw runtime_error("MfcDns::MfcDns: Cannot switch socket to IPV4 compatibility mode");
+
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if(reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void *)&yes, sizeof(yes)) < 0)
+      throw runtime_error("MfcDns::MfcDns: Cannot set SO_REUSEPORT");
+#endif
+
+    if(::bind(sockfd, (struct sockaddr *)&sin6, sizeof(struct sockaddr_in6)) < 0) {
+      char buf[80];
+      sprintf(buf, "MfcDns::MfcDns: Cannot bind to port %u", ntohs(sin6.sin6_port));
+      throw runtime_error(buf);
+    }
+    return sockfd;
+} // OpenSocket
+
+/*---------------------------------------------------*/
+
 MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
 	  const char *gw_suffix, const char *allowed_suff, const char *local_fname, 
 	  uint32_t dapsize, uint32_t daptreshold,
-	  const char *enums, const char *tollfree, uint8_t verbose) 
-    : m_status(-1), m_thread(StatRun, this) {
+	  const char *enums, const char *tollfree, uint8_t verbose, int threads, uint32_t cachesize) 
+    : m_status(-1), m_thread(StatRun, this), m_daprand(0) {
 
     // Clear vars [m_hdr..m_verbose)
     memset(&m_hdr, 0, &m_verbose - (uint8_t *)&m_hdr); // Clear previous state
     m_verbose = verbose;
-
-    // Create and socket
-    int ret = socket(PF_INET6, SOCK_DGRAM, 0);
-    if(ret < 0) 
-      throw runtime_error("MfcDns::MfcDns: Cannot create socket");
-    m_sockfd = ret;
+    m_master = this;
+    m_cache_max = cachesize;
 
     struct sockaddr_in6 sin6;
     const int sin6len = sizeof(struct sockaddr_in6);
@@ -171,19 +210,9 @@ MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
     }
 #endif
 
-    int no = 0;
-#ifdef WIN32
-    if(setsockopt(m_sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&no, sizeof(no)) < 0)
-#else
-    if(setsockopt(m_sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&no, sizeof(no)) < 0)
-#endif
-      throw runtime_error("MfcDns::MfcDns: Cannot switch socket to IPV4 compatibility mode");
-
-    if(::bind(m_sockfd, (struct sockaddr *)&sin6, sin6len) < 0) {
-      char buf[80];
-      sprintf(buf, "MfcDns::MfcDns: Cannot bind to port %u", port_no);
-      throw runtime_error(buf);
-    }
+    if(threads < 1)
+      threads = 1;
+    m_sockfd = OpenSocket(sin6, threads > 1);
 
     // Upload Local DNS entries
     // Create temporary local buf on stack
@@ -225,13 +254,13 @@ MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
     if(dapsize) {
       dapsize += dapsize - 1;
       do m_dapmask = dapsize; while(dapsize &= dapsize - 1); // compute mask as 2^N
-      m_dap_ht = (DNSAP*)calloc(m_dapmask, sizeof(DNSAP));
+      m_dap_ht = new (std::nothrow) std::atomic<uint32_t>[m_dapmask]();
       m_dapmask--;
       m_daprand = GetRand(0xffffffff) | 1;
       m_dap_treshold = daptreshold;
     }
 
-    m_value  = (char *)malloc(VAL_SIZE + BUF_SIZE + 2 + 
+    m_value  = (char *)malloc(VAL_SIZE + MFCDNS_BATCH * PKT_SIZE + 
 	    m_gw_suf_len + allowed_len + local_len + 4);
  
     if(m_value == NULL) 
@@ -250,10 +279,8 @@ MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
 	}
     } // ENUMs completed 
 
-    // Assign data buffers inside m_value hyper-array
-    m_buf    = (uint8_t *)(m_value + VAL_SIZE);
-    m_bufend = m_buf + MAX_OUT;
-    char *varbufs = m_value + VAL_SIZE + BUF_SIZE + 2;
+    // Assign data buffers inside m_value hyper-array; packet buffers are assigned by Run()
+    char *varbufs = m_value + VAL_SIZE + MFCDNS_BATCH * PKT_SIZE;
 
     m_gw_suffix = m_gw_suf_len?
       strcpy(varbufs, gw_suffix) : NULL;
@@ -323,9 +350,9 @@ MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
     } //  if(local_len)
 
     if(m_verbose > 1)
-	 LogPrintf("MfcDns::MfcDns: Created/Attached: [%s]:%u; TLD=%u Local=%u\n", 
+	 LogPrintf("MfcDns::MfcDns: Created/Attached: [%s]:%u; TLD=%u Local=%u Threads=%d\n", 
 		 (bind_ip == NULL)? "INADDR_ANY" : bind_ip,
-		 port_no, m_allowed_qty, local_qty);
+		 port_no, m_allowed_qty, local_qty, threads);
 
     // Hack - pass TF file list through m_value to HandlePacket()
 
@@ -336,6 +363,34 @@ MfcDns::MfcDns(const char *bind_ip, uint16_t port_no,
     } else
       m_value[0] = 0;
 
+    // Workers copy configuration from this object, so create them last
+    bool reuseport = false;
+#ifdef SO_REUSEPORT
+    reuseport = true;
+#endif
+    for(int i = 1; i < threads; i++)
+      m_workers.push_back(new MfcDns(this, reuseport? &sin6 : NULL));
+
+    m_status = 1; // Active, and maybe download
+} // MfcDns::MfcDns
+
+/*---------------------------------------------------*/
+
+MfcDns::MfcDns(MfcDns *master, const struct sockaddr_in6 *sin6)
+    : m_status(-1), m_thread(StatRun, this), m_verifiers(master->m_verifiers), m_daprand(0) {
+
+    // Copy vars [m_hdr..m_verbose]; pointers refer to the configuration inside master->m_value
+    memcpy(&m_hdr, &master->m_hdr, &m_verbose + 1 - (uint8_t *)&m_hdr);
+
+    m_sockfd = (sin6 == NULL)? master->m_sockfd : OpenSocket(*sin6, true);
+
+    m_value = (char *)malloc(VAL_SIZE + MFCDNS_BATCH * PKT_SIZE);
+    if(m_value == NULL) 
+      throw runtime_error("MfcDns::MfcDns: Cannot allocate buffer");
+
+    // Each worker loads own toll-free lists, like m_verifiers are fetched by each worker
+    strcpy(m_value, master->m_value);
+
     m_status = 1; // Active, and maybe download
 } // MfcDns::MfcDns
 /*---------------------------------------------------*/
@@ -366,15 +421,29 @@ void MfcDns::AddTF(char *tf_tok) {
 /*---------------------------------------------------*/
 
 MfcDns::~MfcDns() {
+    // Workers are deleted by master, after all sockets are closed
+    if(m_master != this) {
+      free(m_value);
+      return;
+    }
+
     // reset current object to initial state
+    // Stop all threads before free anything; without SO_REUSEPORT workers share m_sockfd
+    for(size_t i = 0; i <= m_workers.size(); i++) {
+      SOCKET &sockfd = (i == 0)? m_sockfd : m_workers[i - 1]->m_sockfd;
+      if(i != 0 && sockfd == m_sockfd)
+	continue;
 #ifndef WIN32
-    shutdown(m_sockfd, SHUT_RDWR);
+      shutdown(sockfd, SHUT_RDWR);
 #endif
-    CloseSocket(m_sockfd);
-    MilliSleep(100); // Allow 0.1s my thread to exit
+      CloseSocket(sockfd);
+    }
+    MilliSleep(100); // Allow 0.1s my threads to exit
     // m_thread.join();
+    for(size_t i = 0; i < m_workers.size(); i++)
+      delete m_workers[i];
     free(m_value);
-    free(m_dap_ht);
+    delete[] m_dap_ht;
     if(m_verbose > 1)
 	 LogPrintf("MfcDns::~MfcDns: Destroyed OK\n");
 } // MfcDns::~MfcDns
@@ -385,6 +454,8 @@ MfcDns::~MfcDns() {
 void MfcDns::StatRun(void *p) {
   MfcDns *obj = (MfcDns*)p;
   obj->Run();
+  if(obj->m_cache_max && obj->m_verbose > 1)
+    obj->CacheStat("exit");
 //mfcoin  ExitThread(0);
 } // MfcDns::StatRun
 
@@ -395,30 +466,96 @@ void MfcDns::Run() {
   while(m_status < 0) // not initied yet
     MilliSleep(133);
 
-  for( ; ; ) {
-    struct sockaddr_in6 sin6;
-    socklen_t sin6len = sizeof(struct sockaddr_in6);
+  uint8_t *bufs = (uint8_t *)(m_value + VAL_SIZE); // MFCDNS_BATCH packet buffers
+  struct sockaddr_in6 sin6[MFCDNS_BATCH];
+  socklen_t sin6len[MFCDNS_BATCH];
+  int rcvlen[MFCDNS_BATCH];
+#ifdef USE_MMSG
+  struct mmsghdr msgs[MFCDNS_BATCH];
+  struct iovec iovs[MFCDNS_BATCH];
+#endif
 
-    m_rcvlen = recvfrom(m_sockfd, (char *)m_buf, BUF_SIZE, 0,
-	            (struct sockaddr *)&sin6, &sin6len);
-    if(m_rcvlen <= 0)
-	break;
+  m_stat_time = time(NULL) + MFCDNS_STATPERIOD;
+
+  for(bool fExit = false; !fExit; ) {
+    // Receive a batch of packets; wait for the 1st one only
+    int qty = 1;
+#ifdef USE_MMSG
+    for(int i = 0; i < MFCDNS_BATCH; i++) {
+      iovs[i].iov_base = bufs + i * PKT_SIZE;
+      iovs[i].iov_len  = BUF_SIZE;
+      memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      msgs[i].msg_hdr.msg_name    = &sin6[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+      msgs[i].msg_hdr.msg_iov     = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+    qty = recvmmsg(m_sockfd, msgs, MFCDNS_BATCH, MSG_WAITFORONE, NULL);
+    if(qty <= 0) {
+      m_rcvlen = qty;
+      break;
+    }
+    for(int i = 0; i < qty; i++) {
+      rcvlen[i]  = msgs[i].msg_len;
+      sin6len[i] = msgs[i].msg_hdr.msg_namelen;
+    }
+#else
+    sin6len[0] = sizeof(struct sockaddr_in6);
+    rcvlen[0] = recvfrom(m_sockfd, (char *)bufs, BUF_SIZE, 0,
+	            (struct sockaddr *)&sin6[0], &sin6len[0]);
+#endif
+
+    uint32_t now = time(NULL);
+    if(m_cache_max && m_verbose > 1 && now >= m_stat_time) {
+      CacheStat("periodic");
+      m_stat_time = now + MFCDNS_STATPERIOD;
+    }
 
     if(m_dap_ht) {
-      uint32_t now = time(NULL);
-      if(((now ^ m_daprand) & 0xfffff) == 0) // ~weekly update daprand
-        m_daprand = GetRand(0xffffffff) | 1;
+      uint32_t daprand = m_master->m_daprand;
+      if(((now ^ daprand) & 0xfffff) == 0) // ~weekly update daprand
+        m_master->m_daprand.compare_exchange_strong(daprand, GetRand(0xffffffff) | 1);
       m_timestamp = now >> MFCDNS_DAPSHIFTDECAY; // time in 256s (~4 min)
     }
-    if(CheckDAP(&sin6.sin6_addr, sin6len, m_rcvlen)) {
-      m_buf[BUF_SIZE] = 0; // Set terminal for infinity QNAME
-      if(HandlePacket() == 0) {
-        sendto(m_sockfd, (const char *)m_buf, m_snd - m_buf, MSG_NOSIGNAL,
-	             (struct sockaddr *)&sin6, sin6len);
 
-        CheckDAP(&sin6.sin6_addr, sin6len, m_snd - m_buf); // update for long answer
+    int ready = 0; // answers to send
+    for(int i = 0; i < qty; i++) {
+      m_rcvlen = rcvlen[i];
+      if(m_rcvlen <= 0) {
+        fExit = true;
+        break;
       }
-    } // dap check
+      m_buf    = bufs + i * PKT_SIZE;
+      m_bufend = m_buf + MAX_OUT;
+      if(CheckDAP(&sin6[i].sin6_addr, sizeof(sin6[i].sin6_addr), m_rcvlen)) {
+        m_buf[BUF_SIZE] = 0; // Set terminal for infinity QNAME
+        int rc = CacheLookup(); // 0 = answer ready, 1 = handle packet, <0 = drop
+        if(rc > 0 && (rc = HandlePacket()) == 0)
+          CacheStore();
+        if(rc == 0) {
+#ifdef USE_MMSG
+          // Answers are sent after the batch; entries before i are already consumed
+          iovs[ready].iov_base = m_buf;
+          iovs[ready].iov_len  = m_snd - m_buf;
+          msgs[ready].msg_hdr.msg_name    = &sin6[i];
+          msgs[ready].msg_hdr.msg_namelen = sin6len[i];
+          ready++;
+#else
+          sendto(m_sockfd, (const char *)m_buf, m_snd - m_buf, MSG_NOSIGNAL,
+	             (struct sockaddr *)&sin6[i], sin6len[i]);
+#endif
+
+          CheckDAP(&sin6[i].sin6_addr, sizeof(sin6[i].sin6_addr), m_snd - m_buf); // update for long answer
+        }
+      } // dap check
+    } // for i
+
+#ifdef USE_MMSG
+    for(int sent = 0; sent < ready; ) {
+      int rc = sendmmsg(m_sockfd, msgs + sent, ready - sent, MSG_NOSIGNAL);
+      sent += (rc > 0)? rc : 1; // skip an answer which cannot be sent
+    }
+#endif
   } // for
 
   if(m_verbose > 1) LogPrintf("MfcDns::Run: Received Exit packet_len=%d\n", m_rcvlen);
@@ -537,6 +674,159 @@ int MfcDns::HandlePacket() {
   return 0; // answer ready
 } // MfcDns::HandlePacket
 
+/*---------------------------------------------------*/
+// Try to answer the packet in m_buf from m_cache, with its msgID and RD bit
+// Returns 0 - answer is ready; 1 - HandlePacket() needed; -1 - drop by DAP
+// Prepares m_cache_key for CacheStore(), if the answer can be cached
+int MfcDns::CacheLookup() {
+  m_cache_key.clear();
+  m_cache_shuffle.clear();
+  m_cache_names.clear();
+  if(m_cache_max == 0 || m_status != 0)
+    return 1; // Disabled, or not ready yet
+
+  DNSHeader *hdr = (DNSHeader *)m_buf; // Network format
+  uint16_t bits = ntohs(hdr->Bits);
+  if(m_rcvlen < (int)sizeof(DNSHeader) || ntohs(hdr->QDCount) != 1 || hdr->ANCount != 0 || hdr->NSCount != 0 ||
+     (bits & (hdr->QR_MASK | hdr->TC_MASK | hdr->OPCODE_MASK)) != 0)
+    return 1; // Not a plain query, HandlePacket() decides
+
+  // Key is QNAME transformed as HandleQuery() does, with QTYPE and QCLASS
+  // Errors are left to HandleQuery(), these answers are not cached
+  char domain[BUF_SIZE], *dom_end = domain;
+  uint8_t *rcv = m_buf + sizeof(DNSHeader), *rcvend = m_buf + m_rcvlen;
+  int dom_qty = 0;
+  while(rcv < rcvend && *rcv != 0) {
+    uint8_t dom_len = *rcv++;
+    if((dom_len & 0xc0) || rcv + dom_len > rcvend || dom_qty++ >= MAX_DOM)
+      return 1;
+    m_cache_key.push_back(dom_len);
+    do {
+      char c = 040 | *rcv++; // tolower char
+      m_cache_key.push_back(c);
+      *dom_end++ = c;
+    } while(--dom_len);
+    *dom_end++ = '.';
+  }
+  if(dom_qty == 0 || rcv + 5 > rcvend) {
+    m_cache_key.clear();
+    return 1; // Root or truncated question
+  }
+  m_cache_key.append((const char *)rcv, 5); // 0, QTYPE, QCLASS
+  *--dom_end = 0; // Remove last dot, set EOLN
+  m_cache_qlen = rcv + 5 - (m_buf + sizeof(DNSHeader));
+  m_cache_height = INT_MAX;
+
+  unordered_map<string, list<DNSCacheItem>::iterator>::iterator it = m_cache.find(m_cache_key);
+  if(it == m_cache.end()) {
+    m_cache_misses++;
+    return 1;
+  }
+
+  const DNSCacheItem &item = *it->second;
+  int height = chainActive.Height();
+  bool fValid = height >= item.height_min && height <= item.height_max && (uint32_t)time(NULL) < item.expires;
+  for(size_t i = 0; fValid && i < item.names.size(); i++)
+    fValid = nameCache.GetGeneration(item.names[i].first) == item.names[i].second;
+  if(!fValid) { // Expired, or some name of the answer has changed
+    m_cache_lru.erase(it->second);
+    m_cache.erase(it);
+    m_cache_misses++;
+    return 1;
+  }
+  m_cache_lru.splice(m_cache_lru.begin(), m_cache_lru, it->second);
+
+  // Same accounting as HandleQuery() does for the domain
+  if(!CheckDAP(domain, domain - dom_end, 0)) {
+    if(m_verbose > 0)
+      LogPrintf("\tMfcDns::CacheLookup: Aborted domain %s by DAP\n", domain);
+    return -1;
+  }
+
+  m_cache_hits++;
+  uint16_t msgID = hdr->msgID, rd = hdr->Bits & htons(hdr->RD_MASK);
+  memcpy(m_buf, item.answer.data(), sizeof(DNSHeader));
+  hdr->msgID = msgID;
+  hdr->Bits |= rd;
+  // Question stays in place, answer sections follow it
+  m_snd = m_buf + sizeof(DNSHeader) + m_cache_qlen;
+  memcpy(m_snd, item.answer.data() + sizeof(DNSHeader), item.answer.size() - sizeof(DNSHeader));
+  m_snd += item.answer.size() - sizeof(DNSHeader);
+
+  // Shuffle record sets as Answer_ALL() does
+  for(size_t set = 0; set < item.shuffle.size(); set += 3) {
+    uint8_t *rr = m_buf + m_cache_qlen + item.shuffle[set];
+    uint16_t rr_sz = item.shuffle[set + 2];
+    uint8_t tmp[64];
+    for(int i = item.shuffle[set + 1]; i > 1; ) {
+      int randndx = GetRand(i);
+      --i;
+      memcpy(tmp, rr + randndx * rr_sz, rr_sz);
+      memcpy(rr + randndx * rr_sz, rr + i * rr_sz, rr_sz);
+      memcpy(rr + i * rr_sz, tmp, rr_sz);
+    }
+  }
+
+  if(m_verbose > 3) 
+    LogPrintf("*\tMfcDns::CacheLookup: Answered %s from cache, len=%d\n", domain, (int)(m_snd - m_buf));
+  return 0;
+} // MfcDns::CacheLookup
+
+/*---------------------------------------------------*/
+// Save answer, created by HandlePacket() for m_cache_key
+void MfcDns::CacheStore() {
+  if(m_cache_key.empty() || m_status != 0)
+    return;
+
+  // Question must be the request's one, as CacheLookup() expects
+  if(m_rcv != m_buf + sizeof(DNSHeader) + m_cache_qlen)
+    return;
+
+  // Truncated answer can cut a shuffled set
+  DNSHeader *hdr = (DNSHeader *)m_buf; // Network format
+  if(hdr->Bits & htons(hdr->TC_MASK))
+    return;
+
+  // Keep an answer no longer than its TTL
+  uint32_t maxage = MFCDNS_CACHEMAXAGE;
+  if((hdr->ANCount | hdr->NSCount) != 0 && m_ttl < maxage)
+    maxage = m_ttl;
+  if(maxage == 0)
+    return;
+
+  if(m_cache.count(m_cache_key))
+    return; // Already cached
+
+  if(m_cache.size() >= m_cache_max) { // Evict the least recently used item
+    m_cache.erase(m_cache_lru.back().key);
+    m_cache_lru.pop_back();
+  }
+
+  m_cache_lru.push_front(DNSCacheItem());
+  m_cache[m_cache_key] = m_cache_lru.begin();
+  DNSCacheItem &item = m_cache_lru.front();
+  item.key = m_cache_key;
+  item.answer.assign((const char *)m_buf, sizeof(DNSHeader));
+  item.answer.append((const char *)m_rcv, m_snd - m_rcv);
+  DNSHeader *ihdr = (DNSHeader *)&item.answer[0];
+  ihdr->msgID = 0;
+  ihdr->Bits &= ~htons(ihdr->RD_MASK);
+  item.names.swap(m_cache_names);
+  item.height_min = chainActive.Height();
+  item.height_max = m_cache_height;
+  item.expires    = time(NULL) + maxage;
+  item.shuffle    = m_cache_shuffle;
+  for(size_t set = 0; set < item.shuffle.size(); set += 3)
+    item.shuffle[set] += sizeof(DNSHeader); // AR of request is removed, answers follow the question
+} // MfcDns::CacheStore
+
+/*---------------------------------------------------*/
+void MfcDns::CacheStat(const char *when) {
+  uint64_t total = m_cache_hits + m_cache_misses;
+  LogPrintf("MfcDns::CacheStat: %s: items=%u hits=%u misses=%u hitrate=%.1f%%\n", when,
+	    m_cache.size(), m_cache_hits, m_cache_misses, total? 100.0 * m_cache_hits / total : 0.0);
+} // MfcDns::CacheStat
+
 /*---------------------------------------------------*/
 uint16_t MfcDns::HandleQuery() {
   // Decode qname
@@ -764,9 +1054,10 @@ int MfcDns::Tokenize(const char *key, const char *sep2, char **tokens, char *buf
      mainsep[0] = '|';
   mainsep[1] = 0;
 
-  for(char *token = strtok(buf, mainsep);
+  char *save1, *save2;
+  for(char *token = strtok_r(buf, mainsep, &save1);
     token != NULL; 
-      token = strtok(NULL, mainsep)) {
+      token = strtok_r(NULL, mainsep, &save1)) {
       // LogPrintf("Token:%s\n", token);
       char *val = strchr(token, '=');
       if(val == NULL)
@@ -793,9 +1084,9 @@ int MfcDns::Tokenize(const char *key, const char *sep2, char **tokens, char *buf
 	  sep2 = sepulka;
       }
       // Tokenize value
-      for(token = strtok(val, sep2); 
+      for(token = strtok_r(val, sep2, &save2); 
 	 token != NULL && tokensN < MAX_TOK; 
-	   token = strtok(NULL, sep2)) {
+	   token = strtok_r(NULL, sep2, &save2)) {
 	  // LogPrintf("Subtoken=%s\n", token);
 	  tokens[tokensN++] = token;
       }
@@ -837,6 +1128,7 @@ void MfcDns::Answer_ALL(uint16_t qtype, char *buf) {
     tokens[i] = tmp;
   }
 
+  uint8_t *snd0 = m_snd;
   for(int tok_no = 0; tok_no < tokQty; tok_no++) {
       if(m_verbose > 4) 
 	LogPrintf("\tMfcDns::Answer_ALL: Token:%u=[%s]\n", tok_no, tokens[tok_no]);
@@ -857,6 +1149,17 @@ void MfcDns::Answer_ALL(uint16_t qtype, char *buf) {
       } // swithc
   } // for
 
+  // CacheLookup() reshuffles fixed size records; other shuffled answers are not cached
+  if(tokQty > 1 && !m_cache_key.empty()) {
+    uint16_t rr_sz = (qtype == 1)? 16 : 28;
+    if(qtype == 1 || qtype == 28) {
+      m_cache_shuffle.push_back(snd0 - m_rcvend);
+      m_cache_shuffle.push_back((m_snd - snd0) / rr_sz);
+      m_cache_shuffle.push_back(rr_sz);
+    } else
+      m_cache_key.clear();
+  }
+
   if(needed_addl) { // Foll ADDL section (NS in NSCount)
     m_hdr->NSCount += tokQty;
 #if 0
@@ -961,13 +1264,31 @@ int MfcDns::Search(uint8_t *key) {
     LogPrintf("MfcDns::Search(%s)\n", key);
 
   string value;
-  if (!hooks->getNameValue(string("dns:") + (const char *)key, value))
+  if (!LookupName(string("dns:") + (const char *)key, value))
     return 0;
 
   strcpy(m_value, value.c_str());
   return 1;
 } //  MfcDns::Search
 
+/*---------------------------------------------------*/
+// As hooks->getNameValue(), and limits the chain height the answer in work is valid up to
+// and records the name as one the answer in work depends on
+bool MfcDns::LookupName(const string &name, string &value) {
+  CNameVal nameVal = nameValFromString(name);
+  if(!m_cache_key.empty())
+    m_cache_names.push_back(make_pair(nameVal, nameCache.GetGeneration(nameVal)));
+
+  CNameCacheEntry entry;
+  if(!nameCache.Get(nameVal, entry) || !entry.IsActive(chainActive.Height()))
+    return false;
+
+  if(entry.nExpiresAt < m_cache_height)
+    m_cache_height = entry.nExpiresAt;
+  value = stringFromNameVal(entry.value);
+  return true;
+} // MfcDns::LookupName
+
 /*---------------------------------------------------*/
 
 int MfcDns::LocalSearch(const uint8_t *key, uint8_t pos, uint8_t step) {
@@ -1005,7 +1326,7 @@ bool MfcDns::CheckDAP(void *key, int len, uint32_t packet_size) {
   }
   
   uint16_t inctemp = (packet_size >> 5) + 1; // 1 degr = 32 bytes unit
-  uint32_t hash = m_daprand, mintemp = ~0;
+  uint32_t hash = m_master->m_daprand.load(std::memory_order_relaxed), mintemp = ~0;
 
   int used_ndx[MFCDNS_DAPBLOOMSTEP];
   for(int bloomstep = 0; bloomstep < MFCDNS_DAPBLOOMSTEP; bloomstep++) {
@@ -1021,11 +1342,17 @@ bool MfcDns::CheckDAP(void *key, int len, uint32_t packet_size) {
 	  ndx = -1;
     } while(ndx < 0);
 
-    DNSAP *dap = &m_dap_ht[used_ndx[bloomstep] = ndx];
-    uint16_t dt = m_timestamp - dap->timestamp;
-    uint32_t new_temp = (dt > 15? 0 : dap->temp >> dt) + inctemp;
-    dap->temp = (new_temp > 0xffff)? 0xffff : new_temp;
-    dap->timestamp = m_timestamp;
+    std::atomic<uint32_t> &cell = m_dap_ht[used_ndx[bloomstep] = ndx];
+    uint32_t old_cell = cell.load(std::memory_order_relaxed), new_cell, new_temp;
+    do { // other workers can update the same cell
+      DNSAP dap;
+      memcpy(&dap, &old_cell, sizeof(dap));
+      uint16_t dt = m_timestamp - dap.timestamp;
+      new_temp = (dt > 15? 0 : dap.temp >> dt) + inctemp;
+      dap.temp = (new_temp > 0xffff)? 0xffff : new_temp;
+      dap.timestamp = m_timestamp;
+      memcpy(&new_cell, &dap, sizeof(dap));
+    } while(!cell.compare_exchange_weak(old_cell, new_cell, std::memory_order_relaxed));
     if(new_temp < mintemp) 
       mintemp = new_temp;
   } // for
@@ -1034,7 +1361,7 @@ bool MfcDns::CheckDAP(void *key, int len, uint32_t packet_size) {
   if(m_verbose > 5 || (!rc && m_verbose > 0)) {
     char buf[80];
     LogPrintf("MfcDns::CheckDAP: IP=[%s] packet_size=%u, mintemp=%u dap_treshold=%u rc=%d\n", 
-		    len < 0? (const char *)key : inet_ntop(len == 4? AF_INET : AF_INET6, key, buf, len),
+		    len < 0? (const char *)key : inet_ntop(len == 4? AF_INET : AF_INET6, key, buf, sizeof(buf)),
                     packet_size, mintemp, m_dap_treshold, rc);
   }
   return rc;
@@ -1083,7 +1410,7 @@ int MfcDns::SpfunENUM(uint8_t len, uint8_t **domain_start, uint8_t **domain_end)
           LogPrintf("\tMfcDns::SpfunENUM Search(%s)\n", q_str);
 
         string value;
-        if(!hooks->getNameValue(string(q_str), value))
+        if(!LookupName(string(q_str), value))
           break;
 
         strcpy(m_value, value.c_str());
@@ -1244,8 +1571,7 @@ bool MfcDns::CheckEnumSig(const char *q_str, char *sig_str) {
         CNameRecord nameRec;
         CTransactionRef tx;
         LOCK(cs_main);
-        CNameDB dbName("r");
-        if(!dbName.ReadName(CNameVal(it->first.c_str(), it->first.c_str() + it->first.size()), nameRec))
+        if(!pnameindex->ReadName(CNameVal(it->first.c_str(), it->first.c_str() + it->first.size()), nameRec))
 	  break; // failed to read from name DB
         if(nameRec.vtxPos.size() < 1)
 	  break; // no result returned
@@ -1336,7 +1662,7 @@ bool MfcDns::CheckEnumSig(const char *q_str, char *sig_str) {
     sprintf(valbuf, ver.srl_tpl.c_str(), h & ver.mask);
 
     string value;
-    if(!hooks->getNameValue(string(valbuf), value))
+    if(!LookupName(string(valbuf), value))
       return true; // Unable fetch SRL - as same as SRL does not exist
 
     // Is q_str missing in the SRL
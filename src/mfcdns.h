@@ -2,7 +2,11 @@
 #define MFCDNS_H
 
 #include <string>
+#include <list>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
 
 #include <boost/thread.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
@@ -11,12 +15,18 @@ using namespace std;
 
 
 #include "pubkey.h"
+#include "script/script.h"
 
 
 #define MFCDNS_PORT		5335
 #define MFCDNS_DAPBLOOMSTEP	3				// 3 steps in bloom filter
 #define MFCDNS_DAPSHIFTDECAY	8				// Dap time shift 8 = 256 secs (~4min) in decay
 #define MFCDNS_DAPTRESHOLD	(4 << MFCDNS_DAPSHIFTDECAY)	// ~4r/s found name, ~1 r/s - clien IP
+#define MFCDNS_THREADS		1				// Worker threads, each one with own socket
+#define MFCDNS_BATCH		32				// Packets per recvmmsg/sendmmsg call
+#define MFCDNS_CACHESIZE	4096				// Cached answers per worker
+#define MFCDNS_CACHEMAXAGE	600				// Max seconds to keep a cached answer
+#define MFCDNS_STATPERIOD	3600				// Seconds between cache statistic messages
 
 #define VERMASK_NEW	-1
 #define VERMASK_BLOCKED -2
@@ -44,7 +54,7 @@ struct DNSHeader {
   }
 } __attribute__((packed)); // struct DNSHeader
 
-struct DNSAP {		// DNS Amplifier Protector ExpDecay structure
+struct DNSAP {		// DNS Amplifier Protector ExpDecay structure, 32 bits to update atomically
   uint16_t timestamp;	// Time in 64s ticks
   uint16_t temp;	// ExpDecay temperature
 } __attribute__((packed));
@@ -56,6 +66,16 @@ struct Verifier {
     CKeyID   keyID;		// Key for verify message
 }; // 72 bytes = 18 words
 
+struct DNSCacheItem {	// Ready answer for (QNAME, QTYPE, QCLASS)
+    string   key;	// Lowercase QNAME + QTYPE + QCLASS
+    string   answer;	// Header with zero msgID and RD, and sections after the question
+    vector<pair<CNameVal, uint64_t> > names;	// Names the answer was built from, with nameCache generations
+    int      height_min;	// Valid while chain height is in [height_min..height_max]
+    int      height_max;	// (expiration of used names)
+    uint32_t expires;	// Time to drop, by TTL
+    vector<uint16_t> shuffle;	// (offset in answer, records, record size) of A/AAAA sets, shuffled per answer
+};
+
 
 struct TollFree {
     TollFree(const char *re) :
@@ -66,6 +86,8 @@ struct TollFree {
     vector<string>		e2u;
 };
 
+struct sockaddr_in6;
+
 class MfcDns {
   public:
      MfcDns(const char *bind_ip, uint16_t port_no,
@@ -73,14 +95,21 @@ class MfcDns {
 	    const char *local_fname, 
 	    uint32_t dapsize, uint32_t daptreshold,
 	    const char *enums, const char *tollfree, 
-	    uint8_t verbose);
+	    uint8_t verbose, int threads, uint32_t cachesize);
     ~MfcDns();
 
     void Run();
 
   private:
+    // Additional worker: shares configuration and DAP of the master,
+    // receives from own SO_REUSEPORT socket bound to sin6, or from master's socket if sin6 is NULL
+    MfcDns(MfcDns *master, const struct sockaddr_in6 *sin6);
     static void StatRun(void *p);
     int  HandlePacket();
+    int  CacheLookup();
+    void CacheStore();
+    void CacheStat(const char *when);
+    bool LookupName(const string &name, string &value);
     uint16_t HandleQuery();
     int  Search(uint8_t *key);
     int  LocalSearch(const uint8_t *key, uint8_t pos, uint8_t step);
@@ -106,16 +135,21 @@ class MfcDns {
     void OutS(const char *p);
 
     DNSHeader *m_hdr; // 1st bzero element
-    DNSAP    *m_dap_ht;	// Hashtable for DAP; index is hash(IP)
+    MfcDns   *m_master;	// Owner of configuration and DAP; this for the 1st worker
+    std::atomic<uint32_t> *m_dap_ht;	// Hashtable for DAP, DNSAP items; index is hash(IP); shared by all workers
     char     *m_value;
     const char *m_gw_suffix;
     uint8_t  *m_buf, *m_bufend, *m_snd, *m_rcv, *m_rcvend;
     SOCKET    m_sockfd;
     int       m_rcvlen;
     uint32_t m_timestamp;
-    uint32_t  m_daprand;	// DAP random value for universal hashing
     uint32_t  m_dapmask, m_dap_treshold;
     uint32_t  m_ttl;
+    uint32_t  m_cache_max;	// Max items in m_cache; 0 = disabled
+    uint32_t  m_cache_qlen;	// Question length of the packet with m_cache_key
+    int       m_cache_height;	// Chain height limit of the answer being built
+    uint32_t  m_stat_time;	// Time of the next CacheStat()
+    uint64_t  m_cache_hits, m_cache_misses;
     uint16_t  m_label_ref;
     uint16_t  m_gw_suf_len;
     char     *m_allowed_base;
@@ -128,6 +162,13 @@ class MfcDns {
     boost::thread m_thread;
     map<string, Verifier> m_verifiers;
     vector<TollFree>      m_tollfree;
+    list<DNSCacheItem>    m_cache_lru;	// Cached answers, most recently used first
+    unordered_map<string, list<DNSCacheItem>::iterator> m_cache;	// m_cache_lru items by DNSCacheItem::key
+    string                m_cache_key;	// Key of the packet in work; empty if not cacheable
+    vector<uint16_t>      m_cache_shuffle;	// DNSCacheItem::shuffle of the answer in work, from m_rcvend
+    vector<pair<CNameVal, uint64_t> > m_cache_names;	// DNSCacheItem::names of the answer in work
+    std::atomic<uint32_t> m_daprand;	// DAP random value for universal hashing; master only
+    vector<MfcDns*>       m_workers;	// Additional workers; master only
 }; // class MfcDns
 
 #endif // MFCDNS_H
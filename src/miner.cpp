@@ -23,6 +23,7 @@
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
 #include "wallet/wallet.h"
 #include "warnings.h"
@@ -33,7 +34,6 @@
 #include <queue>
 #include <utility>
 #include <stack>
-#include <fstream>
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -156,12 +156,17 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // ppcoin: if coinstake available add coinstake tx
     static int64_t nLastCoinStakeSearchTime = GetAdjustedTime();  // only initialized at startup
 
-    LOCK(cs_main);
-    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+    }
 
     bool fV7Enabled = IsV7Enabled(pindexPrev, chainparams.GetConsensus());
     nHeight = pindexPrev->nHeight + 1;
 
+    // mfcoin: the coinstake search runs before cs_main is taken for the rest
+    // of the block; CreateCoinStake() only locks while it needs chain state
     if (pwallet)  // attemp to find a coinstake
     {
         *pfPoSCancel = true;
@@ -170,7 +175,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         int64_t nSearchTime = txCoinStake.nTime; // search to current time
         if (nSearchTime > nLastCoinStakeSearchTime)
         {
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, txCoinStake, fV7Enabled, nHeight))
+            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, txCoinStake, pindexPrev, fV7Enabled, nHeight))
             {
                 if (txCoinStake.nTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - nMaxClockDrift))
                 {   // make sure coinstake would meet timestamp protocol
@@ -187,7 +192,20 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         if (*pfPoSCancel)
             return nullptr; // mfcoin: there is no point to continue if we failed to create coinstake
     }
-    else
+
+    LOCK(cs_main);
+    if (chainActive.Tip() != pindexPrev)
+    {
+        if (pwallet)
+        {
+            *pfPoSCancel = true;
+            return nullptr; // mfcoin: the coinstake was made on top of a block that is no longer the tip
+        }
+        pindexPrev = chainActive.Tip();
+        fV7Enabled = IsV7Enabled(pindexPrev, chainparams.GetConsensus());
+        nHeight = pindexPrev->nHeight + 1;
+    }
+    if (!pwallet)
         pblock->nBits = GetNextTargetRequired(pindexPrev, false, chainparams.GetConsensus());
 
     LOCK(mempool.cs);
@@ -319,12 +337,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewForkBlock(const CScript
     //const CChainParams& chainparams = Params();
     const int nForkHeight = nHeight - forkStartHeight;
 
-    std::string utxo_file_path = GetUTXOFileName(nHeight);
-    std::ifstream if_utxo(utxo_file_path, std::ios::binary | std::ios::in);
-    if (!if_utxo.is_open()) {
+    std::shared_ptr<const CUtxoSnapshotFile> utxoFile = GetUTXOSnapshot(nHeight);
+    if (!utxoFile) {
         bFileNotFound = true;
         LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: Cannot open UTXO file - %s\n",
-                  nHeight, nForkHeight, forkHeightRange, utxo_file_path);
+                  nHeight, nForkHeight, forkHeightRange, GetUTXOFileName(nHeight));
         return NULL;
     }
 
@@ -357,59 +374,22 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewForkBlock(const CScript
     uint64_t nBlockTx = 0;
     uint64_t nBlockSigOps = 100;
 
-    while (if_utxo && nBlockTx < forkCBPerBlock) {
-        char term = 0;
-
-        char coin[8] = {};
-        if (!if_utxo.read(coin, 8)) {
-            // the last file may be shorter than forkCBPerBlock
-            if(!if_utxo.eof() || nForkHeight != forkHeightRange)
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - No more data (Amount)\n",
-                          nHeight, nForkHeight, forkHeightRange);
-            break;
-        }
-
-        char pubkeysize[8] = {};
-        if (!if_utxo.read(pubkeysize, 8)) {
-            LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - Not more data (PubKeyScript size)\n",
-                      nHeight, nForkHeight, forkHeightRange);
-            break;
-        }
-
-        int pbsize = bytes2uint64(pubkeysize);
-        if (pbsize == 0) {
-            LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? -  PubKeyScript size = 0\n",
-                      nHeight, nForkHeight, forkHeightRange);
-            //but proceed
-        }
+    if (utxoFile->fMissingSeparator && utxoFile->vRecords.size() <= (size_t)forkCBPerBlock)
+        LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - No record separator after the last record\n",
+                  nHeight, nForkHeight, forkHeightRange);
 
-        std::unique_ptr<char[]> pubKeyScript(new char[pbsize]);
-        if (!if_utxo.read(&pubKeyScript[0], pbsize)) {
-            LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? Not more data (PubKeyScript)\n",
-                      nHeight, nForkHeight, forkHeightRange);
+    for (const CUtxoSnapshotRecord& rec : utxoFile->vRecords) {
+        if (nBlockTx >= forkCBPerBlock)
             break;
-        }
-
-        char timestamp_bytes[8] = {};
-        if (!if_utxo.read(timestamp_bytes, 8)) {
-            LogPrintf("ERROR: AddUtxoTransactions(): UTXO file corrupted? - Not more data (Timestamp)\n");
-            break;
-        }
-
-        uint64_t timestamp = bytes2uint64(timestamp_bytes);
-        uint64_t amount = bytes2uint64(coin);
 
         // Add coinbase tx's
         CMutableTransaction txNew;
         txNew.vin.resize(1);
         txNew.vin[0].prevout.SetNull();
         txNew.vout.resize(1);
-        txNew.nTime = timestamp;
-
-        unsigned char* pks = (unsigned char*)pubKeyScript.get();
-        txNew.vout[0].scriptPubKey = CScript(pks, pks+pbsize);
-
-        txNew.vout[0].nValue = amount;
+        txNew.nTime = rec.nTime;
+        txNew.vout[0].scriptPubKey = rec.GetScript();
+        txNew.vout[0].nValue = rec.nValue;
         if(nBlockTx == 0)
             txNew.vin[0].scriptSig = CScript() << nHeight << CScriptNum(nBlockTx) << ToByteVector(hashPid) << OP_0;
         else
@@ -428,14 +408,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewForkBlock(const CScript
         pblock->vtx.push_back(MakeTransactionRef(CTransaction(txNew)));
         nBlockSize += nTxSize;
         nBlockSigOps += nTxSigOps;
-        nBlockTotalAmount += amount;
+        nBlockTotalAmount += rec.nValue;
         ++nBlockTx;
-
-        if (!if_utxo.read(&term, 1) || term != '\n') {
-            LogPrintf("ERROR:  CreateNewForkBlock(): [%u, %u of %u]: invalid record separator\n",
-                      nHeight, nForkHeight, forkHeightRange);
-            break;
-        }
     }
     LogPrintf("CreateNewForkBlock(): [%u, %u of %u]: txns=%u size=%u amount=%u sigops=%u\n",
               nHeight, nForkHeight, forkHeightRange, nBlockTx, nBlockSize, nBlockTotalAmount, nBlockSigOps);
@@ -1158,20 +1132,19 @@ bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phas
     }
 }
 
-bool static ScanHashMTP(CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
-{
-    *phash = mtp::hash(*pblock, Params().GetConsensus().powLimit);
-    nNonce = pblock->nNonce;
-    return true;
+// Number of nonces tried between checks for a new tip or a stop request
+static const uint32_t nMTPNonceBatch = 0x1000;
 
-    // Return the nonce if the hash has at least some zero bits,
-    // caller will check if it has enough to reach the target
-    //if (((uint16_t *) phash)[15] == 0)
-    //    return true;
-
-    // If nothing found after trying for a while, return -1
-    //if ((nNonce & 0xfff) == 0)
-    //    return false;
+bool static ScanHashMTP(mtp::Solver& solver, CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
+{
+    // The memory and the Merkle tree are only rebuilt when the header
+    // fields covered by MTP change, trying more nonces is cheap
+    if (!solver.prepare(*pblock))
+        throw std::runtime_error("Cannot allocate the MTP memory");
+
+    // Return the nonce if the hash reaches the target, otherwise move
+    // past this batch so the caller can check if it should stop
+    return solver.search(*pblock, Params().GetConsensus().powLimit, nNonce, nMTPNonceBatch, *phash);
 }
 
 void static MFCoinMiner(const CChainParams& chainparams)
@@ -1185,6 +1158,7 @@ void static MFCoinMiner(const CChainParams& chainparams)
     GetMainSignals().ScriptForMining(coinbaseScript);
 
     bool bForkModeStarted = false;
+    mtp::Solver solver;
     try {
         // Throw an error if no script was provided.  This can happen
         // due to some internal error but also if the keypool is empty.
@@ -1262,7 +1236,7 @@ void static MFCoinMiner(const CChainParams& chainparams)
             uint32_t nNonce = 0;
             while (true) {
                 // Check if something found
-                if (ScanHashMTP(pblock, nNonce, &mtphash))
+                if (ScanHashMTP(solver, pblock, nNonce, &mtphash))
                 {
                     if (UintToArith256(mtphash) <= hashTarget)
                     {
@@ -1305,15 +1279,9 @@ void static MFCoinMiner(const CChainParams& chainparams)
                 if (pindexPrev != chainActive.Tip())
                     break;
 
-                // Update nTime every few seconds
-                if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
-                    break; // Recreate the block if the clock has run backwards,
-                           // so that we can use the correct time.
-                if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
-                {
-                    // Changing pblock->nTime can change work required on testnet:
-                    hashTarget.SetCompact(pblock->nBits);
-                }
+                // nTime is not updated while searching: it is hashed into the
+                // MTP memory, so every change would mean filling it again.
+                // The block gets a fresh time when it is recreated.
             }
         }
     }
@@ -0,0 +1,126 @@
+#include "mtpcache.h"
+
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include "cuckoocache.h"
+#include <atomic>
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Entries are salted hashes, see SignatureCacheHasher in script/sigcache.cpp.
+ */
+class MTPCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select <8, "MTPCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin()+4*hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * Valid MTP proof cache, to avoid running the Argon2/Blake2b verification
+ * again when the same block is received from another peer, read back from
+ * disk or reindexed.
+ */
+class CMTPCache
+{
+private:
+    //! Entries are SHA256d(nonce || block hash || MTP proof data)
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, MTPCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_mtpcache;
+    size_t nMaxElements;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    CMTPCache() : nMaxElements(0), nHits(0), nMisses(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const CBlockHeader& block)
+    {
+        // The header hash does not commit to the proof itself, so hash it
+        // too: a copy of a valid header with garbage proof data must not be
+        // accepted (and relayed) just because the real one was seen before.
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << block.GetHash() << *block.mtpHashData;
+        entry = ss.GetHash();
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_mtpcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_mtpcache);
+        setValid.insert(entry);
+    }
+
+    size_t setup_bytes(size_t n)
+    {
+        nMaxElements = setValid.setup_bytes(n);
+        return nMaxElements;
+    }
+
+    size_t max_elements() const
+    {
+        return nMaxElements;
+    }
+};
+
+static CMTPCache mtpCache;
+}
+
+// To be called once in AppInit2 to initialize the mtpCache
+void InitMTPCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxmtpcachesize", DEFAULT_MAX_MTP_CACHE_SIZE)), MAX_MAX_MTP_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = mtpCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for MTP cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+bool MTPCacheLookup(const CBlockHeader& block, uint256& entry)
+{
+    mtpCache.ComputeEntry(entry, block);
+    if (mtpCache.Get(entry)) {
+        ++mtpCache.nHits;
+        return true;
+    }
+    ++mtpCache.nMisses;
+    return false;
+}
+
+void MTPCacheInsert(const uint256& entry)
+{
+    mtpCache.Set(entry);
+}
+
+CMTPCacheStats GetMTPCacheStats()
+{
+    CMTPCacheStats stats;
+    stats.nHits = mtpCache.nHits;
+    stats.nMisses = mtpCache.nMisses;
+    stats.nMaxElements = mtpCache.max_elements();
+    return stats;
+}
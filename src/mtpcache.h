@@ -0,0 +1,34 @@
+#ifndef BITCOIN_MTPCACHE_H
+#define BITCOIN_MTPCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A cached entry is 32 bytes, so 4MB keeps the verification results of
+// over 100000 PoW block headers.
+static const unsigned int DEFAULT_MAX_MTP_CACHE_SIZE = 4;
+// Maximum MTP cache size allowed
+static const int64_t MAX_MAX_MTP_CACHE_SIZE = 1024;
+
+class CBlockHeader;
+class uint256;
+
+/** Usage counters of the MTP cache, reported by getmtpcacheinfo */
+struct CMTPCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    size_t nMaxElements;
+};
+
+void InitMTPCache();
+
+/** Compute the cache entry of a PoW block header and its MTP proof, return whether it is cached */
+bool MTPCacheLookup(const CBlockHeader& block, uint256& entry);
+
+/** Remember that the MTP proof behind `entry` was verified successfully */
+void MTPCacheInsert(const uint256& entry);
+
+CMTPCacheStats GetMTPCacheStats();
+
+#endif // BITCOIN_MTPCACHE_H
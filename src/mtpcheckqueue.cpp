@@ -0,0 +1,98 @@
+#include "mtpcheckqueue.h"
+
+#include "pow.h"
+
+void CMTPCheckQueue::Evict()
+{
+    while (mapJobs.size() >= nMaxJobs) {
+        // drop the oldest job nobody is waiting for; running ones are kept
+        std::map<uint256, JobRef>::iterator itOldest = mapJobs.end();
+        for (std::map<uint256, JobRef>::iterator it = mapJobs.begin(); it != mapJobs.end(); ++it) {
+            if (it->second->state == JOB_RUNNING)
+                continue;
+            if (itOldest == mapJobs.end() || it->second->nSequence < itOldest->second->nSequence)
+                itOldest = it;
+        }
+        if (itOldest == mapJobs.end())
+            return;
+        itOldest->second->state = JOB_CANCELLED;
+        mapJobs.erase(itOldest);
+    }
+}
+
+void CMTPCheckQueue::Thread()
+{
+    while (true) {
+        JobRef job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.empty())
+                condWorker.wait(lock);
+            job = queue.front();
+            queue.pop_front();
+            if (job->state != JOB_QUEUED)
+                continue; // joined or evicted before we got to it
+            job->state = JOB_RUNNING;
+        }
+
+        bool fValid = CheckMerkleTreeProof(job->header, *job->params);
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            job->fValid = fValid;
+            job->state = JOB_DONE;
+        }
+        condDone.notify_all();
+    }
+}
+
+void CMTPCheckQueue::Push(const CBlockHeader& header, const Consensus::Params& params)
+{
+    if (!header.mtpHashData)
+        return;
+
+    uint256 hash = header.GetHash();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (mapJobs.count(hash))
+        return;
+    Evict();
+
+    JobRef job = std::make_shared<Job>();
+    job->header = header;
+    job->params = &params;
+    job->state = JOB_QUEUED;
+    job->fValid = false;
+    job->nSequence = nSequence++;
+
+    mapJobs.emplace(hash, job);
+    queue.push_back(job);
+    condWorker.notify_one();
+}
+
+bool CMTPCheckQueue::Join(const CBlockHeader& header, bool& fValid)
+{
+    if (!header.mtpHashData)
+        return false;
+
+    uint256 hash = header.GetHash();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::map<uint256, JobRef>::iterator it = mapJobs.find(hash);
+    if (it == mapJobs.end())
+        return false;
+
+    JobRef job = it->second;
+    if (job->header.mtpHashData != header.mtpHashData)
+        return false; // queued for a different copy of this block
+
+    mapJobs.erase(it);
+    if (job->state == JOB_QUEUED) {
+        // cheaper to verify it right here than to wait for a free worker
+        job->state = JOB_CANCELLED;
+        return false;
+    }
+
+    while (job->state == JOB_RUNNING)
+        condDone.wait(lock);
+    fValid = job->fValid;
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef BITCOIN_MTPCHECKQUEUE_H
+#define BITCOIN_MTPCHECKQUEUE_H
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Consensus { struct Params; }
+
+/**
+ * Queue of MTP proof verifications for blocks that are not connected yet.
+ *
+ * PoW blocks are pushed as soon as they are received from the network and
+ * verified by a pool of worker threads while they wait to be connected.
+ * When the block reaches CheckBlock, the result is joined instead of running
+ * the verification again on the message handler thread under cs_main.
+ *
+ * Results are bound to the exact CMTPHashData object that was queued, so a
+ * different block that happens to share the header hash never picks up a
+ * result that was not computed for its own proof.
+ */
+class CMTPCheckQueue
+{
+private:
+    enum JobState {
+        JOB_QUEUED,
+        JOB_RUNNING,
+        JOB_DONE,
+        JOB_CANCELLED,
+    };
+
+    struct Job
+    {
+        CBlockHeader header;
+        const Consensus::Params* params;
+        JobState state;
+        bool fValid;
+        uint64_t nSequence;
+    };
+    typedef std::shared_ptr<Job> JobRef;
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Threads joining a running verification block on this
+    boost::condition_variable condDone;
+
+    //! Verifications that have not been picked up by a worker yet, oldest first
+    std::deque<JobRef> queue;
+
+    //! All queued, running and finished verifications by block hash
+    std::map<uint256, JobRef> mapJobs;
+
+    //! Sequence number of the next pushed job, used for eviction
+    uint64_t nSequence;
+
+    //! Maximum number of entries kept in mapJobs
+    size_t nMaxJobs;
+
+    /** Drop the oldest jobs that are not running until there is room for one more. */
+    void Evict();
+
+public:
+    //! Create a new queue that keeps at most nMaxJobsIn verifications
+    explicit CMTPCheckQueue(size_t nMaxJobsIn) : nSequence(0), nMaxJobs(nMaxJobsIn) {}
+
+    //! Worker thread
+    void Thread();
+
+    //! Queue the MTP verification of a PoW block header
+    void Push(const CBlockHeader& header, const Consensus::Params& params);
+
+    /**
+     * Take the result of a verification that was pushed for this header,
+     * waiting for it if a worker is busy with it. Returns false if the
+     * header was not queued (or has not been started yet), in which case
+     * the caller has to verify it by itself.
+     */
+    bool Join(const CBlockHeader& header, bool& fValid);
+};
+
+#endif // BITCOIN_MTPCHECKQUEUE_H
@@ -3,15 +3,23 @@
 #include "rpc/server.h"
 #include "wallet/wallet.h"
 #include "base58.h"
+#include "init.h"
 #include "txmempool.h"
+#include "undo.h"
+#include "hash.h"
 
 #include <boost/format.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
 map<CNameVal, set<uint256> > mapNamePending; // for pending tx
+CNameCache nameCache;
+CNameDB *pnameindex = NULL;
 
 class CNamecoinHooks : public CHooks
 {
@@ -75,6 +83,18 @@ string encodeNameVal(const CNameVal& input, const string& format)
     return output;
 }
 
+// Sets expiration height of the last op in nameRec: height of the name_new that
+// started its chain plus rental days of every op in the chain.
+static void SetOpExpiresAt(CNameRecord& nameRec)
+{
+    CNameIndex& ind = nameRec.vtxPos.back();
+    int64_t sum = (ind.op == OP_NAME_NEW || nameRec.vtxPos.size() < 2) ? ind.nHeight : nameRec.vtxPos[nameRec.vtxPos.size() - 2].nExpiresAt;
+    sum += (int64_t)ind.nRentalDays * 175; //days to blocks. 175 is average number of blocks per day
+
+    //limit to INT_MAX value
+    ind.nExpiresAt = sum > INT_MAX ? INT_MAX : sum;
+}
+
 // Calculate at which block will expire.
 bool CalculateExpiresAt(CNameRecord& nameRec)
 {
@@ -84,32 +104,15 @@ bool CalculateExpiresAt(CNameRecord& nameRec)
         return true;
     }
 
-    int64_t sum = 0;
-    for(unsigned int i = nameRec.nLastActiveChainIndex; i < nameRec.vtxPos.size(); i++)
-    {
-        CTransactionRef tx;
-        if (!GetTransaction(nameRec.vtxPos[i].txPos, tx))
-            return error("CalculateExpiresAt() : could not read tx from disk");
-
-        NameTxInfo nti;
-        if (!DecodeNameTx(tx, nti))
-            return error("CalculateExpiresAt() : %s is not name tx, this should never happen", tx->GetHash().GetHex());
-
-        sum += nti.nRentalDays * 175; //days to blocks. 175 is average number of blocks per day
-    }
-
-    //limit to INT_MAX value
-    sum += nameRec.vtxPos[nameRec.nLastActiveChainIndex].nHeight;
-    nameRec.nExpiresAt = sum > INT_MAX ? INT_MAX : sum;
-
+    nameRec.nExpiresAt = nameRec.vtxPos.back().nExpiresAt;
     return true;
 }
 
 // Tests if name is active. You can optionaly specify at which height it is/was active.
-bool NameActive(CNameDB& dbName, const CNameVal& name, int currentBlockHeight = -1)
+bool NameActive(const CNameVal& name, int currentBlockHeight = -1)
 {
     CNameRecord nameRec;
-    if (!dbName.ReadName(name, nameRec))
+    if (!pnameindex->ReadName(name, nameRec))
         return false;
 
     if (currentBlockHeight < 0)
@@ -121,12 +124,6 @@ bool NameActive(CNameDB& dbName, const CNameVal& name, int currentBlockHeight =
     return currentBlockHeight <= nameRec.nExpiresAt;
 }
 
-bool NameActive(const CNameVal& name, int currentBlockHeight = -1)
-{
-    CNameDB dbName("r");
-    return NameActive(dbName, name, currentBlockHeight);
-}
-
 // Returns minimum name operation fee rounded down to cents. Should be used during|before transaction creation.
 // If you wish to calculate if fee is enough - use IsNameFeeEnough() function.
 // Generaly:  GetNameOpFee() > IsNameFeeEnough().
@@ -158,73 +155,390 @@ CAmount GetNameOpFee(const CBlockIndex* pindex, const int nRentalDays, int op, c
     return txMinFee;
 }
 
-// scans nameindex.dat and return names with their last CNameIndex
-// if nMax == 0 - it will scan all names
-bool CNameDB::ScanNames(const CNameVal& name, unsigned int nMax,
-        vector<
-            pair<
-                CNameVal,
-                pair<CNameIndex, int>
-            >
-        > &nameScan)
+static const char DB_NAME = 'n';
+static const char DB_NAME_ADDRESS = 'a';
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_VERSION = 'V';
+static const char DB_NAME_HEIGHT = 'h';
+
+namespace {
+
+// DB_NAME followed by the raw name, so that names are iterated in lexicographic order
+struct NameKey
 {
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
-        return false;
+    char key;
+    CNameVal name;
 
-    bool fRange = true;
-    while (true)
-    {
-        // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fRange)
-            ssKey << make_pair(string("namei"), name);
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fRange);
-        fRange = false;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
-            return false;
+    NameKey() : key(DB_NAME) {}
+    NameKey(const CNameVal& nameIn) : key(DB_NAME), name(nameIn) {}
 
-        // Unserialize
-        string strType;
-        ssKey >> strType;
-        if (strType == "namei")
-        {
-            CNameVal name2;
-            ssKey >> name2;
-            CNameRecord val;
-            ssValue >> val;
-            if (val.deleted() || val.vtxPos.empty())
-                continue;
-            nameScan.push_back(make_pair(name2, make_pair(val.vtxPos.back(), val.nExpiresAt)));
-        }
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << key;
+        if (!name.empty())
+            s.write((const char*)name.data(), name.size());
+    }
 
-        if (nMax > 0 && nameScan.size() >= nMax)
-            break;
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> key;
+        name.resize(s.size());
+        if (!name.empty())
+            s.read((char*)name.data(), name.size());
+    }
+};
+
+// DB_NAME_ADDRESS, address and the raw name - one entry per name owned by address
+struct NameAddressKey
+{
+    char key;
+    std::string address;
+    CNameVal name;
+
+    NameAddressKey() : key(DB_NAME_ADDRESS) {}
+    NameAddressKey(const std::string& addressIn, const CNameVal& nameIn) : key(DB_NAME_ADDRESS), address(addressIn), name(nameIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << key << address;
+        if (!name.empty())
+            s.write((const char*)name.data(), name.size());
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> key;
+        if (key != DB_NAME_ADDRESS)
+            return;
+        s >> address;
+        name.resize(s.size());
+        if (!name.empty())
+            s.read((char*)name.data(), name.size());
     }
-    pcursor->close();
+};
+
+// DB_NAME_HEIGHT, big endian height of the name_new that started the active
+// chain of the name and the raw name - names in order of registration
+struct NameHeightKey
+{
+    char key;
+    int nHeight;
+    CNameVal name;
+
+    NameHeightKey() : key(DB_NAME_HEIGHT), nHeight(0) {}
+    NameHeightKey(int nHeightIn, const CNameVal& nameIn) : key(DB_NAME_HEIGHT), nHeight(nHeightIn), name(nameIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << key;
+        ser_writedata32(s, htobe32(nHeight));
+        if (!name.empty())
+            s.write((const char*)name.data(), name.size());
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> key;
+        if (key != DB_NAME_HEIGHT)
+            return;
+        nHeight = be32toh(ser_readdata32(s));
+        name.resize(s.size());
+        if (!name.empty())
+            s.read((char*)name.data(), name.size());
+    }
+};
+
+// key of a name in the height index, false if it is not listed there
+bool GetNameHeightKey(const CNameRecord& rec, int& nHeight)
+{
+    if (rec.deleted() || rec.vtxPos.empty())
+        return false;
+    nHeight = rec.vtxPos[rec.nLastActiveChainIndex].nHeight;
+    return true;
+}
+
+}
+
+CNameDB::CNameDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "nameindex", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CNameDB::WriteName(const CNameVal& name, const CNameRecord& rec)
+{
+    LOCK(cs);
+    CNameRecord recOld;
+    int nHeight;
+    if (ReadName(name, recOld) && GetNameHeightKey(recOld, nHeight))
+        mapHeights[make_pair(nHeight, name)] = false;
+    if (GetNameHeightKey(rec, nHeight))
+        mapHeights[make_pair(nHeight, name)] = true;
+    mapNames[name] = make_pair(true, rec);
     return true;
 }
 
 bool CNameDB::ReadName(const CNameVal& name, CNameRecord& rec)
 {
-    bool ret = Read(make_pair(std::string("namei"), name), rec);
+    bool ret;
+    {
+        LOCK(cs);
+        map<CNameVal, pair<bool, CNameRecord> >::const_iterator mi = mapNames.find(name);
+        if (mi == mapNames.end())
+            ret = Read(NameKey(name), rec);
+        else if ((ret = mi->second.first))
+            rec = mi->second.second;
+    }
     int s = rec.vtxPos.size();
 
      // check if array index is out of array bounds
     if (s > 0 && rec.nLastActiveChainIndex >= s)
     {
-        // delete nameindex and kill the application. nameindex should be recreated on next start
-        boost::system::error_code err;
-        boost::filesystem::remove(GetDataDir() / this->strFile, err);
+        // kill the application. nameindex will be recreated on next start
+        SetCorrupt();
         LogPrintf("Nameindex is corrupt! It will be recreated on next start.");
         assert(rec.nLastActiveChainIndex < s);
     }
     return ret;
 }
 
+bool CNameDB::ExistsName(const CNameVal& name)
+{
+    LOCK(cs);
+    map<CNameVal, pair<bool, CNameRecord> >::const_iterator mi = mapNames.find(name);
+    if (mi != mapNames.end())
+        return mi->second.first;
+    return Exists(NameKey(name));
+}
+
+bool CNameDB::EraseName(const CNameVal& name)
+{
+    LOCK(cs);
+    CNameRecord recOld;
+    int nHeight;
+    if (ReadName(name, recOld) && GetNameHeightKey(recOld, nHeight))
+        mapHeights[make_pair(nHeight, name)] = false;
+    mapNames[name] = make_pair(false, CNameRecord());
+    return true;
+}
+
+bool CNameDB::ForEachName(const CNameVal& name, const std::function<bool(const CNameVal&, const CNameRecord&)>& f)
+{
+    // Take the not yet written names and a LevelDB snapshot at the same point, then scan
+    // without cs so that a slow callback does not hold up the name hooks of ConnectBlock.
+    std::unique_ptr<CDBIterator> pcursor;
+    map<CNameVal, pair<bool, CNameRecord> > mapPending;
+    {
+        LOCK(cs);
+        pcursor.reset(NewIterator());
+        mapPending.insert(mapNames.lower_bound(name), mapNames.end());
+    }
+    pcursor->Seek(NameKey(name));
+    map<CNameVal, pair<bool, CNameRecord> >::const_iterator mi = mapPending.begin();
+
+    // merge names on disk with the ones not yet written, the latter take precedence
+    NameKey key;
+    bool fKey = pcursor->Valid() && pcursor->GetKey(key) && key.key == DB_NAME;
+    while (fKey || mi != mapPending.end())
+    {
+        if (mi != mapPending.end() && (!fKey || mi->first <= key.name))
+        {
+            if (fKey && mi->first == key.name)
+            {
+                pcursor->Next();
+                fKey = pcursor->Valid() && pcursor->GetKey(key) && key.key == DB_NAME;
+            }
+            if (mi->second.first && !f(mi->first, mi->second.second))
+                return true;
+            ++mi;
+            continue;
+        }
+
+        CNameRecord rec;
+        if (!pcursor->GetValue(rec))
+            return error("%s: failed to read %s", __func__, stringFromNameVal(key.name));
+        if (!f(key.name, rec))
+            return true;
+        pcursor->Next();
+        fKey = pcursor->Valid() && pcursor->GetKey(key) && key.key == DB_NAME;
+    }
+    return true;
+}
+
+bool CNameDB::ForEachNameFromHeight(int nHeight, const std::function<bool(const CNameVal&, const CNameRecord&)>& f)
+{
+    // as in ForEachName, only the copy of the pending changes is made under cs
+    std::unique_ptr<CDBIterator> pcursor, precords;
+    map<CNameVal, pair<bool, CNameRecord> > mapPending;
+    map<pair<int, CNameVal>, bool> mapPendingHeights;
+    {
+        LOCK(cs);
+        pcursor.reset(NewIterator());
+        precords.reset(NewIterator());
+        mapPending = mapNames;
+        mapPendingHeights.insert(mapHeights.lower_bound(make_pair(nHeight, CNameVal())), mapHeights.end());
+    }
+
+    set<pair<int, CNameVal> > setKeys;
+    pcursor->Seek(NameHeightKey(std::max(nHeight, 0), CNameVal()));
+    while (pcursor->Valid())
+    {
+        NameHeightKey key;
+        if (!pcursor->GetKey(key) || key.key != DB_NAME_HEIGHT)
+            break;
+        setKeys.insert(make_pair(key.nHeight, key.name));
+        pcursor->Next();
+    }
+
+    for (const auto& entry : mapPendingHeights)
+    {
+        if (entry.second)
+            setKeys.insert(entry.first);
+        else
+            setKeys.erase(entry.first);
+    }
+
+    for (const auto& key : setKeys)
+    {
+        CNameRecord rec;
+        map<CNameVal, pair<bool, CNameRecord> >::const_iterator mi = mapPending.find(key.second);
+        if (mi != mapPending.end())
+        {
+            if (!mi->second.first)
+                return error("%s: failed to read %s", __func__, stringFromNameVal(key.second));
+            if (!f(key.second, mi->second.second))
+                break;
+            continue;
+        }
+
+        // read the record from the same snapshot as the height keys
+        NameKey nameKey;
+        precords->Seek(NameKey(key.second));
+        if (!(precords->Valid() && precords->GetKey(nameKey) && nameKey.key == DB_NAME && nameKey.name == key.second && precords->GetValue(rec)))
+            return error("%s: failed to read %s", __func__, stringFromNameVal(key.second));
+        if (!f(key.second, rec))
+            break;
+    }
+    return true;
+}
+
+// scans name index and return names with their last CNameIndex
+// if nMax == 0 - it will scan all names
+bool CNameDB::ScanNames(const CNameVal& name, unsigned int nMax,
+        vector<
+            pair<
+                CNameVal,
+                pair<CNameIndex, int>
+            >
+        > &nameScan)
+{
+    return ForEachName(name, [&](const CNameVal& name2, const CNameRecord& val) {
+        if (val.deleted() || val.vtxPos.empty())
+            return true;
+        nameScan.push_back(make_pair(name2, make_pair(val.vtxPos.back(), val.nExpiresAt)));
+        return nMax == 0 || nameScan.size() < nMax;
+    });
+}
+
+bool CNameDB::ReadAddress(const std::string& address, std::set<CNameVal>& names)
+{
+    LOCK(cs);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(NameAddressKey(address, CNameVal()));
+    while (pcursor->Valid())
+    {
+        NameAddressKey key;
+        if (!pcursor->GetKey(key) || key.key != DB_NAME_ADDRESS || key.address != address)
+            break;
+        names.insert(key.name);
+        pcursor->Next();
+    }
+
+    map<pair<string, CNameVal>, bool>::const_iterator mi = mapAddresses.lower_bound(make_pair(address, CNameVal()));
+    for (; mi != mapAddresses.end() && mi->first.first == address; ++mi)
+    {
+        if (mi->second)
+            names.insert(mi->first.second);
+        else
+            names.erase(mi->first.second);
+    }
+    return !names.empty();
+}
+
+bool CNameDB::MoveName(const std::string& oldAddress, const std::string& newAddress, const CNameVal& name)
+{
+    if (newAddress == oldAddress) // nothing to do
+        return true;
+
+    LOCK(cs);
+    if (oldAddress != "")
+        mapAddresses[make_pair(oldAddress, name)] = false;
+    if (newAddress != "")
+        mapAddresses[make_pair(newAddress, name)] = true;
+    return true;
+}
+
+bool CNameDB::Flush(const uint256& hashBlock)
+{
+    LOCK(cs);
+    CDBBatch batch(*this);
+    for (const auto& entry : mapNames)
+    {
+        if (entry.second.first)
+            batch.Write(NameKey(entry.first), entry.second.second);
+        else
+            batch.Erase(NameKey(entry.first));
+    }
+    for (const auto& entry : mapAddresses)
+    {
+        if (entry.second)
+            batch.Write(NameAddressKey(entry.first.first, entry.first.second), '\0');
+        else
+            batch.Erase(NameAddressKey(entry.first.first, entry.first.second));
+    }
+    for (const auto& entry : mapHeights)
+    {
+        if (entry.second)
+            batch.Write(NameHeightKey(entry.first.first, entry.first.second), '\0');
+        else
+            batch.Erase(NameHeightKey(entry.first.first, entry.first.second));
+    }
+    batch.Write(DB_VERSION, NAMEINDEX_VERSION);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    LogPrint("coindb", "Committing %u changed names and %u address entries to name index...\n", (unsigned int)mapNames.size(), (unsigned int)mapAddresses.size());
+    if (!WriteBatch(batch))
+        return false;
+    mapNames.clear();
+    mapAddresses.clear();
+    mapHeights.clear();
+    return true;
+}
+
+int CNameDB::GetVersion()
+{
+    int nVersion;
+    if (!Read(DB_VERSION, nVersion))
+        return 0;
+    return nVersion;
+}
+
+uint256 CNameDB::GetBestBlock()
+{
+    uint256 hashBlock;
+    if (!Read(DB_BEST_BLOCK, hashBlock))
+        return uint256();
+    return hashBlock;
+}
+
+void CNameDB::SetCorrupt()
+{
+    Erase(DB_BEST_BLOCK, true);
+}
+
 CHooks* InitHook()
 {
     return new CNamecoinHooks();
@@ -261,10 +575,10 @@ bool CNamecoinHooks::IsNameFeeEnough(const CTransactionRef& tx, const CAmount& t
 }
 
 //returns first name operation. I.e. name_new from chain like name_new->name_update->name_update->...->name_update
-bool GetFirstTxOfName(CNameDB& dbName, const CNameVal& name, CTransactionRef& tx)
+bool GetFirstTxOfName(const CNameVal& name, CTransactionRef& tx)
 {
     CNameRecord nameRec;
-    if (!dbName.ReadName(name, nameRec) || nameRec.vtxPos.empty())
+    if (!pnameindex->ReadName(name, nameRec) || nameRec.vtxPos.empty())
         return false;
     CNameIndex& txPos = nameRec.vtxPos[nameRec.nLastActiveChainIndex];
 
@@ -273,9 +587,9 @@ bool GetFirstTxOfName(CNameDB& dbName, const CNameVal& name, CTransactionRef& tx
     return true;
 }
 
-bool GetLastTxOfName(CNameDB& dbName, const CNameVal& name, CTransactionRef& tx, CNameRecord& nameRec)
+bool GetLastTxOfName(const CNameVal& name, CTransactionRef& tx, CNameRecord& nameRec)
 {
-    if (!dbName.ReadName(name, nameRec))
+    if (!pnameindex->ReadName(name, nameRec))
         return false;
     if (nameRec.deleted() || nameRec.vtxPos.empty())
         return false;
@@ -287,10 +601,10 @@ bool GetLastTxOfName(CNameDB& dbName, const CNameVal& name, CTransactionRef& tx,
     return true;
 }
 
-bool GetLastTxOfName(CNameDB& dbName, const CNameVal& name, CTransactionRef& tx)
+bool GetLastTxOfName(const CNameVal& name, CTransactionRef& tx)
 {
     CNameRecord nameRec;
-    return GetLastTxOfName(dbName, name, tx, nameRec);
+    return GetLastTxOfName(name, tx, nameRec);
 }
 
 
@@ -332,29 +646,27 @@ UniValue sendtoname(const JSONRPCRequest& request)
 
 bool GetNameCurrentAddress(const CNameVal& name, CBitcoinAddress& address, string& error)
 {
-    CNameDB dbName("r");
-    if (!dbName.ExistsName(name))
+    CNameCacheEntry entry;
+    if (!nameCache.Get(name, entry))
     {
         error = "Name not found";
         return false;
     }
 
-    CTransactionRef tx;
-    NameTxInfo nti;
-    if (!(GetLastTxOfName(dbName, name, tx) && DecodeNameTx(tx, nti, true)))
+    if (entry.fDeleted)
     {
-        error = "Failed to read/decode last name transaction";
+        error = "Name has been deleted";
         return false;
     }
 
-    address.SetString(nti.strAddress);
+    address.SetString(entry.strAddress);
     if (!address.IsValid())
     {
         error = "Name contains invalid address"; // this error should never happen, and if it does - this probably means that client blockchain database is corrupted
         return false;
     }
 
-    if (!NameActive(dbName, name))
+    if (!entry.IsActive(chainActive.Height()))
     {
         stringstream ss;
         ss << "This name have expired. If you still wish to send money to it's last owner you can use this command:\n"
@@ -407,32 +719,28 @@ UniValue name_list(const JSONRPCRequest& request)
 // read wallet name txs and extract: name, value, rentalDays, nOut and nExpiresAt
 void GetNameList(const CNameVal& nameUniq, std::map<CNameVal, NameTxInfo> &mapNames, std::map<CNameVal, NameTxInfo> &mapPending)
 {
-    CNameDB dbName("r");
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     // add all names from wallet tx that are in blockchain
-    BOOST_FOREACH(const PAIRTYPE(uint256, CWalletTx) &item, pwalletMain->mapWallet)
+    set<CNameVal>::const_iterator itBegin = pwalletMain->setNameTx.begin();
+    set<CNameVal>::const_iterator itEnd = pwalletMain->setNameTx.end();
+    if (nameUniq.size() > 0)
+    {
+        itBegin = pwalletMain->setNameTx.find(nameUniq);
+        itEnd = itBegin == itEnd ? itEnd : std::next(itBegin);
+    }
+    for (set<CNameVal>::const_iterator it = itBegin; it != itEnd; ++it)
     {
-        NameTxInfo ntiWalllet;
-        if (!DecodeNameTx(item.second.tx, ntiWalllet))
-            continue;
-
-        if (mapNames.count(ntiWalllet.name)) // already added info about this name
-            continue;
-
         CTransactionRef tx;
         CNameRecord nameRec;
-        if (!GetLastTxOfName(dbName, ntiWalllet.name, tx, nameRec))
+        if (!GetLastTxOfName(*it, tx, nameRec))
             continue;
 
         NameTxInfo nti;
         if (!DecodeNameTx(tx, nti, true))
             continue;
 
-        if (nameUniq.size() > 0 && nameUniq != nti.name)
-            continue;
-
-        if (!dbName.ExistsName(nti.name))
+        if (!pnameindex->ExistsName(nti.name))
             continue;
 
         nti.nExpiresAt = nameRec.nExpiresAt;
@@ -525,35 +833,23 @@ UniValue name_show(const JSONRPCRequest& request)
     CNameVal name = nameValFromValue(request.params[0]);
     string outputType = request.params.size() > 1 ? request.params[1].get_str() : "";
     string sName = stringFromNameVal(name);
-    NameTxInfo nti;
+    CNameCacheEntry entry;
     {
         LOCK(cs_main);
-        CNameRecord nameRec;
-        CNameDB dbName("r");
-        if (!dbName.ReadName(name, nameRec))
+        if (!nameCache.Get(name, entry))
             throw JSONRPCError(RPC_WALLET_ERROR, "failed to read from name DB");
 
-        if (nameRec.vtxPos.size() < 1)
-            throw JSONRPCError(RPC_WALLET_ERROR, "no result returned");
-
-        CTransactionRef tx;
-        if (!GetTransaction(nameRec.vtxPos.back().txPos, tx))
-            throw JSONRPCError(RPC_WALLET_ERROR, "failed to read from from disk");
-
-        if (!DecodeNameTx(tx, nti, true))
-            throw JSONRPCError(RPC_WALLET_ERROR, "failed to decode name");
-
         oName.push_back(Pair("name", sName));
-        oName.push_back(Pair("value", encodeNameVal(nti.value, outputType)));
-        oName.push_back(Pair("txid", tx->GetHash().GetHex()));
-        oName.push_back(Pair("address", nti.strAddress));
-        oName.push_back(Pair("expires_in", nameRec.nExpiresAt - chainActive.Height()));
-        oName.push_back(Pair("expires_at", nameRec.nExpiresAt));
-        oName.push_back(Pair("time", (boost::int64_t)tx->nTime));
-        if (nameRec.deleted())
+        oName.push_back(Pair("value", encodeNameVal(entry.value, outputType)));
+        oName.push_back(Pair("txid", entry.txid.GetHex()));
+        oName.push_back(Pair("address", entry.strAddress));
+        oName.push_back(Pair("expires_in", entry.nExpiresAt - chainActive.Height()));
+        oName.push_back(Pair("expires_at", entry.nExpiresAt));
+        oName.push_back(Pair("time", (boost::int64_t)entry.nTime));
+        if (entry.fDeleted)
             oName.push_back(Pair("deleted", true));
         else
-            if (nameRec.nExpiresAt - chainActive.Height() <= 0)
+            if (entry.nExpiresAt - chainActive.Height() <= 0)
                 oName.push_back(Pair("expired", true));
     }
 
@@ -565,7 +861,7 @@ UniValue name_show(const JSONRPCRequest& request)
         if (!file.is_open())
             throw JSONRPCError(RPC_PARSE_ERROR, "Failed to open file. Check if you have permission to open it.");
 
-        file.write((const char*)&nti.value[0], nti.value.size());
+        file.write((const char*)entry.value.data(), entry.value.size());
         file.close();
     }
 
@@ -610,8 +906,7 @@ UniValue name_history(const JSONRPCRequest& request)
     CNameRecord nameRec;
     {
         LOCK(cs_main);
-        CNameDB dbName("r");
-        if (!dbName.ReadName(name, nameRec))
+        if (!pnameindex->ReadName(name, nameRec))
             throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read from name DB");
     }
 
@@ -713,18 +1008,43 @@ UniValue name_mempool(const JSONRPCRequest& request)
     return res;
 }
 
-// used for sorting in name_filter by nHeight
-bool mycompare2 (const UniValue& lhs, const UniValue& rhs)
+// Literal text every match of an anchored regexp starts with, e.g. "dns:" for "^dns:.*"
+static string RegexLiteralPrefix(const string& strRegexp)
 {
-    int pos = 2; //this should exactly match field name position in name_filter
+    if (strRegexp.empty() || strRegexp[0] != '^' || strRegexp.find('|') != string::npos)
+        return "";
 
-    return lhs[pos].get_int() < rhs[pos].get_int();
+    string prefix;
+    for (unsigned int i = 1; i < strRegexp.size(); i++)
+    {
+        char c = strRegexp[i];
+        if (c == '?' || c == '*' || c == '{')
+        {
+            // previous char is optional
+            if (!prefix.empty())
+                prefix.resize(prefix.size() - 1);
+            break;
+        }
+        if (c == '\0' || strchr("\\.^$+()[]", c))
+            break;
+        prefix += c;
+    }
+    return prefix;
 }
+
+struct NameFilterMatch
+{
+    CNameVal name;
+    CNameVal value;
+    int nHeight;
+    int nExpiresAt;
+};
+
 UniValue name_filter(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() > 6)
+    if (request.fHelp || request.params.size() > 7)
         throw runtime_error(
-                "name_filter [regexp] [maxage=0] [from=0] [nb=0] [stat] [valuetype]\n"
+                "name_filter [regexp] [maxage=0] [from=0] [nb=0] [stat] [valuetype] [start-name]\n"
                 "scan and filter names\n"
                 "[regexp] : apply [regexp] on names, empty means all names\n"
                 "[maxage] : look in last [maxage] blocks\n"
@@ -732,6 +1052,7 @@ UniValue name_filter(const JSONRPCRequest& request)
                 "[nb] : show [nb] results, 0 means all\n"
                 "[stat] : show some stats instead of results\n"
                 "[valuetype] : if \"hex\" or \"base64\" is specified then it will print value in corresponding format instead of string.\n"
+                "[start-name] : only look at names from [start-name] on, in byte order. Use to page through results instead of [from].\n"
                 "name_filter \"\" 5 # list names updated in last 5 blocks\n"
                 "name_filter \"^id/\" # list all names from the \"id\" namespace\n"
                 "name_filter \"^id/\" 0 0 0 stat # display stats (number of names) on active names from the \"id\" namespace\n"
@@ -740,94 +1061,102 @@ UniValue name_filter(const JSONRPCRequest& request)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "MFCoin is downloading blocks...");
 
-    int nCountFrom = 0;
-    int nCountNb = 0;
-
     string strRegexp  = request.params.size() > 0 ? request.params[0].get_str() : "";
     int nMaxAge       = request.params.size() > 1 ? request.params[1].get_int() : 0;
     int nFrom         = request.params.size() > 2 ? request.params[2].get_int() : 0;
     int nNb           = request.params.size() > 3 ? request.params[3].get_int() : 0;
     bool fStat        = request.params.size() > 4 ? (request.params[4].get_str() == "stat" ? true : false) : false;
     string outputType = request.params.size() > 5 ? request.params[5].get_str() : "";
-
-    CNameDB dbName("r");
-    vector<UniValue> oRes;
-
-    CNameVal name;
-    vector<pair<CNameVal, pair<CNameIndex,int> > > nameScan;
-    {
-        LOCK(cs_main);
-        if (!dbName.ScanNames(name, 0, nameScan))
-            throw JSONRPCError(RPC_WALLET_ERROR, "scan failed");
-    }
+    CNameVal start    = request.params.size() > 6 ? nameValFromValue(request.params[6]) : CNameVal();
 
     // compile regex once
     using namespace boost::xpressive;
     smatch nameparts;
     sregex cregex = sregex::compile(strRegexp);
 
-    pair<CNameVal, pair<CNameIndex,int> > pairScan;
-    BOOST_FOREACH(pairScan, nameScan)
-    {
-        string name = stringFromNameVal(pairScan.first);
+    // names matching an anchored regexp are next to each other in the name index
+    CNameVal prefix = nameValFromString(RegexLiteralPrefix(strRegexp));
 
-        // regexp
-        if(strRegexp != "" && !regex_search(name, nameparts, cregex))
-            continue;
+    int nTip;
+    {
+        LOCK(cs_main);
+        nTip = chainActive.Height();
+    }
 
-        CNameIndex txName = pairScan.second.first;
+    vector<NameFilterMatch> vMatch;
+    auto filter = [&](const CNameVal& name, const CNameRecord& nameRec) {
+        if (nameRec.deleted() || nameRec.vtxPos.empty())
+            return true;
+        if (name < start || name.size() < prefix.size() || !std::equal(prefix.begin(), prefix.end(), name.begin()))
+            return true;
 
-        CNameRecord nameRec;
-        if (!dbName.ReadName(pairScan.first, nameRec))
-            continue;
+        // regexp
+        if (strRegexp != "" && !regex_search(stringFromNameVal(name), nameparts, cregex))
+            return true;
 
         // max age
         int nHeight = nameRec.vtxPos[nameRec.nLastActiveChainIndex].nHeight;
-        if(nMaxAge != 0 && chainActive.Height() - nHeight >= nMaxAge)
-            continue;
-
-        // from limits
-        nCountFrom++;
-        if(nCountFrom < nFrom + 1)
-            continue;
-
-        UniValue oName(UniValue::VOBJ);
-        if (!fStat) {
-            oName.push_back(Pair("name", name));
-            oName.push_back(Pair("value", limitString(encodeNameVal(txName.value, outputType), 300, "\n...(value too large - use name_show to see full value)")));
-            oName.push_back(Pair("registered_at", nHeight)); // pos = 2 in comparison function (above name_filter)
-            int nExpiresIn = nameRec.nExpiresAt - chainActive.Height();
-            oName.push_back(Pair("expires_in", nExpiresIn));
-            if (nExpiresIn <= 0)
-                oName.push_back(Pair("expired", true));
-        }
-        oRes.push_back(oName);
-
-        nCountNb++;
-        // nb limits
-        if(nNb > 0 && nCountNb >= nNb)
-            break;
-    }
+        if (nMaxAge != 0 && nTip - nHeight >= nMaxAge)
+            return true;
+
+        NameFilterMatch match;
+        match.name = name;
+        match.value = nameRec.vtxPos.back().value;
+        match.nHeight = nHeight;
+        match.nExpiresAt = nameRec.nExpiresAt;
+        vMatch.push_back(match);
+        return true;
+    };
 
-    UniValue oRes2(UniValue::VARR);
-    if (!fStat)
+    if (nMaxAge > 0)
     {
-        std::sort(oRes.begin(), oRes.end(), mycompare2); //sort by nHeight
-        for (unsigned int idx = 0; idx < oRes.size(); idx++) {
-            const UniValue& res = oRes[idx];
-            oRes2.push_back(res);
-        }
+        // only names registered in the last nMaxAge blocks
+        if (!pnameindex->ForEachNameFromHeight(nTip - nMaxAge + 1, filter))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "scan failed");
+        std::sort(vMatch.begin(), vMatch.end(), [](const NameFilterMatch& a, const NameFilterMatch& b) { return a.name < b.name; });
     }
     else
+    {
+        // stop at the end of the prefix range or once the requested page is complete
+        if (!pnameindex->ForEachName(std::max(prefix, start), [&](const CNameVal& name, const CNameRecord& nameRec) {
+                if (name.size() < prefix.size() || !std::equal(prefix.begin(), prefix.end(), name.begin()))
+                    return false;
+                filter(name, nameRec);
+                return nNb <= 0 || (int)vMatch.size() < nFrom + nNb;
+            }))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "scan failed");
+    }
+
+    // from and nb limits
+    if (nFrom > 0)
+        vMatch.erase(vMatch.begin(), vMatch.begin() + std::min((size_t)nFrom, vMatch.size()));
+    if (nNb > 0 && vMatch.size() > (size_t)nNb)
+        vMatch.resize(nNb);
+
+    if (fStat)
     {
         UniValue oStat(UniValue::VOBJ);
-        oStat.push_back(Pair("blocks",    chainActive.Height()));
-        oStat.push_back(Pair("count",     (int)oRes2.size()));
-        //oStat.push_back(Pair("sha256sum", SHA256(oRes), true));
+        oStat.push_back(Pair("blocks",    nTip));
+        oStat.push_back(Pair("count",     (int)vMatch.size()));
         return oStat;
     }
 
-    return oRes2;
+    //sort by nHeight
+    std::stable_sort(vMatch.begin(), vMatch.end(), [](const NameFilterMatch& a, const NameFilterMatch& b) { return a.nHeight < b.nHeight; });
+    UniValue oRes(UniValue::VARR);
+    for (const auto& match : vMatch)
+    {
+        UniValue oName(UniValue::VOBJ);
+        oName.push_back(Pair("name", stringFromNameVal(match.name)));
+        oName.push_back(Pair("value", limitString(encodeNameVal(match.value, outputType), 300, "\n...(value too large - use name_show to see full value)")));
+        oName.push_back(Pair("registered_at", match.nHeight));
+        int nExpiresIn = match.nExpiresAt - nTip;
+        oName.push_back(Pair("expires_in", nExpiresIn));
+        if (nExpiresIn <= 0)
+            oName.push_back(Pair("expired", true));
+        oRes.push_back(oName);
+    }
+    return oRes;
 }
 
 UniValue name_scan(const JSONRPCRequest& request)
@@ -848,13 +1177,12 @@ UniValue name_scan(const JSONRPCRequest& request)
     int nMaxShownValue = request.params.size() > 2 ? request.params[2].get_int() : 0;
     string outputType  = request.params.size() > 3 ? request.params[3].get_str() : "";
 
-    CNameDB dbName("r");
     UniValue oRes(UniValue::VARR);
 
     vector<pair<CNameVal, pair<CNameIndex,int> > > nameScan;
     {
         LOCK(cs_main);
-        if (!dbName.ScanNames(name, nMax, nameScan))
+        if (!pnameindex->ScanNames(name, nMax, nameScan))
             throw JSONRPCError(RPC_WALLET_ERROR, "scan failed");
     }
 
@@ -898,12 +1226,10 @@ UniValue name_scan_address(const JSONRPCRequest& request)
     string outputType  = request.params.size() > 3 ? request.params[3].get_str() : "";
 
     LOCK(cs_main);
-    CNameDB dbName("r");
-    CNameAddressDB dbNameAddress("r");
     UniValue oRes(UniValue::VARR);
 
     set<CNameVal> names;
-    if (dbNameAddress.ReadAddress(address, names))
+    if (!pnameindex->ReadAddress(address, names))
         throw JSONRPCError(RPC_WALLET_ERROR, "found nothing");
 
     for (const auto& name : names)
@@ -912,7 +1238,7 @@ UniValue name_scan_address(const JSONRPCRequest& request)
         oName.push_back(Pair("name", stringFromNameVal(name)));
 
         CNameRecord nameRec;
-        if (!dbName.ReadName(name, nameRec))
+        if (!pnameindex->ReadName(name, nameRec))
             throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read from name DB");
 
         int nExpiresAt    = nameRec.nExpiresAt;
@@ -1183,10 +1509,9 @@ NameTxReturn name_operation(const int op, const CNameVal& name, CNameVal value,
         CWalletTx wtxIn = CWalletTx();
         if (op == OP_NAME_UPDATE || op == OP_NAME_DELETE)
         {
-            CNameDB dbName("r");
             CTransactionRef prevTx;
             CNameRecord nameRec;
-            if (!GetLastTxOfName(dbName, name, prevTx, nameRec))
+            if (!GetLastTxOfName(name, prevTx, nameRec))
             {
                 ret.err_msg = "could not find tx with this name";
                 return ret;
@@ -1271,46 +1596,38 @@ NameTxReturn name_operation(const int op, const CNameVal& name, CNameVal value,
     return ret;
 }
 
-bool createNameIndexes()
+// Reads a block for the name index rebuild along with the fee of every name tx in it.
+// Fees come from the block's undo data, txindex is only used if that is not available.
+static bool ReadNameIndexBlock(const CBlockIndex* pindex, CBlock& block, vector<CAmount>& vFee)
 {
-    if (!fTxIndex)
-        return error("createNameIndexes() : transaction index not available");
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return error("createNameIndexes() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
 
-    LogPrintf("Scanning blockchain for names to create fast index...\n");
-    LOCK(cs_main);
-    CNameDB dbName("cr+");
-    CNameAddressDB dbNameAddress("cr+");
-    int maxHeight = chainActive.Height();
-    int reportDone = 0;
-    for (int nHeight=0; nHeight<=maxHeight; nHeight++)
+    vFee.assign(block.vtx.size(), 0);
+    CBlockUndo blockundo;
+    bool fUndoRead = false;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
     {
-        int percentageDone = (100*nHeight / maxHeight);
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone);
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Creating nameindex (do not close app!)..."), percentageDone);
-
-        CBlockIndex* pindex = chainActive[nHeight];
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
-            return error("createNameIndexes() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        const CTransactionRef& tx = block.vtx[i];
+        if (tx->nVersion != NAMECOIN_TX_VERSION || tx->IsCoinStake())
+            continue;
 
-        // collect name tx from block
-        vector<nameTempProxy> vName;
-        CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size())); // start position
-        for (unsigned int i=0; i<block.vtx.size(); i++)
+        if (!fUndoRead)
         {
-            const CTransactionRef& tx = block.vtx[i];
-            if (tx->IsCoinStake() || tx->IsCoinBase())
-            {
-                pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);  // set next tx position
-                continue;
-            }
+            fUndoRead = true;
+            if (!(pindex->nStatus & BLOCK_HAVE_UNDO) || !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+                blockundo.vtxundo.size() != block.vtx.size() - 1)
+                blockundo.vtxundo.clear();
+        }
 
-            // calculate tx fee
-            CAmount input = 0;
+        CAmount input = 0;
+        if (!blockundo.vtxundo.empty() && blockundo.vtxundo[i-1].vprevout.size() == tx->vin.size())
+        {
+            for (const auto& undo : blockundo.vtxundo[i-1].vprevout)
+                input += undo.out.nValue;
+        }
+        else
+        {
             for (const auto& txin : tx->vin)
             {
                 CTransactionRef txPrev;
@@ -1320,49 +1637,172 @@ bool createNameIndexes()
 
                 input += txPrev->vout[txin.prevout.n].nValue;
             }
-            CAmount fee = input - tx->GetValueOut();
+        }
+        vFee[i] = input - tx->GetValueOut();
+    }
+    return true;
+}
 
-            hooks->CheckInputs(tx, pindex, vName, pos, fee);                    // collect valid name tx to vName
-            pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);  // set next tx position
+namespace {
+
+// Reads the blocks of a name index rebuild on several threads, ahead of the
+// thread that applies them. Blocks are handed out in chain order.
+class CNameIndexReader
+{
+private:
+    struct Slot
+    {
+        size_t nPos; // position in vIndex of the block held, SIZE_MAX if none
+        bool fOk;
+        CBlock block;
+        vector<CAmount> vFee;
+
+        Slot() : nPos(SIZE_MAX), fOk(false) {}
+    };
+
+    const vector<CBlockIndex*>& vIndex;
+    vector<Slot> vSlots; // block at position n is kept in vSlots[n % vSlots.size()]
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t nNextRead;
+    size_t nNextGet;
+    bool fStop;
+    vector<std::thread> vThreads;
+
+    void ThreadRead()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cond.wait(lock, [this] { return fStop || nNextRead >= vIndex.size() || nNextRead < nNextGet + vSlots.size(); });
+            if (fStop || nNextRead >= vIndex.size())
+                return;
+            size_t nPos = nNextRead++;
+            lock.unlock();
+
+            CBlock block;
+            vector<CAmount> vFee;
+            bool fOk = ReadNameIndexBlock(vIndex[nPos], block, vFee);
+
+            lock.lock();
+            Slot& slot = vSlots[nPos % vSlots.size()];
+            slot.nPos = nPos;
+            slot.fOk = fOk;
+            slot.block = std::move(block);
+            slot.vFee = std::move(vFee);
+            cond.notify_all();
         }
+    }
 
-        // execute name operations, if any
-        if (!vName.empty())
-            hooks->ConnectBlock(pindex, vName);
+public:
+    CNameIndexReader(const vector<CBlockIndex*>& vIndexIn, int nThreads) :
+        vIndex(vIndexIn), vSlots(16 * nThreads), nNextRead(0), nNextGet(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            vThreads.emplace_back(&CNameIndexReader::ThreadRead, this);
     }
-    return true;
+
+    ~CNameIndexReader()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        for (auto& thread : vThreads)
+            thread.join();
+    }
+
+    // Returns the next block and the fees of its name txs
+    bool Get(CBlock& block, vector<CAmount>& vFee)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Slot& slot = vSlots[nNextGet % vSlots.size()];
+        cond.wait(lock, [&] { return slot.nPos == nNextGet; });
+        block = std::move(slot.block);
+        vFee = std::move(slot.vFee);
+        slot.nPos = SIZE_MAX;
+        nNextGet++;
+        cond.notify_all();
+        return slot.fOk;
+    }
+};
+
 }
 
-bool createNameAddressFile()
+// Replays name ops of the active chain into the name index. Continues from the
+// block the index was last flushed at if it is on the active chain, else the
+// index must be empty. Progress is flushed every NAMEINDEX_REBUILD_FLUSH blocks
+// and on shutdown request, so an interrupted rebuild resumes from there.
+bool createNameIndexes()
 {
-    LogPrintf("Scanning blockchain for names to create secondary (address->name) index...\n");
-    LOCK(cs_main);
-    CNameAddressDB dbNameAddress("cr+");
+    if (!fTxIndex)
+        return error("createNameIndexes() : transaction index not available");
 
-    CNameDB dbName("r");
-    vector<pair<CNameVal, pair<CNameIndex,int> > > nameScan;
+    // the index may have been wiped, drop lookups cached from its old contents
+    nameCache.Clear();
+
+    vector<CBlockIndex*> vIndex;
     {
-        if (!dbName.ScanNames(CNameVal(), 0, nameScan))
-            return error("createNameAddressFile() : scan failed");
+        LOCK(cs_main);
+        int nStart = 0;
+        BlockMap::iterator mi = mapBlockIndex.find(pnameindex->GetBestBlock());
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            nStart = mi->second->nHeight + 1;
+        for (int nHeight = nStart; nHeight <= chainActive.Height(); nHeight++)
+            vIndex.push_back(chainActive[nHeight]);
+        if (nStart > 0)
+            LogPrintf("Resuming name index creation at height %d\n", nStart);
     }
 
-    for (const auto& pair : nameScan)
+    LogPrintf("Scanning blockchain for names to create fast index...\n");
+    int nThreads = std::max(nScriptCheckThreads, 1);
+    CNameIndexReader reader(vIndex, nThreads);
+    int reportDone = 0;
+    for (size_t n = 0; n < vIndex.size(); n++)
     {
-        const CNameVal&   name  = pair.first;
-        const CDiskTxPos& txpos = pair.second.first.txPos;
+        CBlockIndex* pindex = vIndex[n];
+        int percentageDone = (100*(n+1) / vIndex.size());
+        if (reportDone < percentageDone/10) {
+            // report every 10% step
+            LogPrintf("[%d%%]...", percentageDone);
+            reportDone = percentageDone/10;
+        }
+        uiInterface.ShowProgress(_("Creating nameindex (do not close app!)..."), percentageDone);
 
-        CTransactionRef tx;
-        if (!GetTransaction(txpos, tx))
-            return error("createNameAddressFile() : could not read tx from disk - your blockchain or nameindex.dat are probably corrupt");
+        CBlock block;
+        vector<CAmount> vFee;
+        if (!reader.Get(block, vFee))
+            return false;
 
-        NameTxInfo nti;
-        if (!DecodeNameTx(tx, nti, true, false))
-            return error("createNameAddressFile() : failed to decode name - your blockchain or nameindex.dat are probably corrupt");
+        LOCK(cs_main);
 
-        if (nti.strAddress != "" && nti.op != OP_NAME_DELETE)
-            dbNameAddress.WriteSingleName(nti.strAddress, name);
+        // collect name tx from block
+        vector<nameTempProxy> vName;
+        CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size())); // start position
+        for (unsigned int i=0; i<block.vtx.size(); i++)
+        {
+            const CTransactionRef& tx = block.vtx[i];
+            if (!tx->IsCoinStake() && !tx->IsCoinBase())
+                hooks->CheckInputs(tx, pindex, vName, pos, vFee[i]);        // collect valid name tx to vName
+            pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);  // set next tx position
+        }
+
+        // execute name operations, if any
+        if (!vName.empty())
+            hooks->ConnectBlock(pindex, vName);
+
+        // checkpoint, the index only matches the chainstate after the final flush
+        bool fInterrupt = ShutdownRequested();
+        if ((fInterrupt || (n + 1) % NAMEINDEX_REBUILD_FLUSH == 0) && !pnameindex->Flush(pindex->GetBlockHash()))
+            return error("createNameIndexes() : failed to write name index");
+        if (fInterrupt)
+        {
+            LogPrintf("createNameIndexes() : interrupted at height %d\n", pindex->nHeight);
+            return false;
+        }
     }
-    return true;
+    return pnameindex->Flush(pcoinsTip->GetBestBlock());
 }
 
 // read name tx and extract: name, value and rentalDays
@@ -1417,10 +1857,18 @@ int IndexOfNameOutput(const CTransactionRef& tx)
     return nti.nOut;
 }
 
+// true if an output of tx is still unspent in the chainstate
+static bool IsTxInChainstate(const CTransactionRef& tx)
+{
+    for (unsigned int i = 0; i < tx->vout.size(); i++)
+        if (pcoinsTip->HaveCoin(COutPoint(tx->GetHash(), i)))
+            return true;
+    return false;
+}
+
 bool CNamecoinHooks::CheckPendingNames(const CTransactionRef& tx)
 {
-    CCoins coins;
-    if (pcoinsTip->GetCoins(tx->GetHash(), coins)) // try to ignore coins that are in blockchain
+    if (IsTxInChainstate(tx)) // try to ignore coins that are in blockchain
         return false;
 
     if (tx->vout.size() < 1)
@@ -1440,8 +1888,7 @@ bool CNamecoinHooks::CheckPendingNames(const CTransactionRef& tx)
 
 void CNamecoinHooks::AddToPendingNames(const CTransactionRef& tx)
 {
-    CCoins coins;
-    if (pcoinsTip->GetCoins(tx->GetHash(), coins)) // try to ignore coins that are in blockchain
+    if (IsTxInChainstate(tx)) // try to ignore coins that are in blockchain
         return;
 
     if (tx->vout.size() < 1)
@@ -1484,9 +1931,8 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
         sName % tx->GetHash().GetHex() % pindexBlock->nHeight % stringFromNameVal(nti.value));
 
 //check if last known tx on this name matches any of inputs of this tx
-    CNameDB dbName("r");
     CNameRecord nameRec;
-    if (dbName.ExistsName(name) && !dbName.ReadName(name, nameRec))
+    if (pnameindex->ExistsName(name) && !pnameindex->ReadName(name, nameRec))
         return error("CheckInputsHook() : failed to read from name DB for %s", info);
 
     bool found = false;
@@ -1498,7 +1944,7 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
             return error("CheckInputsHook() : failed to read from name DB for %s", info);
         uint256 lasthash = lastKnownNameTx->GetHash();
         if (!DecodeNameTx(lastKnownNameTx, prev_nti, true, false))
-            return error("CheckInputsHook() : Failed to decode existing previous name tx for %s. Your blockchain or nameindex.dat may be corrupt.", info);
+            return error("CheckInputsHook() : Failed to decode existing previous name tx for %s. Your blockchain or name index may be corrupt.", info);
 
         for (unsigned int i = 0; i < tx->vin.size(); i++) //this scans all scripts of tx.vin
         {
@@ -1521,7 +1967,7 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
                 return false;
             }
 
-            if (NameActive(dbName, name, pindexBlock->nHeight))
+            if (NameActive(name, pindexBlock->nHeight))
             {
                 if (pindexBlock->nHeight > RELEASE_HEIGHT)
                     return error("CheckInputsHook() : name_new on an unexpired name for %s", info);
@@ -1545,7 +1991,7 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
             if (prev_nti.name != name)
                 return error("CheckInputsHook() : name_update name mismatch for %s", info);
 
-            if (!NameActive(dbName, name, pindexBlock->nHeight))
+            if (!NameActive(name, pindexBlock->nHeight))
                 return error("CheckInputsHook() : name_update on an expired name for %s", info);
             break;
         }
@@ -1557,7 +2003,7 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
             if (prev_nti.name != name)
                 return error("CheckInputsHook() : name_delete name mismatch for %s", info);
 
-            if (!NameActive(dbName, name, pindexBlock->nHeight))
+            if (!NameActive(name, pindexBlock->nHeight))
                 return error("CheckInputsHook() : name_delete on expired name for %s", info);
             break;
         }
@@ -1565,11 +2011,12 @@ bool CNamecoinHooks::CheckInputs(const CTransactionRef& tx, const CBlockIndex* p
             return error("CheckInputsHook() : unknown name operation for %s", info);
     }
 
-    // all checks passed - record tx information to vName. It will be sorted by nTime and writen to nameindex.dat at the end of ConnectBlock
+    // all checks passed - record tx information to vName. It will be sorted by nTime and writen to name index at the end of ConnectBlock
     CNameIndex txPos2;
     txPos2.nHeight = pindexBlock->nHeight;
     txPos2.value = nti.value;
     txPos2.txPos = pos;
+    txPos2.nRentalDays = nti.nRentalDays;
 
     nameTempProxy tmp;
     tmp.nTime = tx->nTime;
@@ -1596,10 +2043,9 @@ bool CNamecoinHooks::DisconnectInputs(const CTransactionRef& tx)
         return false;
     }
 
-    CNameDB dbName("cr+");
 
     CNameRecord nameRec;
-    if (!dbName.ReadName(nti.name, nameRec))
+    if (!pnameindex->ReadName(nti.name, nameRec))
     {
         LogPrintf("DisconnectInputs() : failed to read from name DB, skipping...");
         return false;
@@ -1608,7 +2054,11 @@ bool CNamecoinHooks::DisconnectInputs(const CTransactionRef& tx)
     // vtxPos might be empty if we pruned expired transactions.  However, it should normally still not
     // be empty, since a reorg cannot go that far back.  Be safe anyway and do not try to pop if empty.
     if (nameRec.vtxPos.empty())
-        return dbName.EraseName(nti.name); // delete empty record
+    {
+        bool ret = pnameindex->EraseName(nti.name); // delete empty record
+        nameCache.Invalidate(nti.name);
+        return ret;
+    }
 
     CDiskTxPos postx;
     if (!pblocktree->ReadTxIndex(tx->GetHash(), postx))
@@ -1636,7 +2086,7 @@ bool CNamecoinHooks::DisconnectInputs(const CTransactionRef& tx)
     // remove tx
     nameRec.vtxPos.pop_back();
 
-    if (nameRec.vtxPos.size() == 0 && !dbName.EraseName(nti.name)) // delete empty record
+    if (nameRec.vtxPos.size() == 0 && !pnameindex->EraseName(nti.name)) // delete empty record
         return error("DisconnectInputs() : failed to erase from name DB");
     else
     {
@@ -1651,13 +2101,13 @@ bool CNamecoinHooks::DisconnectInputs(const CTransactionRef& tx)
 
         if (!CalculateExpiresAt(nameRec))
             return error("DisconnectInputs() : failed to calculate expiration time before writing to name DB");
-        if (!dbName.WriteName(nti.name, nameRec))
+        if (!pnameindex->WriteName(nti.name, nameRec))
             return error("DisconnectInputs() : failed to write to name DB");
     }
+    nameCache.Invalidate(nti.name);
 
     // update (address->name) index
     // delete name from old address and add it to new address
-    CNameAddressDB dbNameAddress("r+");
     string oldAddress = (nti.op != OP_NAME_DELETE) ? nti.strAddress : "";
     string newAddress = "";
     if (!nameRec.vtxPos.empty() && !nameRec.deleted())
@@ -1670,8 +2120,8 @@ bool CNamecoinHooks::DisconnectInputs(const CTransactionRef& tx)
             return error("DisconnectInputs() : failed to decode name tx");
         newAddress = prev_nti.strAddress;
     }
-    if (!dbNameAddress.MoveName(oldAddress, newAddress, nti.name))
-        return error("ConnectBlockHook(): failed to move name in nameaddress.dat");
+    if (!pnameindex->MoveName(oldAddress, newAddress, nti.name))
+        return error("ConnectBlockHook(): failed to move name in name address index");
 
     return true;
 }
@@ -1702,16 +2152,14 @@ bool CNamecoinHooks::ExtractAddress(const CScript& script, string& address)
     return true;
 }
 
-// Executes name operations in vName and writes result to nameindex.dat.
+// Executes name operations in vName and writes result to name index.
 // NOTE: the block should already be written to blockchain by now - otherwise this may fail.
 bool CNamecoinHooks::ConnectBlock(CBlockIndex* pindex, const vector<nameTempProxy> &vName)
 {
     if (vName.empty())
         return true;
 
-    // All of these name ops should succed. If there is an error - nameindex.dat is probably corrupt.
-    CNameDB dbName("r+");
-    CNameAddressDB dbNameAddress("r+");
+    // All of these name ops should succed. If there is an error - name index is probably corrupt.
     set<CNameVal> sNameNew;
 
     for (const auto& i : vName)
@@ -1729,7 +2177,7 @@ bool CNamecoinHooks::ConnectBlock(CBlockIndex* pindex, const vector<nameTempProx
         }
 
         CNameRecord nameRec;
-        if (dbName.ExistsName(i.name) && !dbName.ReadName(i.name, nameRec))
+        if (pnameindex->ExistsName(i.name) && !pnameindex->ReadName(i.name, nameRec))
             return error("ConnectBlockHook() : failed to read from name DB");
 
         // only first name_new for same name in same block will get written
@@ -1758,21 +2206,23 @@ bool CNamecoinHooks::ConnectBlock(CBlockIndex* pindex, const vector<nameTempProx
 
         // save name op
         nameRec.vtxPos.back().op = i.op;
+        SetOpExpiresAt(nameRec);
 
         if (!CalculateExpiresAt(nameRec))
             return error("ConnectBlockHook() : failed to calculate expiration time before writing to name DB for %s", i.hash.GetHex());
-        if (!dbName.WriteName(i.name, nameRec))
+        if (!pnameindex->WriteName(i.name, nameRec))
             return error("ConnectBlockHook() : failed to write to name DB");
+        nameCache.Invalidate(i.name);
         if (i.op == OP_NAME_NEW)
             sNameNew.insert(i.name);
-        LogPrintf("ConnectBlockHook(): writing %s %s in block %d to nameindexV2.dat\n", stringFromOp(i.op), stringFromNameVal(i.name), pindex->nHeight);
+        LogPrintf("ConnectBlockHook(): writing %s %s in block %d to name index\n", stringFromOp(i.op), stringFromNameVal(i.name), pindex->nHeight);
 
 
         // update (address->name) index
         // delete name from old address and add it to new address
         // note: addresses are set inside hooks->CheckInputs()
-        if (!dbNameAddress.MoveName(i.prev_address, i.address, i.name))
-            return error("ConnectBlockHook(): failed to move name in nameaddress.dat");
+        if (!pnameindex->MoveName(i.prev_address, i.address, i.name))
+            return error("ConnectBlockHook(): failed to move name in name address index");
     }
 
     return true;
@@ -1786,44 +2236,113 @@ bool CNamecoinHooks::IsNameScript(CScript scr)
 
 bool CNamecoinHooks::getNameValue(const string& sName, string& sValue)
 {
-    CNameVal name = nameValFromString(sName);
-    CNameDB dbName("r");
-    if (!dbName.ExistsName(name))
+    CNameCacheEntry entry;
+    if (!nameCache.Get(nameValFromString(sName), entry) || !entry.IsActive(chainActive.Height()))
         return false;
 
-    CTransactionRef tx;
-    NameTxInfo nti;
-    if (!(GetLastTxOfName(dbName, name, tx) && DecodeNameTx(tx, nti, true)))
-        return false;
+    sValue = stringFromNameVal(entry.value);
+    return true;
+}
 
-    if (!NameActive(dbName, name))
+bool GetNameValue(const CNameVal& name, CNameVal& value)
+{
+    CNameCacheEntry entry;
+    if (!nameCache.Get(name, entry) || !entry.IsActive(chainActive.Height()))
         return false;
 
-    sValue = stringFromNameVal(nti.value);
-
+    value = entry.value;
     return true;
 }
 
-bool GetNameValue(const CNameVal& name, CNameVal& value)
+std::atomic<uint64_t>& CNameCache::Generation(const CNameVal& name)
 {
-    CNameDB dbName("r");
+    CSipHasher hasher(0x6e616d6563616368ULL, 0x6567656e65726174ULL);
+    hasher.Write(name.data(), name.size());
+    return vGenerations[hasher.Finalize() % GENERATION_SLOTS];
+}
+
+bool CNameCache::Get(const CNameVal& name, CNameCacheEntry& entry)
+{
+    std::atomic<uint64_t>& nGeneration = Generation(name);
+    uint64_t nGenerationRead;
+    {
+        LOCK(cs);
+        map<CNameVal, list<Item>::iterator>::iterator mi = mapItems.find(name);
+        if (mi != mapItems.end())
+        {
+            lruItems.splice(lruItems.begin(), lruItems, mi->second);
+            entry = mi->second->entry;
+            return mi->second->fFound;
+        }
+        nGenerationRead = nGeneration;
+    }
+
+    // not cached: read the last name op from the name DB and its tx from disk
+    Item item;
+    item.name = name;
+    item.fFound = false;
     CNameRecord nameRec;
+    if (pnameindex->ReadName(name, nameRec) && !nameRec.vtxPos.empty())
+    {
+        CTransactionRef tx;
+        NameTxInfo nti;
+        if (!GetTransaction(nameRec.vtxPos.back().txPos, tx) || !DecodeNameTx(tx, nti, true, false))
+            return error("%s: failed to read last tx of %s", __func__, stringFromNameVal(name));
+
+        item.fFound = true;
+        item.entry.value = nti.value;
+        item.entry.strAddress = nti.strAddress;
+        item.entry.txid = tx->GetHash();
+        item.entry.nTime = tx->nTime;
+        item.entry.nExpiresAt = nameRec.nExpiresAt;
+        item.entry.fDeleted = nameRec.deleted();
+    }
+    item.nUsage = sizeof(Item) + 64 + name.size() + item.entry.value.size() + item.entry.strAddress.size();
+    entry = item.entry;
+
+    LOCK(cs);
+    if (nGenerationRead != nGeneration || mapItems.count(name))
+        return item.fFound; // a block changed the name meanwhile, or another lookup got here first
+
+    if (nMaxUsage == 0)
+        nMaxUsage = GetArg("-namecachesize", DEFAULT_NAME_CACHE_SIZE) << 20;
+    nUsage += item.nUsage;
+    lruItems.push_front(item);
+    mapItems[name] = lruItems.begin();
+    while (nUsage > nMaxUsage && lruItems.size() > 1)
+    {
+        nUsage -= lruItems.back().nUsage;
+        mapItems.erase(lruItems.back().name);
+        lruItems.pop_back();
+    }
+    return item.fFound;
+}
 
-    if (!NameActive(name))
-        return false;
-    if (!dbName.ReadName(name, nameRec))
-        return false;
-    if (nameRec.vtxPos.empty())
-        return false;
+void CNameCache::Invalidate(const CNameVal& name)
+{
+    LOCK(cs);
+    Generation(name)++;
+    map<CNameVal, list<Item>::iterator>::iterator mi = mapItems.find(name);
+    if (mi == mapItems.end())
+        return;
+    nUsage -= mi->second->nUsage;
+    lruItems.erase(mi->second);
+    mapItems.erase(mi);
+}
 
-    value = nameRec.vtxPos.back().value;
-    return true;
+void CNameCache::Clear()
+{
+    LOCK(cs);
+    for (size_t i = 0; i < GENERATION_SLOTS; i++)
+        vGenerations[i]++;
+    lruItems.clear();
+    mapItems.clear();
+    nUsage = 0;
 }
 
 bool CNamecoinHooks::DumpToTextFile()
 {
-    CNameDB dbName("r");
-    return dbName.DumpToTextFile();
+    return pnameindex->DumpToTextFile();
 }
 
 
@@ -1833,54 +2352,27 @@ bool CNameDB::DumpToTextFile()
     if (!myfile.is_open())
         return false;
 
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
-        return false;
+    bool ret = ForEachName(CNameVal(), [&](const CNameVal& name, const CNameRecord& val) {
+        if (val.vtxPos.empty())
+            return true;
 
-    CNameVal name;
-    bool fRange = true;
-    while (true)
-    {
-        // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fRange)
-            ssKey << make_pair(string("namei"), name);
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fRange);
-        fRange = false;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
-            return false;
-
-        // Unserialize
-        string strType;
-        ssKey >> strType;
-        if (strType == "namei")
+        myfile << "name =  " << stringFromNameVal(name) << "\n";
+        myfile << "nExpiresAt " << val.nExpiresAt << "\n";
+        myfile << "nLastActiveChainIndex " << val.nLastActiveChainIndex << "\n";
+        myfile << "vtxPos:\n";
+        for (unsigned int i = 0; i < val.vtxPos.size(); i++)
         {
-            CNameVal name2;
-            ssKey >> name2;
-            CNameRecord val;
-            ssValue >> val;
-            if (val.vtxPos.empty())
-                continue;
-
-            myfile << "name =  " << stringFromNameVal(name2) << "\n";
-            myfile << "nExpiresAt " << val.nExpiresAt << "\n";
-            myfile << "nLastActiveChainIndex " << val.nLastActiveChainIndex << "\n";
-            myfile << "vtxPos:\n";
-            for (unsigned int i = 0; i < val.vtxPos.size(); i++)
-            {
-                myfile << "    nHeight = " << val.vtxPos[i].nHeight << "\n";
-                myfile << "    op = " << val.vtxPos[i].op << "\n";
-                myfile << "    value = " << stringFromNameVal(val.vtxPos[i].value) << "\n";
-            }
-            myfile << "\n\n";
+            myfile << "    nHeight = " << val.vtxPos[i].nHeight << "\n";
+            myfile << "    op = " << val.vtxPos[i].op << "\n";
+            myfile << "    value = " << stringFromNameVal(val.vtxPos[i].value) << "\n";
+            myfile << "    nRentalDays = " << val.vtxPos[i].nRentalDays << "\n";
+            myfile << "    nExpiresAt = " << val.vtxPos[i].nExpiresAt << "\n";
         }
-    }
-    pcursor->close();
+        myfile << "\n\n";
+        return true;
+    });
     myfile.close();
-    return true;
+    return ret;
 }
 
 UniValue name_dump(const JSONRPCRequest& request)
@@ -1906,96 +2398,61 @@ struct NameIndexStats
 //! Calculate statistics about name index
 bool CNameDB::GetNameIndexStats(NameIndexStats &stats)
 {
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
-        return false;
-
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    CNameVal name;
-    bool fRange = true;
-    while (true)
-    {
-        // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fRange)
-            ssKey << make_pair(string("namei"), name);
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fRange);
-        fRange = false;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
-            return false;
-
-        // Unserialize
-        string strType;
-        ssKey >> strType;
-        if (strType == "namei")
+    bool ret = ForEachName(CNameVal(), [&](const CNameVal& name, const CNameRecord& val) {
+        ss << name;
+        ss << val.nExpiresAt;
+        ss << val.nLastActiveChainIndex;
+        for (unsigned int i = 0; i < val.vtxPos.size(); i++)
         {
-            CNameVal name2;
-            CNameRecord val;
-            ssKey >> name2;
-            ssValue >> val;
-            ss << name2;
-            ss << val.nExpiresAt;
-            ss << val.nLastActiveChainIndex;
-            for (unsigned int i = 0; i < val.vtxPos.size(); i++)
-            {
-                ss << val.vtxPos[i].nHeight;
-                ss << val.vtxPos[i].op;
-                ss << val.vtxPos[i].value;
-            }
-            stats.nRecordsName += 1;
-            stats.nSerializedSizeName += ::GetSerializeSize(name2, SER_NETWORK, PROTOCOL_VERSION);
-            stats.nSerializedSizeName += ::GetSerializeSize(val, SER_NETWORK, PROTOCOL_VERSION);
+            ss << val.vtxPos[i].nHeight;
+            ss << val.vtxPos[i].op;
+            ss << val.vtxPos[i].value;
         }
-    }
-    pcursor->close();
+        stats.nRecordsName += 1;
+        stats.nSerializedSizeName += ::GetSerializeSize(name, SER_NETWORK, PROTOCOL_VERSION);
+        stats.nSerializedSizeName += ::GetSerializeSize(val, SER_NETWORK, PROTOCOL_VERSION);
+        return true;
+    });
     stats.hashSerializedName = ss.GetHash();
-    return true;
+    return ret;
 }
 
 //! Calculate statistics about name index
-bool CNameAddressDB::GetNameAddressIndexStats(NameIndexStats &stats)
+bool CNameDB::GetNameAddressIndexStats(NameIndexStats &stats)
 {
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
-        return false;
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    std::string address;
-    bool fRange = true;
-    while (true)
-    {
-        // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fRange)
-            ssKey << make_pair(string("addressi"), address);
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fRange);
-        fRange = false;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
-            return false;
-
-        // Unserialize
-        string strType;
-        ssKey >> strType;
-        if (strType == "addressi")
+    // entries on disk are ordered by serialized address, collect them first to merge with unwritten ones
+    set<pair<string, CNameVal> > setAddresses;
+    {
+        LOCK(cs);
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(DB_NAME_ADDRESS);
+        while (pcursor->Valid())
         {
-            std::string address2;
-            CNameVal name;
-            ssKey >> address2;
-            ssValue >> name;
-            ss << address2;
-            ss << name;
-            stats.nRecordsAddress += 1;
-            stats.nSerializedSizeAddress += ::GetSerializeSize(address2, SER_NETWORK, PROTOCOL_VERSION);
-            stats.nSerializedSizeAddress += ::GetSerializeSize(name, SER_NETWORK, PROTOCOL_VERSION);
+            NameAddressKey key;
+            if (!pcursor->GetKey(key) || key.key != DB_NAME_ADDRESS)
+                break;
+            setAddresses.insert(make_pair(key.address, key.name));
+            pcursor->Next();
         }
+        for (const auto& entry : mapAddresses)
+        {
+            if (entry.second)
+                setAddresses.insert(entry.first);
+            else
+                setAddresses.erase(entry.first);
+        }
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    for (const auto& entry : setAddresses)
+    {
+        ss << entry.first;
+        ss << entry.second;
+        stats.nRecordsAddress += 1;
+        stats.nSerializedSizeAddress += ::GetSerializeSize(entry.first, SER_NETWORK, PROTOCOL_VERSION);
+        stats.nSerializedSizeAddress += ::GetSerializeSize(entry.second, SER_NETWORK, PROTOCOL_VERSION);
     }
-    pcursor->close();
     stats.hashSerializedAddress = ss.GetHash();
     return true;
 }
@@ -2016,7 +2473,7 @@ UniValue name_indexinfo(const JSONRPCRequest& request)
             "  \"records_name\": n,  (numeric) number of names in main index\n"
             "  \"bytes_name\": n,  (numeric) The serialized size of main index\n"
             "  \"hash_name\": \"hash\",   (string) The serialized hash of main index\n"
-            "  \"records_address\": n,  (numeric) number of addresses in address index\n"
+            "  \"records_address\": n,  (numeric) number of (address, name) pairs in address index\n"
             "  \"bytes_address\": n,  (numeric) The serialized size of address index\n"
             "  \"hash_address\": \"hash\",   (string) The serialized hash of address index\n"
             "}\n"
@@ -2041,18 +2498,16 @@ UniValue name_indexinfo(const JSONRPCRequest& request)
     ret.push_back(Pair("bestblock", chainActive.Tip()->GetBlockHash().ToString()));
 
     NameIndexStats stats;
-    CNameDB dbName("r");
     if (fShowName) {
-        if (dbName.GetNameIndexStats(stats)) {
+        if (pnameindex->GetNameIndexStats(stats)) {
             ret.push_back(Pair("records_name", stats.nRecordsName));
             ret.push_back(Pair("bytes_name", stats.nSerializedSizeName));
             ret.push_back(Pair("hash_name", stats.hashSerializedName.GetHex()));
         } else
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read main name index");
     }
-    CNameAddressDB dbNameAddress("r");
     if (fShowAddress) {
-        if (dbNameAddress.GetNameAddressIndexStats(stats)) {
+        if (pnameindex->GetNameAddressIndexStats(stats)) {
             ret.push_back(Pair("records_address", stats.nRecordsAddress));
             ret.push_back(Pair("bytes_address", stats.nSerializedSizeAddress));
             ret.push_back(Pair("hash_address", stats.hashSerializedAddress.GetHex()));
@@ -3,16 +3,26 @@
 
 #include "hooks.h"
 #include "rpc/protocol.h"
-#include "wallet/db.h"
 #include "txdb.h"
 #include "script/interpreter.h"
+#include "sync.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
 
 class CBitcoinAddress;
 class CKeyStore;
 struct NameIndexStats;
 
 static const unsigned int NAMEINDEX_CHAIN_SIZE = 1000;
+static const int NAMEINDEX_REBUILD_FLUSH = 10000; // blocks between checkpoints of a name index rebuild
 static const int RELEASE_HEIGHT = 1<<16;
+static const unsigned int DEFAULT_NAME_CACHE_SIZE = 32; // MiB
+//! Max memory allocated to name index DB specific cache (MiB)
+static const int64_t nMaxNameDBCache = 8;
+
+static const int NAMEINDEX_VERSION = 1; // bump on record format changes, the index is then rebuilt
 
 class CNameIndex
 {
@@ -21,11 +31,13 @@ public:
     int nHeight;
     int op;
     CNameVal value;
+    int nRentalDays;
+    int nExpiresAt;   // expiration height of the name after this op, summed over its chain of name_new -> name_update -> ...
 
-    CNameIndex() : nHeight(0), op(0) {}
+    CNameIndex() : nHeight(0), op(0), nRentalDays(0), nExpiresAt(0) {}
 
     CNameIndex(CDiskTxPos txPos, int nHeight, CNameVal value) :
-        txPos(txPos), nHeight(nHeight), value(value) {}
+        txPos(txPos), nHeight(nHeight), value(value), nRentalDays(0), nExpiresAt(0) {}
 
     ADD_SERIALIZE_METHODS;
 
@@ -35,10 +47,12 @@ public:
         READWRITE(nHeight);
         READWRITE(op);
         READWRITE(value);
+        READWRITE(nRentalDays);
+        READWRITE(nExpiresAt);
     }
 };
 
-// CNameRecord is all the data that is saved (in nameindex.dat) with associated name
+// CNameRecord is all the data that is saved (in the name index) with associated name
 class CNameRecord
 {
 public:
@@ -47,7 +61,7 @@ public:
     int nLastActiveChainIndex;  // position in vtxPos of first tx in last active chain of name_new -> name_update -> name_update -> ....
 
     CNameRecord() : nExpiresAt(0), nLastActiveChainIndex(0) {}
-    bool deleted()
+    bool deleted() const
     {
         if (!vtxPos.empty())
             return vtxPos.back().op == OP_NAME_DELETE;
@@ -64,27 +78,36 @@ public:
     }
 };
 
-class CNameDB : public CDB
+// mfcoin: name index (nameindex/ directory), kept in step with the chainstate.
+// Name ops of connected and disconnected blocks are buffered in memory and
+// written in a single batch together with the best block hash whenever the
+// chainstate is flushed. If that hash does not match the chainstate on start
+// the index is rebuilt from the block files.
+class CNameDB : public CDBWrapper
 {
-public:
-    CNameDB(const char* pszMode="r+") : CDB("nameindex/nameindexV2.dat", pszMode) {}
+private:
+    CCriticalSection cs;
+    // changes not yet written to disk; false - the entry was erased
+    std::map<CNameVal, std::pair<bool, CNameRecord> > mapNames;
+    std::map<std::pair<std::string, CNameVal>, bool> mapAddresses;
+    std::map<std::pair<int, CNameVal>, bool> mapHeights;
 
-    bool WriteName(const CNameVal& name, const CNameRecord& rec)
-    {
-        return Write(make_pair(std::string("namei"), name), rec);
-    }
+    CNameDB(const CNameDB&);
+    void operator=(const CNameDB&);
 
-    bool ReadName(const CNameVal& name, CNameRecord& rec);
+public:
+    CNameDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool ExistsName(const CNameVal& name)
-    {
-        return Exists(make_pair(std::string("namei"), name));
-    }
+    bool WriteName(const CNameVal& name, const CNameRecord& rec);
+    bool ReadName(const CNameVal& name, CNameRecord& rec);
+    bool ExistsName(const CNameVal& name);
+    bool EraseName(const CNameVal& name);
 
-    bool EraseName(const CNameVal& name)
-    {
-        return Erase(make_pair(std::string("namei"), name));
-    }
+    // Calls f for every name starting from name, in lexicographic order, until f returns false.
+    // f sees the index as of the start of the scan and runs without cs held.
+    bool ForEachName(const CNameVal& name, const std::function<bool(const CNameVal&, const CNameRecord&)>& f);
+    // Same for active names whose current chain of ops started at nHeight or later, in order of that height
+    bool ForEachNameFromHeight(int nHeight, const std::function<bool(const CNameVal&, const CNameRecord&)>& f);
 
     bool ScanNames(const CNameVal& name, unsigned int nMax,
             std::vector<
@@ -93,72 +116,92 @@ public:
                     std::pair<CNameIndex, int>
                 >
             > &nameScan);
+
+    // secondary index of (address, name) pairs
+    // names listed here maybe expired
+    // names that have OP_NAME_DELETE as their last operation are not listed here
+    bool ReadAddress(const std::string& address, std::set<CNameVal>& names);
+
+    // removes name from old address and adds it to new address
+    bool MoveName(const std::string& oldAddress, const std::string& newAddress, const CNameVal& name);
+
+    // Writes buffered changes and marks the index as matching chainstate at hashBlock
+    bool Flush(const uint256& hashBlock);
+    uint256 GetBestBlock();
+    // NAMEINDEX_VERSION the index was written with, 0 if none
+    int GetVersion();
+    // Forces a rebuild of the index on next start
+    void SetCorrupt();
+
     bool DumpToTextFile();
     bool GetNameIndexStats(NameIndexStats &stats);
+    bool GetNameAddressIndexStats(NameIndexStats &stats);
 };
 
+extern CNameDB *pnameindex;
 
-// secondary index for (address -> name) pairs
-// names listed here maybe expired
-// names that have OP_NAME_DELETE as their last operation are not listed here
-class CNameAddressDB : public CDB
+// last operation on a name, as served by CNameCache
+struct CNameCacheEntry
 {
-public:
-    CNameAddressDB(const char* pszMode="r+") : CDB("nameindex/nameaddress.dat", pszMode) {}
-
-    bool WriteAddress(const std::string& address, const std::set<CNameVal>& names)
-    {
-        return Write(make_pair(std::string("addressi"), address), names);
-    }
+    CNameVal value;
+    std::string strAddress;
+    uint256 txid;
+    int64_t nTime;
+    int nExpiresAt;
+    bool fDeleted;
 
-    bool ReadAddress(const std::string& address, std::set<CNameVal>& names)
-    {
-        return Read(make_pair(std::string("addressi"), address), names);
-    }
+    CNameCacheEntry() : nTime(0), nExpiresAt(0), fDeleted(false) {}
 
-    bool ExistsAddress(const std::string& address)
-    {
-        return Exists(make_pair(std::string("addressi"), address));
-    }
+    // same as NameActive()
+    bool IsActive(int nHeight) const { return !fDeleted && nHeight <= nExpiresAt; }
+};
 
-    bool EraseAddress(const std::string& address)
+// mfcoin: resident copy of the last operation of recently used names, so that
+// name_show, GetNameValue() and the DNS gateway answer without reading the
+// name index and the name tx from the block files. Names that do not exist
+// are cached too. The name hooks drop a name after writing it to the
+// name DB; a lookup that raced with such a write is not cached.
+class CNameCache
+{
+private:
+    struct Item
     {
-        return Erase(make_pair(std::string("addressi"), address));
-    }
+        CNameVal name;
+        bool fFound;
+        CNameCacheEntry entry;
+        size_t nUsage;
+    };
+
+    CCriticalSection cs;
+    std::list<Item> lruItems; // most recently used first
+    std::map<CNameVal, std::list<Item>::iterator> mapItems;
+    size_t nUsage;
+    size_t nMaxUsage;
+    // change counters of names, by hash; names sharing a slot change together
+    static const size_t GENERATION_SLOTS = 4096;
+    std::atomic<uint64_t> vGenerations[GENERATION_SLOTS];
+
+    std::atomic<uint64_t>& Generation(const CNameVal& name);
 
-    // this will fail if you try to add a name that already exist
-    bool WriteSingleName(const std::string& address, const CNameVal& name)
+public:
+    CNameCache() : nUsage(0), nMaxUsage(0)
     {
-        std::set<CNameVal> names;
-        ReadAddress(address, names); // note: address will not exist if this is the first time we are writting it
-        return names.insert(name).second && Write(make_pair(std::string("addressi"), address), names);
+        for (size_t i = 0; i < GENERATION_SLOTS; i++)
+            vGenerations[i] = 0;
     }
 
-    // this will fail if you try to erase a name that does not exist
-    bool EraseSingleName(const std::string& address, const CNameVal& name)
-    {
-        std::set<CNameVal> names;
-        if (ReadAddress(address, names)) // note: address should always exist, because we are trying to erase name from existing record
-            return names.erase(name) && Write(make_pair(std::string("addressi"), address), names);
-        return false;
-    }
+    // Returns false if the name has no record in the name DB
+    bool Get(const CNameVal& name, CNameCacheEntry& entry);
+    void Invalidate(const CNameVal& name);
+    void Clear();
 
-    // removes name from old address and adds it to new address
-    bool MoveName(const std::string& oldAddress, const std::string& newAddress, const CNameVal& name)
-    {
-        if (newAddress == oldAddress) // nothing to do
-            return true;
-
-        bool ret = true;
-        if (oldAddress != "")
-            ret = ret && EraseSingleName(oldAddress, name);
-        if (newAddress != "")
-            ret = ret && WriteSingleName(newAddress, name);
-        return ret;
-    }
-    bool GetNameAddressIndexStats(NameIndexStats &stats);
+    // Changes whenever the name may have changed; lets callers keep own derived
+    // caches. Read it before Get() to depend on what Get() returns.
+    uint64_t GetGeneration(const CNameVal& name) { return Generation(name); }
 };
 
+extern CNameCache nameCache;
+
 extern std::map<CNameVal, std::set<uint256> > mapNamePending;
 
 int IndexOfNameOutput(const CTransactionRef &tx);
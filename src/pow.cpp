@@ -10,6 +10,7 @@
 #include "bignum.h"
 #include "chain.h"
 #include "consensus/merkle.h"
+#include "mtpcache.h"
 #include "primitives/block.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -70,6 +71,10 @@ bool CheckMerkleTreeProof(const CBlockHeader &block, const Consensus::Params &pa
    if (block.mtpHashValue == uint256())
        return error("CheckMerkleTreeProof: mtpHashValue is zero");
 
+   uint256 cacheEntry;
+   if (MTPCacheLookup(block, cacheEntry))
+      return true;
+
    uint256 calculatedMtpHashValue;
    bool isVerified = mtp::verify(block.nNonce, block, params.powLimit, &calculatedMtpHashValue) &&
                      block.mtpHashValue == calculatedMtpHashValue;
@@ -77,6 +82,7 @@ bool CheckMerkleTreeProof(const CBlockHeader &block, const Consensus::Params &pa
    if(!isVerified)
       return error("CheckMerkleTreeProof: mtp verification failure");;
 
+   MTPCacheInsert(cacheEntry);
    return true;
 }
 
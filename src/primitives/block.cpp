@@ -28,11 +28,12 @@ std::string CMTPHashData::toString()
         ss << "},";
     }
     ss << "}\n\n{";
-    for (const auto& arr : nProofMTP) {
+    for (int i = 0; i < mtp::ProofSet::COUNT; i++) {
         ss << "{";
-        for (const auto &row : arr) {
+        const uint8_t *row = nProofMTP.data(i);
+        for (size_t j = 0; j < nProofMTP.size(i); j++, row += mtp::MTP_PROOF_NODE_SIZE) {
             ss << "{";
-            std::copy(begin(row), end(row), std::ostream_iterator<unsigned>(ss, ","));
+            std::copy(row, row + mtp::MTP_PROOF_NODE_SIZE, std::ostream_iterator<unsigned>(ss, ","));
             ss << "},";
         }
         ss << "},";
@@ -45,7 +45,7 @@ class CMTPHashData {
 public:
    uint8_t hashRootMTP[16]; // 16 is 128 bit of blake2b
    uint64_t nBlockMTP[mtp::MTP_L*2][128]; // 128 is ARGON2_QWORDS_IN_BLOCK
-   std::deque<std::vector<uint8_t>> nProofMTP[mtp::MTP_L*3];
+   mtp::ProofSet nProofMTP; // mtp::MTP_L*3 proofs in one contiguous arena
 
    CMTPHashData() {
       memset(nBlockMTP, 0, sizeof(nBlockMTP));
@@ -62,15 +62,12 @@ public:
    inline void SerializationOp(Stream &s, Operation ser_action) {
       READWRITE(hashRootMTP);
       READWRITE(nBlockMTP);
-      for (int i = 0; i < mtp::MTP_L*3; i++) {
-         assert(nProofMTP[i].size() < 256);
-         uint8_t numberOfProofBlocks = (uint8_t)nProofMTP[i].size();
+      for (int i = 0; i < mtp::ProofSet::COUNT; i++) {
+         assert(nProofMTP.size(i) < 256);
+         uint8_t numberOfProofBlocks = (uint8_t)nProofMTP.size(i);
          READWRITE(numberOfProofBlocks);
-         for (const std::vector<uint8_t> &mtpData: nProofMTP[i]) {
-            // data size should be 16 for each block
-            assert(mtpData.size() == 16);
-            s.write((const char *)mtpData.data(), 16);
-         }
+         // nodes of one proof are contiguous, 16 bytes each
+         s.write((const char *)nProofMTP.data(i), numberOfProofBlocks * mtp::MTP_PROOF_NODE_SIZE);
       }
    }
 
@@ -79,14 +76,12 @@ public:
    inline void SerializationOp(Stream &s, CSerActionUnserialize ser_action) {
       READWRITE(hashRootMTP);
       READWRITE(nBlockMTP);
-      for (int i = 0; i < mtp::MTP_L*3; i++) {
+      nProofMTP.clear();
+      for (int i = 0; i < mtp::ProofSet::COUNT; i++) {
          uint8_t numberOfProofBlocks;
          READWRITE(numberOfProofBlocks);
-         for (uint8_t j=0; j<numberOfProofBlocks; j++) {
-            std::vector<uint8_t> mtpData(16, 0);
-            s.read((char *)mtpData.data(), 16);
-            nProofMTP[i].emplace_back(std::move(mtpData));
-         }
+         uint8_t *mtpData = nProofMTP.append(i, numberOfProofBlocks);
+         s.read((char *)mtpData, numberOfProofBlocks * mtp::MTP_PROOF_NODE_SIZE);
       }
    }
 
@@ -169,7 +164,7 @@ public:
                 auxpow.reset();
         }
 
-        if (!(nFlags & BLOCK_PROOF_OF_STAKE) && mtpHashValue != uint256()) {
+        if (!(nFlags & BLOCK_PROOF_OF_STAKE) && mtpHashValue != uint256() && !(s.GetType() & SER_NOMTP)) {
             //READWRITE(mtpHashData);
             if (ser_action.ForRead()) {
                 mtpHashData = std::make_shared<CMTPHashData>();
@@ -13,6 +13,8 @@
 
 
 #include <util.h>
+#include <pow.h>
+#include <timedata.h>
 #include <wallet/wallet.h>
 #include <validation.h>
 
@@ -21,6 +23,8 @@
 #include <QColor>
 #include <QTimer>
 
+#include <algorithm>
+
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
         Qt::AlignLeft|Qt::AlignVCenter,
@@ -64,7 +68,7 @@ public:
      * As it is in the same order as the CWallet, by definition
      * this is sorted by sha256.
      */
-    QList<KernelRecord> cachedWallet;
+    std::vector<KernelRecord> cachedWallet;
 
     /* Query entire wallet anew from core.
      */
@@ -77,15 +81,22 @@ public:
             LOCK2(cs_main, wallet->cs_wallet);
             for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
             {
-                std::vector<KernelRecord> txList = KernelRecord::decomposeOutput(wallet, it->second);
-                if(KernelRecord::showTransaction(it->second))
-                    for(const KernelRecord& kr : txList) {
-                        if(!kr.spent) {
-                            cachedWallet.append(kr);
-                        }
-                    }
+                std::vector<KernelRecord> txList = decomposeUnspent(it->second);
+                cachedWallet.insert(cachedWallet.end(), txList.begin(), txList.end());
             }
         }
+        cachedWallet.shrink_to_fit();
+    }
+
+    /* Unspent outputs of a wallet transaction, the only ones shown in the table.
+     */
+    std::vector<KernelRecord> decomposeUnspent(const CWalletTx &wtx)
+    {
+        std::vector<KernelRecord> parts = KernelRecord::decomposeOutput(wallet, wtx);
+        parts.erase(std::remove_if(parts.begin(), parts.end(),
+                                   [](const KernelRecord &rec) { return rec.spent; }),
+                    parts.end());
+        return parts;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -104,9 +115,9 @@ public:
             bool inWallet = mi != wallet->mapWallet.end();
 
             // Find bounds of this transaction in model
-            QList<KernelRecord>::iterator lower = qLowerBound(
+            std::vector<KernelRecord>::iterator lower = std::lower_bound(
                 cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
-            QList<KernelRecord>::iterator upper = qUpperBound(
+            std::vector<KernelRecord>::iterator upper = std::upper_bound(
                 cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
             int lowerIndex = (lower - cachedWallet.begin());
             int upperIndex = (upper - cachedWallet.begin());
@@ -142,20 +153,11 @@ public:
                 if(showTransaction)
                 {
                     // Added -- insert at the right position
-                    std::vector<KernelRecord> toInsert =
-                            KernelRecord::decomposeOutput(wallet, mi->second);
+                    std::vector<KernelRecord> toInsert = decomposeUnspent(mi->second);
                     if(toInsert.size() != 0) /* only if something to insert */
                     {
                         parent->beginInsertRows(QModelIndex(), lowerIndex, lowerIndex+toInsert.size()-1);
-                        int insert_idx = lowerIndex;
-                        for (const KernelRecord &rec : toInsert)
-                        {
-                            if(!rec.spent)
-                            {
-                                cachedWallet.insert(insert_idx, rec);
-                                insert_idx += 1;
-                            }
-                        }
+                        cachedWallet.insert(lower, toInsert.begin(), toInsert.end());
                         parent->endInsertRows();
                     }
                 }
@@ -173,27 +175,15 @@ public:
                 break;
             case CT_UPDATED:
                 // Updated -- remove spent coins from table
-                std::vector<KernelRecord> toCheck = KernelRecord::decomposeOutput(wallet, mi->second);
-                if(!toCheck.empty())
+                if(!inWallet)
+                    break;
+                for(int i = upperIndex - 1; i >= lowerIndex; i--)
                 {
-                    for(const KernelRecord &rec : toCheck)
+                    if(wallet->IsSpent(hash, cachedWallet[i].idx))
                     {
-                        if(rec.spent)
-                        {
-                            for(int i = lowerIndex; i < upperIndex; i++)
-                            {
-                                KernelRecord cachedRec = cachedWallet.at(i);
-                                if((rec.address == cachedRec.address)
-                                   && (rec.nValue == cachedRec.nValue)
-                                   && (rec.idx == cachedRec.idx))
-                                {
-                                    parent->beginRemoveRows(QModelIndex(), i, i);
-                                    cachedWallet.removeAt(i);
-                                    parent->endRemoveRows();
-                                    break;
-                                }
-                            }
-                        }
+                        parent->beginRemoveRows(QModelIndex(), i, i);
+                        cachedWallet.erase(cachedWallet.begin() + i);
+                        parent->endRemoveRows();
                     }
                 }
                 break;
@@ -208,7 +198,7 @@ public:
 
     KernelRecord *index(int idx)
     {
-        if(idx >= 0 && idx < cachedWallet.size())
+        if(idx >= 0 && idx < (int)cachedWallet.size())
         {
             KernelRecord *rec = &cachedWallet[idx];
             return rec;
@@ -265,7 +255,9 @@ MintingTableModel::MintingTableModel(CWallet* wallet, WalletModel *parent) :
         walletModel(parent),
         mintingInterval(60*24),
         priv(new MintingTablePriv(wallet, this)),
-        cachedNumBlocks(0)
+        cachedNumBlocks(-1),
+        cachedDifficulty(0),
+        nLastAgeUpdate(GetAdjustedTime())
 {
 	for(int i = 0; i<ColCount; ++i)
 		columns << QString();
@@ -277,6 +269,7 @@ MintingTableModel::MintingTableModel(CWallet* wallet, WalletModel *parent) :
 	columns[MintProbability] = tr("MintProbability");
 
     priv->refreshWallet();
+    updateDifficulty();
 
     QTimer *timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), this, SLOT(updateAge()));
@@ -298,14 +291,35 @@ void MintingTableModel::updateTransaction(const QString &hash, int status)
     updated.SetHex(hash.toStdString());
 
     priv->updateWallet(updated, status);
-    mintingProxyModel->invalidate(); // Force deletion of empty rows
+}
+
+void MintingTableModel::updateDifficulty()
+{
+    // Don't stall the GUI while the core holds cs_main, retry on the next tick
+    TRY_LOCK(cs_main, lockMain);
+    if(!lockMain || chainActive.Height() == cachedNumBlocks)
+        return;
+    cachedNumBlocks = chainActive.Height();
+
+    double difficulty = GetDifficulty(GetLastBlockIndex(chainActive.Tip(), true));
+    if(difficulty != cachedDifficulty)
+    {
+        cachedDifficulty = difficulty;
+        if(priv->size() > 0)
+            Q_EMIT dataChanged(index(0, MintProbability), index(priv->size()-1, MintProbability));
+    }
 }
 
 void MintingTableModel::updateAge()
 {
+    // Probabilities only move with the difficulty, ages only in whole days
+    updateDifficulty();
+
+    int64_t nNow = GetAdjustedTime();
+    if(nNow - nLastAgeUpdate < 60 || priv->size() == 0)
+        return;
+    nLastAgeUpdate = nNow;
     Q_EMIT dataChanged(index(0, Age), index(priv->size()-1, Age));
-    Q_EMIT dataChanged(index(0, CoinDay), index(priv->size()-1, CoinDay));
-    Q_EMIT dataChanged(index(0, MintProbability), index(priv->size()-1, MintProbability));
 }
 
 void MintingTableModel::setMintingProxyModel(MintingFilterProxy *mintingProxy)
@@ -330,7 +344,9 @@ QVariant MintingTableModel::data(const QModelIndex &index, int role) const
     const Consensus::Params& params = Params().GetConsensus();
     if(!index.isValid())
         return QVariant();
-    KernelRecord *rec = static_cast<KernelRecord*>(index.internalPointer());
+    KernelRecord *rec = priv->index(index.row());
+    if(!rec)
+        return QVariant();
 
     switch(role)
     {
@@ -417,7 +433,11 @@ QVariant MintingTableModel::data(const QModelIndex &index, int role) const
 
 void MintingTableModel::setMintingInterval(int interval)
 {
+    if(interval == mintingInterval)
+        return;
     mintingInterval = interval;
+    if(priv->size() > 0)
+        Q_EMIT dataChanged(index(0, MintProbability), index(priv->size()-1, MintProbability));
 }
 
 QString MintingTableModel::lookupAddress(const std::string &address, bool tooltip) const
@@ -437,10 +457,11 @@ QString MintingTableModel::lookupAddress(const std::string &address, bool toolti
 
 double MintingTableModel::getDayToMint(KernelRecord *wtx) const
 {
-    const CBlockIndex *p = GetLastBlockIndex(chainActive.Tip(), true);
-    double difficulty = GetDifficulty(p);
+    if(cachedDifficulty <= 0)
+        return 0;
 
-    double prob = wtx->getProbToMintWithinNMinutes(difficulty, mintingInterval);
+    // Computed on first display and kept in the record until the difficulty or interval changes
+    double prob = wtx->getProbToMintWithinNMinutes(cachedDifficulty, mintingInterval);
     prob = prob * 100;
     return prob;
 }
@@ -516,7 +537,8 @@ QModelIndex MintingTableModel::index(int row, int column, const QModelIndex &par
     KernelRecord *data = priv->index(row);
     if(data)
     {
-        return createIndex(row, column, priv->index(row));
+        // Rows are looked up by number, records move when the vector grows
+        return createIndex(row, column);
     }
     else
     {
@@ -527,5 +549,6 @@ QModelIndex MintingTableModel::index(int row, int column, const QModelIndex &par
 void MintingTableModel::updateDisplayUnit()
 {
     // emit dataChanged to update Balance column with the current unit
-    Q_EMIT dataChanged(index(0, Balance), index(priv->size()-1, Balance));
+    if(priv->size() > 0)
+        Q_EMIT dataChanged(index(0, Balance), index(priv->size()-1, Balance));
 }
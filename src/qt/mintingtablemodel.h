@@ -48,6 +48,12 @@ private:
     MintingTablePriv *priv;
     MintingFilterProxy *mintingProxyModel;
     int cachedNumBlocks;
+    /** PoS difficulty at the tip, refreshed once per new block rather than per painted cell */
+    double cachedDifficulty;
+    /** Time of the last Age column refresh */
+    qint64 nLastAgeUpdate;
+
+    void updateDifficulty();
 
     QString lookupAddress(const std::string &address, bool tooltip) const;
 
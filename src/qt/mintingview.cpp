@@ -166,7 +166,6 @@ void MintingView::chooseMintingInterval(int idx)
             break;
     }
     model->getMintingTableModel()->setMintingInterval(interval);
-    mintingProxyModel->invalidate();
 }
 
 void MintingView::exportClicked()
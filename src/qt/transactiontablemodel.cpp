@@ -25,6 +25,7 @@
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QTimer>
 
 #include <boost/foreach.hpp>
 
@@ -38,6 +39,9 @@ static int column_alignments[] = {
         Qt::AlignRight|Qt::AlignVCenter /* amount */
     };
 
+/** Number of wallet transactions decomposed per step of the initial load */
+static const int LOAD_BATCH_SIZE = 1000;
+
 // Comparison operator for sort/binary search of model tx list
 struct TxLessThan
 {
@@ -61,7 +65,8 @@ class TransactionTablePriv
 public:
     TransactionTablePriv(CWallet *_wallet, TransactionTableModel *_parent) :
         wallet(_wallet),
-        parent(_parent)
+        parent(_parent),
+        fLoading(false)
     {
     }
 
@@ -74,20 +79,61 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* While the wallet is being loaded, transactions up to and including
+     * this hash are in the model, later ones will be picked up by loadBatch.
+     */
+    bool fLoading;
+    uint256 hashLoadedUpTo;
+
+    /* Query entire wallet anew from core. Only the first batch is loaded
+     * here, the caller continues with loadBatch until it returns true.
      */
-    void refreshWallet()
+    bool refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
-        cachedWallet.clear();
+        if(!cachedWallet.isEmpty())
+        {
+            parent->beginResetModel();
+            cachedWallet.clear();
+            parent->endResetModel();
+        }
+        fLoading = true;
+        hashLoadedUpTo.SetNull();
+        return loadBatch();
+    }
+
+    /* Append the next LOAD_BATCH_SIZE wallet transactions to the model,
+       holding the locks for this batch only. Returns true when the whole
+       wallet has been loaded.
+     */
+    bool loadBatch()
+    {
+        QList<TransactionRecord> batch;
         {
             LOCK2(cs_main, wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            std::map<uint256, CWalletTx>::iterator it = hashLoadedUpTo.IsNull() ?
+                wallet->mapWallet.begin() : wallet->mapWallet.upper_bound(hashLoadedUpTo);
+            for(int n = 0; it != wallet->mapWallet.end() && n < LOAD_BATCH_SIZE; ++it, ++n)
             {
                 if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                    batch.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                hashLoadedUpTo = it->first;
             }
+            fLoading = (it != wallet->mapWallet.end());
         }
+        // mapWallet is sorted by hash, so the batch goes at the end
+        if(!batch.isEmpty())
+        {
+            parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size()+batch.size()-1);
+            cachedWallet.append(batch);
+            parent->endInsertRows();
+        }
+        return !fLoading;
+    }
+
+    bool isLoaded(const uint256 &hash) const
+    {
+        return !fLoading || !(hashLoadedUpTo < hash);
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -99,6 +145,12 @@ public:
     {
         qDebug() << "TransactionTablePriv::updateWallet: " + QString::fromStdString(hash.ToString()) + " " + QString::number(status);
 
+        if(!isLoaded(hash))
+        {
+            // Not reached by the initial load yet, loadBatch will see its current state
+            return;
+        }
+
         // Find bounds of this transaction in model
         QList<TransactionRecord>::iterator lower = qLowerBound(
             cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
@@ -166,8 +218,10 @@ public:
             parent->endRemoveRows();
             break;
         case CT_UPDATED:
-            // Miscellaneous updates -- nothing to do, status update will take care of this, and is only computed for
-            // visible transactions.
+            // Miscellaneous updates -- status update will take care of this, and is only computed for
+            // visible transactions. Invalidate the affected rows, they may have left the settled state.
+            if(inModel)
+                Q_EMIT parent->dataChanged(parent->index(lowerIndex, 0), parent->index(upperIndex-1, TransactionTableModel::Amount));
             break;
         }
     }
@@ -177,6 +231,14 @@ public:
         return cachedWallet.size();
     }
 
+    /* Whether the cached status of a record can no longer change with new blocks,
+       short of a reorg, which the wallet reports as a transaction update.
+     */
+    bool isSettled(int idx)
+    {
+        return cachedWallet[idx].status.status == TransactionStatus::Confirmed;
+    }
+
     TransactionRecord *index(int idx)
     {
         if(idx >= 0 && idx < cachedWallet.size())
@@ -241,10 +303,16 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *_platformStyle
         walletModel(parent),
         priv(new TransactionTablePriv(_wallet, this)),
         fProcessingQueuedTransactions(false),
+        fLoadingTransactions(false),
         platformStyle(_platformStyle)
 {
     columns << QString() << QString() << tr("Date") << tr("Type") << tr("Label") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
-    priv->refreshWallet();
+    if(!priv->refreshWallet())
+    {
+        // Load the rest of the wallet from the event loop so that the window shows up
+        fLoadingTransactions = true;
+        QTimer::singleShot(0, this, SLOT(loadTransactionBatch()));
+    }
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
@@ -272,14 +340,39 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status, b
     priv->updateWallet(updated, status, showTransaction);
 }
 
+void TransactionTableModel::loadTransactionBatch()
+{
+    if(!priv->loadBatch())
+    {
+        QTimer::singleShot(0, this, SLOT(loadTransactionBatch()));
+        return;
+    }
+    fLoadingTransactions = false;
+}
+
 void TransactionTableModel::updateConfirmations()
 {
     // Blocks came in since last poll.
     // Invalidate status (number of confirmations) and (possibly) description
-    //  for all rows. Qt is smart enough to only actually request the data for the
-    //  visible rows.
-    Q_EMIT dataChanged(index(0, Status), index(priv->size()-1, Status));
-    Q_EMIT dataChanged(index(0, ToAddress), index(priv->size()-1, ToAddress));
+    //  for the rows whose status can still change. Settled rows refresh their
+    //  depth when next painted. Qt is smart enough to only actually request the
+    //  data for the visible rows.
+    int first = -1;
+    for(int i = 0; i <= priv->size(); i++)
+    {
+        if(i < priv->size() && !priv->isSettled(i))
+        {
+            if(first < 0)
+                first = i;
+            continue;
+        }
+        if(first >= 0)
+        {
+            Q_EMIT dataChanged(index(first, Status), index(i-1, Status));
+            Q_EMIT dataChanged(index(first, ToAddress), index(i-1, ToAddress));
+            first = -1;
+        }
+    }
 }
 
 int TransactionTableModel::rowCount(const QModelIndex &parent) const
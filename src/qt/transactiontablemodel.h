@@ -79,7 +79,7 @@ public:
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
-    bool processingQueuedTransactions() { return fProcessingQueuedTransactions; }
+    bool processingQueuedTransactions() { return fProcessingQueuedTransactions || fLoadingTransactions; }
 
 private:
     CWallet* wallet;
@@ -87,6 +87,8 @@ private:
     QStringList columns;
     TransactionTablePriv *priv;
     bool fProcessingQueuedTransactions;
+    /** Set while the initial wallet load is still appending rows */
+    bool fLoadingTransactions;
     const PlatformStyle *platformStyle;
 
     void subscribeToCoreSignals();
@@ -109,6 +111,8 @@ public Q_SLOTS:
     void updateTransaction(const QString &hash, int status, bool showTransaction);
     void updateConfirmations();
     void updateDisplayUnit();
+    /* Continue the initial wallet load with the next batch of transactions */
+    void loadTransactionBatch();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
     void updateAmountColumnTitle();
     /* Needed to update fProcessingQueuedTransactions through a QueuedConnection */
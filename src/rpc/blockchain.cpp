@@ -12,6 +12,7 @@
 #include "coins.h"
 #include "consensus/validation.h"
 #include "validation.h"
+#include "mtpcache.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
@@ -762,7 +763,7 @@ UniValue getblock(const JSONRPCRequest& request)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus(), !fVerbose))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose)
@@ -789,6 +790,22 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    // same layout as the former per-transaction records, so hash_serialized
+    // does not change with the database format
+    ss << hash;
+    for (const auto& output : outputs) {
+        stats.nTransactionOutputs++;
+        ss << VARINT(output.first + 1);
+        ss << output.second.out;
+        stats.nTotalAmount += output.second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
@@ -801,32 +818,29 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            stats.nSerializedSize += 32 + 4 + pcursor->GetValueSize();
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -968,34 +982,35 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
-    ret.push_back(Pair("coinstake", coins.fCoinStake));
+    ret.push_back(Pair("version", coin.nVersion));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
+    ret.push_back(Pair("coinstake", coin.fCoinStake));
 
     return ret;
 }
@@ -1284,6 +1299,31 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getmtpcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getmtpcacheinfo\n"
+            "\nReturns usage statistics of the MTP proof verification cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hits\": xxxxx,                (numeric) Proof checks answered from the cache\n"
+            "  \"misses\": xxxxx,              (numeric) Proof checks that ran the full MTP verification\n"
+            "  \"maxsize\": xxxxx              (numeric) Maximum number of cached proofs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmtpcacheinfo", "")
+            + HelpExampleRpc("getmtpcacheinfo", "")
+        );
+
+    CMTPCacheStats stats = GetMTPCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("maxsize", (uint64_t)stats.nMaxElements));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1402,9 +1442,9 @@ bool FindScriptPubKey(std::atomic<int>& scan_progress, const std::atomic<bool>&
     scan_progress = 0;
     count = 0;
     while (cursor->Valid()) {
-        uint256 key;
-        CCoins coins;
-        if (!cursor->GetKey(key) || !cursor->GetValue(coins)) return false;
+        COutPoint key;
+        Coin coin;
+        if (!cursor->GetKey(key) || !cursor->GetValue(coin)) return false;
         if (++count % 8192 == 0) {
             boost::this_thread::interruption_point();
             if (should_abort) {
@@ -1414,32 +1454,28 @@ bool FindScriptPubKey(std::atomic<int>& scan_progress, const std::atomic<bool>&
         }
         if (count % 256 == 0) {
             // update progress reference every 256 item
-            uint32_t high = 0x100 * *key.begin() + *(key.begin() + 1);
+            uint32_t high = 0x100 * *key.hash.begin() + *(key.hash.begin() + 1);
             scan_progress = (int)(high * 100.0 / 65536.0 + 0.5);
         }
-        for (unsigned int i=0; i<coins.vout.size(); i++) {
-            CTxOut &out = coins.vout[i];
-            if (out.IsNull())
-                continue;
-            if (needles.count(out.scriptPubKey)) {
-                out_results.emplace(COutPoint(key, i), std::make_pair(coins.nHeight, out));
-            }
+        cursor->Next();
+        const CTxOut &out = coin.out;
+        if (needles.count(out.scriptPubKey)) {
+            out_results.emplace(key, std::make_pair((int)coin.nHeight, out));
+        }
 
-            if (addresses.empty())
-                continue;
-            txnouttype type;
-            vector<CTxDestination> vAddr;
-            int nRequired;
-            if (!ExtractDestinations(out.scriptPubKey, type, vAddr, nRequired))
-                continue;
-
-            for (const auto& addr : vAddr) { // 1 txout can contain more than 1 address
-                if (addresses.count(addr)) {
-                    out_results.emplace(COutPoint(key, i), std::make_pair(coins.nHeight, out));
-                }
+        if (addresses.empty())
+            continue;
+        txnouttype type;
+        vector<CTxDestination> vAddr;
+        int nRequired;
+        if (!ExtractDestinations(out.scriptPubKey, type, vAddr, nRequired))
+            continue;
+
+        for (const auto& addr : vAddr) { // 1 txout can contain more than 1 address
+            if (addresses.count(addr)) {
+                out_results.emplace(key, std::make_pair((int)coin.nHeight, out));
             }
         }
-        cursor->Next();
     }
     scan_progress = 100;
     return true;
@@ -1722,6 +1758,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
+    { "blockchain",         "getmtpcacheinfo",        &getmtpcacheinfo,        true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
@@ -1740,7 +1777,7 @@ static const CRPCCommand commands[] =
     { "hidden",             "waitforblockheight",     &waitforblockheight,     true,  {"height","timeout"} },
 
     // mfcoin commands
-    { "blockchain",         "name_filter",            &name_filter,            true,  {"regexp","maxage","from","nb","stat","valuetype"} },
+    { "blockchain",         "name_filter",            &name_filter,            true,  {"regexp","maxage","from","nb","stat","valuetype","start-name"} },
     { "blockchain",         "name_history",           &name_history,           true,  {"name","fullhistory","valuetype"} },
     { "blockchain",         "name_indexinfo",         &name_indexinfo,         true,  {} },
     { "blockchain",         "name_mempool",           &name_mempool,           true,  {"valuetype"} },
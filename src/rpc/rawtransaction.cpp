@@ -290,9 +290,9 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, oneTxid);
+        if (!coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= chainActive.Height())
+            pblockindex = chainActive[coin.nHeight];
     }
 
     if (pblockindex == NULL)
@@ -306,7 +306,7 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
     }
 
     CBlock block;
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus(), true))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     unsigned int ntxFound = 0;
@@ -699,9 +699,7 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -755,26 +753,32 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
             vector<unsigned char> pkData(ParseHexO(prevOut, "scriptPubKey"));
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
-            CCoinsModifier coins = view.ModifyCoins(txid);
+            COutPoint out(txid, nOut);
+            int nVersion = 0;
             {
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                if (!coin.IsSpent())
+                    nVersion = coin.nVersion;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                newcoin.nVersion = nVersion;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
             // given), add redeemScript to the tempKeystore so it can be signed:
-            if (fGivenKeys && (scriptPubKey.IsPayToScriptHash(coins->nVersion) || scriptPubKey.IsPayToWitnessScriptHash(coins->nVersion))) {
+            if (fGivenKeys && (scriptPubKey.IsPayToScriptHash(nVersion) || scriptPubKey.IsPayToWitnessScriptHash(nVersion))) {
                 RPCTypeCheckObj(prevOut,
                     {
                         {"txid", UniValueType(UniValue::VSTR)},
@@ -827,15 +831,15 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
         const CScript& prevPubKey = txin.prevout.hash != randpaytx ?
-                    coins->vout[txin.prevout.n].scriptPubKey :
+                    coin.out.scriptPubKey :
                     GenerateScriptForRandPay(mergedTx.vout[0].scriptPubKey);
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -906,9 +910,12 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
         nMaxRawTxFee = 0;
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -1133,8 +1140,11 @@ UniValue randpay_submittx(const JSONRPCRequest& request)
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(tx->GetHash());
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(tx->GetHash(), o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     if (fHaveChain)
         throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction already in block chain");
     CValidationState state;
@@ -1197,10 +1207,10 @@ UniValue randpay_submittx(const JSONRPCRequest& request)
             // sign randpay input (vin[rpn]) with key
             if (rpn >= 0) {
                 const CTxIn& txin = tx->vin[rpn];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins != nullptr && coins->IsAvailable(txin.prevout.n)); // randpay input should always be available
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                assert(!coin.IsSpent()); // randpay input should always be available
                 const CScript prevPubKey = GenerateScriptForRandPay(tx->vout[0].scriptPubKey);
-                const CAmount amount = coins->vout[txin.prevout.n].nValue;
+                const CAmount amount = coin.out.nValue;
 
                 SignatureData sigdata;
                 if(!ProduceSignature(MutableTransactionSignatureCreator(pwalletMain, &mtx, rpn, amount, SIGHASH_ALL), prevPubKey, sigdata))
@@ -1228,9 +1238,12 @@ UniValue randpay_submittx(const JSONRPCRequest& request)
         CTransactionRef txUpdated(MakeTransactionRef(std::move(mtx)));
         const uint256& hashUpdatedTx = txUpdated->GetHash();
 
-        const CCoins* existingCoins2 = view.AccessCoins(hashUpdatedTx);
+        bool fHaveChain2 = false;
+        for (size_t o = 0; !fHaveChain2 && o < txUpdated->vout.size(); o++) {
+            const Coin& existingCoin = view.AccessCoin(COutPoint(hashUpdatedTx, o));
+            fHaveChain2 = !existingCoin.IsSpent();
+        }
         bool fHaveMempool2 = mempool.exists(hashUpdatedTx);
-        bool fHaveChain2 = existingCoins2 && existingCoins2->nHeight < 1000000000;
         if (!fHaveMempool2 && !fHaveChain2) {
             // push to local node and sync with wallets
             CValidationState state;
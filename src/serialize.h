@@ -150,6 +150,7 @@ enum
     // modifiers
     SER_POSMARKER       = (1 << 18),  // mfcoin: for sending block headers with PoS marker, to allow headers-first syncronization
     SER_BTC_TX          = (1 << 19),  // mfcoin: for merged mining, to read tx without nTime.
+    SER_NOMTP           = (1 << 20),  // mfcoin: block files that keep MTP proofs separately in mtp*.dat
 };
 
 #define READWRITE(obj)      (::SerReadWrite(s, (obj), ser_action))
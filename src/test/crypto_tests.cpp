@@ -255,6 +255,34 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_short) {
+    // Every batch size up to two 8-way batches plus a tail, every length that fits one block
+    std::vector<unsigned char> in(55 * 17);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = insecure_rand();
+    const char* names[] = {"standard", "sse4.1(4way)", "avx2(8way)"};
+    for (const char* name : names) {
+        if (!SHA256Select(name))
+            continue; // not built in or not supported by this CPU
+        BOOST_TEST_MESSAGE("Testing SHA256DShort: " << name);
+        for (size_t len = 0; len <= 55; len++) {
+            for (size_t count = 0; count <= 17; count++) {
+                std::vector<unsigned char> out(32 * count + 32, 0xa5);
+                SHA256DShort(out.data(), in.data(), len, count);
+                for (size_t i = 0; i < count; i++) {
+                    unsigned char hash[CSHA256::OUTPUT_SIZE], expected[CSHA256::OUTPUT_SIZE];
+                    CSHA256().Write(in.data() + len * i, len).Finalize(hash);
+                    CSHA256().Write(hash, sizeof(hash)).Finalize(expected);
+                    BOOST_CHECK(memcmp(out.data() + 32 * i, expected, sizeof(expected)) == 0);
+                }
+                // Nothing written past the last hash
+                BOOST_CHECK(out[32 * count] == 0xa5 && out[32 * count + 31] == 0xa5);
+            }
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -0,0 +1,111 @@
+#include "chainparams.h"
+#include "crypto/MerkleTreeProof/mtp.h"
+#include "crypto/MerkleTreeProof/simd.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mtp_tests, BasicTestingSetup)
+
+static const char* const MTP_IMPLEMENTATIONS[] = {"standard", "sse4.1", "avx2"};
+
+static void RandomBytes(void* data, size_t len)
+{
+    unsigned char* p = (unsigned char*)data;
+    for (size_t i = 0; i < len; i++)
+        p[i] = insecure_rand();
+}
+
+BOOST_AUTO_TEST_CASE(mtp_fill_block)
+{
+    for (const char* name : MTP_IMPLEMENTATIONS) {
+        if (!mtp_select(name))
+            continue; // not built in or not supported by this CPU
+        BOOST_TEST_MESSAGE("Testing fill_block_mtp: " << name);
+        for (int i = 0; i < 64; i++) {
+            block prev, ref, next;
+            uint8_t h0[ARGON2_PREHASH_SEED_LENGTH];
+            RandomBytes(&prev, sizeof(prev));
+            RandomBytes(&ref, sizeof(ref));
+            RandomBytes(&next, sizeof(next));
+            RandomBytes(h0, sizeof(h0));
+            uint32_t index = insecure_rand();
+            for (int with_xor = 0; with_xor <= 1; with_xor++) {
+                block expected = next, actual = next;
+                fill_block_mtp_ref(&prev, &ref, &expected, with_xor, index, h0);
+                fill_block_mtp(&prev, &ref, &actual, with_xor, index, h0);
+                BOOST_CHECK(memcmp(&expected, &actual, sizeof(block)) == 0);
+            }
+        }
+    }
+    mtp_select("standard");
+}
+
+BOOST_AUTO_TEST_CASE(mtp_blake2b)
+{
+    std::vector<unsigned char> data(3 * sizeof(block));
+    RandomBytes(data.data(), data.size());
+
+    // Digests of the portable code for every length up to a few blocks
+    std::vector<std::vector<uint8_t> > expected;
+    BOOST_CHECK(mtp_select("standard"));
+    for (size_t len = 0; len <= data.size(); len += 7) {
+        std::vector<uint8_t> digest(16);
+        blake2b_state S;
+        blake2b_init(&S, digest.size());
+        blake2b_4r_update(&S, data.data(), len);
+        blake2b_4r_final(&S, digest.data(), digest.size());
+        expected.push_back(digest);
+    }
+
+    for (const char* name : MTP_IMPLEMENTATIONS) {
+        if (!mtp_select(name))
+            continue;
+        BOOST_TEST_MESSAGE("Testing blake2b_4r_compress: " << name);
+        for (int i = 0; i < 64; i++) {
+            blake2b_state S;
+            uint8_t in[BLAKE2B_BLOCKBYTES];
+            RandomBytes(&S, sizeof(S));
+            RandomBytes(in, sizeof(in));
+            blake2b_state S_ref = S;
+            blake2b_4r_compress_ref(&S_ref, in);
+            blake2b_4r_compress(&S, in);
+            BOOST_CHECK(memcmp(S.h, S_ref.h, sizeof(S.h)) == 0);
+        }
+        size_t n = 0;
+        for (size_t len = 0; len <= data.size(); len += 7) {
+            std::vector<uint8_t> digest(16);
+            blake2b_state S;
+            blake2b_init(&S, digest.size());
+            blake2b_4r_update(&S, data.data(), len);
+            blake2b_4r_final(&S, digest.data(), digest.size());
+            BOOST_CHECK(digest == expected[n++]);
+        }
+    }
+    mtp_select("standard");
+}
+
+BOOST_AUTO_TEST_CASE(mtp_verify_genesis)
+{
+    // The genesis blocks carry a full MTP proof
+    const CBlock& genesis = Params().GenesisBlock();
+    const uint256& powLimit = Params().GetConsensus().powLimit;
+    BOOST_REQUIRE(genesis.mtpHashData);
+    for (const char* name : MTP_IMPLEMENTATIONS) {
+        if (!mtp_select(name))
+            continue;
+        BOOST_TEST_MESSAGE("Testing mtp::verify: " << name);
+        uint256 mtpHashValue;
+        BOOST_CHECK(mtp::verify(genesis.nNonce, genesis, powLimit, &mtpHashValue));
+        BOOST_CHECK_EQUAL(mtpHashValue.GetHex(), "000c2dcee2bd9d180c95f42a40006e3c6ca2db1c0a0863b6dd359940641ef999");
+        BOOST_CHECK(!mtp::verify(genesis.nNonce + 1, genesis, powLimit));
+    }
+    mtp_select("standard");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,296 @@
+#include "txreader.h"
+
+#include "auxpow.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "sync.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace {
+
+/** Block file opened read-only, closed when the last reader is done with it */
+class CBlockFileHandle
+{
+private:
+    FILE* file;
+#ifdef WIN32
+    CCriticalSection cs; // fseek and fread share the file position
+#endif
+
+    CBlockFileHandle(const CBlockFileHandle&);
+    void operator=(const CBlockFileHandle&);
+
+public:
+    explicit CBlockFileHandle(FILE* fileIn) : file(fileIn) {}
+    ~CBlockFileHandle() { fclose(file); }
+
+    // Reads up to nSize bytes at nPos, returns the number of bytes read
+    size_t ReadAt(uint64_t nPos, char* pch, size_t nSize)
+    {
+#ifdef WIN32
+        LOCK(cs);
+        if (fseek(file, nPos, SEEK_SET))
+            return 0;
+        return fread(pch, 1, nSize, file);
+#else
+        size_t nRead = 0;
+        while (nRead < nSize) {
+            ssize_t n = pread(fileno(file), pch + nRead, nSize - nRead, nPos + nRead);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            nRead += n;
+        }
+        return nRead;
+#endif
+    }
+};
+
+/** Buffered deserialization stream reading a block file at any position */
+class CBlockFileReader
+{
+private:
+    CBlockFileHandle& handle;
+    int nType;
+    const int nVersion;
+    uint64_t nPos;
+    std::vector<char> vchBuf;
+    uint64_t nBufPos;   // file position of vchBuf[0]
+    size_t nBufSize;    // valid bytes in vchBuf
+
+public:
+    CBlockFileReader(CBlockFileHandle& handleIn, uint64_t nPosIn, int nTypeIn, int nVersionIn) :
+        handle(handleIn), nType(nTypeIn), nVersion(nVersionIn), nPos(nPosIn), vchBuf(4096), nBufPos(0), nBufSize(0) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    void SetType(int n) { nType = n; }
+    uint64_t GetPos() const { return nPos; }
+    void Seek(uint64_t nPosIn) { nPos = nPosIn; }
+    void ignore(size_t nSize) { nPos += nSize; }
+
+    void read(char* pch, size_t nSize)
+    {
+        while (nSize > 0) {
+            if (nPos < nBufPos || nPos >= nBufPos + nBufSize) {
+                if (nSize >= vchBuf.size()) {
+                    // large reads bypass the buffer
+                    if (handle.ReadAt(nPos, pch, nSize) != nSize)
+                        throw std::ios_base::failure("CBlockFileReader::read: end of data");
+                    nPos += nSize;
+                    return;
+                }
+                nBufPos = nPos;
+                nBufSize = handle.ReadAt(nPos, &vchBuf[0], vchBuf.size());
+                if (nBufSize == 0)
+                    throw std::ios_base::failure("CBlockFileReader::read: end of data");
+            }
+            size_t nNow = std::min(nSize, (size_t)(nBufPos + nBufSize - nPos));
+            memcpy(pch, &vchBuf[nPos - nBufPos], nNow);
+            pch += nNow;
+            nPos += nNow;
+            nSize -= nNow;
+        }
+    }
+
+    template<typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+/** Reads the hashed fields of a block header and returns the size of the whole header on disk */
+unsigned int ReadHeaderSkipProofs(CBlockFileReader& s, CBlockHeader& header)
+{
+    uint64_t nStart = s.GetPos();
+    int nType = s.GetType();
+
+    // hashed fields only, see CBlockHeader::SerializationOp
+    s.SetType(SER_GETHASH | SER_NOMTP);
+    s >> header;
+    s.SetType(nType);
+
+    if (header.nVersion & BLOCK_VERSION_AUXPOW) {
+        CAuxPow auxpow;
+        s >> auxpow;
+    }
+
+    // nFlags is not stored in block files, so PoS blocks are recognized by their empty MTP hash
+    if (header.mtpHashValue != uint256() && !(nType & SER_NOMTP)) {
+        s.ignore(sizeof(CMTPHashData::hashRootMTP) + sizeof(CMTPHashData::nBlockMTP));
+        for (int i = 0; i < mtp::ProofSet::COUNT; i++) {
+            uint8_t numberOfProofBlocks;
+            s >> numberOfProofBlocks;
+            s.ignore(numberOfProofBlocks * mtp::MTP_PROOF_NODE_SIZE);
+        }
+    }
+    return s.GetPos() - nStart;
+}
+
+/** Fixed size map dropping the least recently used entry */
+template <typename K, typename V>
+class CLRUMap
+{
+private:
+    typedef std::list<std::pair<K, V> > list_type;
+    list_type items; // most recently used first
+    std::map<K, typename list_type::iterator> index;
+    size_t nMaxSize;
+
+public:
+    explicit CLRUMap(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    V* Get(const K& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return NULL;
+        items.splice(items.begin(), items, it->second);
+        return &it->second->second;
+    }
+
+    void Put(const K& key, const V& value)
+    {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = value;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        items.emplace_front(key, value);
+        index[key] = items.begin();
+        if (items.size() > nMaxSize) {
+            index.erase(items.back().first);
+            items.pop_back();
+        }
+    }
+
+    void Erase(const K& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        items.erase(it->second);
+        index.erase(it);
+    }
+
+    template <typename Pred>
+    void EraseIf(Pred pred)
+    {
+        for (auto it = items.begin(); it != items.end(); ) {
+            if (pred(it->first)) {
+                index.erase(it->first);
+                it = items.erase(it);
+            } else
+                ++it;
+        }
+    }
+};
+
+struct CBlockHeaderEntry
+{
+    CBlockHeader header;
+    unsigned int nSize;
+};
+
+class CTxReader
+{
+private:
+    CCriticalSection cs;
+    CLRUMap<int, std::shared_ptr<CBlockFileHandle> > files;
+    CLRUMap<std::pair<int, unsigned int>, CBlockHeaderEntry> headers;
+    CLRUMap<std::tuple<int, unsigned int, unsigned int>, CTransactionRef> txs;
+
+public:
+    CTxReader() : files(TXREADER_MAX_OPEN_FILES), headers(TXREADER_CACHE_SIZE), txs(TXREADER_CACHE_SIZE) {}
+
+    bool Read(const CDiskTxPos& postx, CTransactionRef& txOut, CBlockHeader& header)
+    {
+        std::pair<int, unsigned int> blockKey(postx.nFile, postx.nPos);
+        std::tuple<int, unsigned int, unsigned int> txKey(postx.nFile, postx.nPos, postx.nTxOffset);
+
+        std::shared_ptr<CBlockFileHandle> handle;
+        CBlockHeaderEntry entry;
+        bool fHeader;
+        {
+            LOCK(cs);
+            CBlockHeaderEntry* pentry = headers.Get(blockKey);
+            fHeader = pentry != NULL;
+            if (fHeader) {
+                entry = *pentry;
+                CTransactionRef* ptx = txs.Get(txKey);
+                if (ptx) {
+                    txOut = *ptx;
+                    header = entry.header;
+                    return true;
+                }
+            }
+
+            std::shared_ptr<CBlockFileHandle>* phandle = files.Get(postx.nFile);
+            if (phandle)
+                handle = *phandle;
+            else {
+                FILE* file = OpenBlockFile(CDiskBlockPos(postx.nFile, 0), true);
+                if (!file)
+                    return error("%s: OpenBlockFile failed for %s", __func__, postx.ToString());
+                handle = std::make_shared<CBlockFileHandle>(file);
+                files.Put(postx.nFile, handle);
+            }
+        }
+
+        // the file is read without holding the lock
+        try {
+            CBlockFileReader s(*handle, postx.nPos, GetBlockFileSerType(postx.nFile), CLIENT_VERSION);
+            if (!fHeader)
+                entry.nSize = ReadHeaderSkipProofs(s, entry.header);
+            s.Seek((uint64_t)postx.nPos + entry.nSize + postx.nTxOffset);
+            s >> txOut;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), postx.ToString());
+        }
+        header = entry.header;
+
+        LOCK(cs);
+        if (!fHeader)
+            headers.Put(blockKey, entry);
+        txs.Put(txKey, txOut);
+        return true;
+    }
+
+    void ForgetFile(int nFile)
+    {
+        LOCK(cs);
+        files.Erase(nFile);
+        headers.EraseIf([nFile](const std::pair<int, unsigned int>& key) { return key.first == nFile; });
+        txs.EraseIf([nFile](const std::tuple<int, unsigned int, unsigned int>& key) { return std::get<0>(key) == nFile; });
+    }
+};
+
+CTxReader txReader;
+
+} // anon namespace
+
+bool ReadTxFromDisk(const CDiskTxPos& postx, CTransactionRef& txOut, CBlockHeader& header)
+{
+    return txReader.Read(postx, txOut, header);
+}
+
+void TxReaderForgetFile(int nFile)
+{
+    txReader.ForgetFile(nFile);
+}
@@ -0,0 +1,26 @@
+#ifndef BITCOIN_TXREADER_H
+#define BITCOIN_TXREADER_H
+
+#include "primitives/transaction.h"
+
+class CBlockHeader;
+struct CDiskTxPos;
+
+// Block files kept open for transaction reads
+static const unsigned int TXREADER_MAX_OPEN_FILES = 8;
+// Decoded transactions (and header sizes of their blocks) kept in memory
+static const unsigned int TXREADER_CACHE_SIZE = 2000;
+
+/**
+ * mfcoin: read the transaction at postx from the block files, and the hashed
+ * part of the header of its block (enough for GetHash() and GetBlockTime()).
+ * Block files stay open between calls and the auxpow and MTP proof of the
+ * header are skipped instead of deserialized; recently read transactions are
+ * served from memory.
+ */
+bool ReadTxFromDisk(const CDiskTxPos& postx, CTransactionRef& txOut, CBlockHeader& header);
+
+/** Close a block file that is about to be deleted */
+void TxReaderForgetFile(int nFile);
+
+#endif // BITCOIN_TXREADER_H
@@ -0,0 +1,174 @@
+#include "utxosnapshot.h"
+
+#include "crypto/common.h"
+#include "sync.h"
+#include "util.h"
+#include "validation.h"
+
+#ifdef WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <map>
+
+CUtxoSnapshotFile::~CUtxoSnapshotFile()
+{
+#ifndef WIN32
+    if (pData)
+        munmap(pData, nSize);
+#endif
+}
+
+bool CUtxoSnapshotFile::Open(const std::string& path)
+{
+    strPath = path;
+#ifdef WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::in);
+    if (!file.is_open())
+        return false;
+    vData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    pData = vData.empty() ? NULL : &vData[0];
+    nSize = vData.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    nSize = st.st_size;
+    if (nSize > 0) {
+        void* p = mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return error("%s: cannot map %s", __func__, path);
+        }
+        pData = (unsigned char*)p;
+        // records are read once, front to back
+        madvise(pData, nSize, MADV_SEQUENTIAL);
+        madvise(pData, nSize, MADV_WILLNEED);
+    }
+    close(fd);
+#endif
+    return true;
+}
+
+void CUtxoSnapshotFile::Index()
+{
+    if (fIndexed)
+        return;
+    fIndexed = true;
+
+    // mfcoin: same rules as the original stream reader of AcceptBlock(): stop at
+    // the first incomplete record, tolerate a missing record separator.
+    const unsigned char* p = pData;
+    const unsigned char* pend = pData + nSize;
+    while (pend - p >= 8) {
+        CUtxoSnapshotRecord rec;
+        rec.nValue = ReadLE64(p);
+        p += 8;
+
+        if (pend - p < 8) {
+            LogPrintf("%s: %s corrupted? - No more data (PubKeyScript size)\n", __func__, strPath);
+            break;
+        }
+        uint64_t nScriptSize = ReadLE64(p);
+        p += 8;
+        if (nScriptSize == 0)
+            LogPrintf("%s: %s corrupted? - Warning! PubKeyScript size = 0\n", __func__, strPath);
+        if (nScriptSize > (uint64_t)(pend - p)) {
+            LogPrintf("%s: %s corrupted? - No more data (PubKeyScript)\n", __func__, strPath);
+            break;
+        }
+        rec.pScript = p;
+        rec.nScriptSize = nScriptSize;
+        p += nScriptSize;
+
+        if (pend - p < 8) {
+            LogPrintf("%s: %s corrupted? - No more data (Timestamp)\n", __func__, strPath);
+            break;
+        }
+        rec.nTime = ReadLE64(p);
+        p += 8;
+
+        vRecords.push_back(rec);
+
+        if (p == pend) {
+            LogPrintf("%s: %s corrupted? - No more data (record separator)\n", __func__, strPath);
+            fMissingSeparator = true;
+            break;
+        }
+        if (*p == '\n')
+            p++;
+        else
+            LogPrintf("%s: %s corrupted? - Warning! No record separator ('0xA') was found\n", __func__, strPath);
+    }
+    if (p != pend && !fMissingSeparator)
+        LogPrintf("%s: %s: %u trailing bytes ignored\n", __func__, strPath, pend - p);
+}
+
+namespace {
+
+class CUtxoSnapshotCache
+{
+private:
+    CCriticalSection cs;
+    std::map<int, std::shared_ptr<CUtxoSnapshotFile> > mapFiles; // by block height
+
+    std::shared_ptr<CUtxoSnapshotFile> Open(int nHeight)
+    {
+        AssertLockHeld(cs);
+        auto it = mapFiles.find(nHeight);
+        if (it != mapFiles.end())
+            return it->second;
+
+        std::string path = GetUTXOFileName(nHeight);
+        if (path.empty())
+            return nullptr;
+        std::shared_ptr<CUtxoSnapshotFile> file = std::make_shared<CUtxoSnapshotFile>();
+        if (!file->Open(path))
+            return nullptr;  // not cached, the file may be put in place later
+
+        mapFiles[nHeight] = file;
+        // files are used in order of height: drop the farthest one
+        while (mapFiles.size() > UTXO_SNAPSHOT_CACHE_FILES) {
+            auto itFirst = mapFiles.begin();
+            auto itLast = std::prev(mapFiles.end());
+            if (nHeight - itFirst->first >= itLast->first - nHeight)
+                mapFiles.erase(itFirst);
+            else
+                mapFiles.erase(itLast);
+        }
+        return file;
+    }
+
+public:
+    std::shared_ptr<const CUtxoSnapshotFile> Get(int nHeight)
+    {
+        LOCK(cs);
+        std::shared_ptr<CUtxoSnapshotFile> file = Open(nHeight);
+        if (!file)
+            return nullptr;
+        file->Index();
+
+        if (isForkBlock(nHeight + 1))
+            Open(nHeight + 1);
+        return file;
+    }
+};
+
+CUtxoSnapshotCache utxoSnapshotCache;
+
+} // anon namespace
+
+std::shared_ptr<const CUtxoSnapshotFile> GetUTXOSnapshot(int nHeight)
+{
+    return utxoSnapshotCache.Get(nHeight);
+}
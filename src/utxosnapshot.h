@@ -0,0 +1,72 @@
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include "script/script.h"
+
+#include <memory>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Number of parsed UTXO snapshot files kept mapped in memory
+static const unsigned int UTXO_SNAPSHOT_CACHE_FILES = 8;
+
+/** One record of a UTXO snapshot file: the only output of a fork block coinbase tx */
+struct CUtxoSnapshotRecord
+{
+    uint64_t nValue;
+    const unsigned char* pScript; // points into the mapped file
+    uint32_t nScriptSize;
+    uint32_t nTime;
+
+    CScript GetScript() const { return CScript(pScript, pScript + nScriptSize); }
+    bool IsScript(const CScript& script) const
+    {
+        return script.size() == nScriptSize && (nScriptSize == 0 || memcmp(&script[0], pScript, nScriptSize) == 0);
+    }
+};
+
+/**
+ * mfcoin: utxo-NNNNN.bin file of fork block NNNNN, mapped read-only into
+ * memory. Record layout is: amount (8 bytes LE), script size (8 bytes LE),
+ * script, time (8 bytes LE), '\n'. Records are parsed once and point into
+ * the mapping, which lives as long as the object.
+ */
+class CUtxoSnapshotFile
+{
+private:
+    std::string strPath;
+    unsigned char* pData;
+    size_t nSize;
+#ifdef WIN32
+    std::vector<unsigned char> vData;
+#endif
+    bool fIndexed;
+
+    CUtxoSnapshotFile(const CUtxoSnapshotFile&);
+    void operator=(const CUtxoSnapshotFile&);
+
+public:
+    std::vector<CUtxoSnapshotRecord> vRecords;
+    // the last record is not followed by a record separator
+    bool fMissingSeparator;
+
+    CUtxoSnapshotFile() : pData(NULL), nSize(0), fIndexed(false), fMissingSeparator(false) {}
+    ~CUtxoSnapshotFile();
+
+    // Maps the file and asks the OS to start reading it in
+    bool Open(const std::string& path);
+    // Parses the records, once
+    void Index();
+
+    const std::string& GetPath() const { return strPath; }
+};
+
+/**
+ * Returns the parsed snapshot file of fork block nHeight, or nullptr if it
+ * cannot be opened. The file of the next fork block is opened in advance so
+ * that mining and (re)indexing of the fork range do not wait for the disk.
+ */
+std::shared_ptr<const CUtxoSnapshotFile> GetUTXOSnapshot(int nHeight);
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
@@ -14,6 +14,7 @@
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "mtpcheckqueue.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
@@ -27,11 +28,13 @@
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txreader.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
 #include "warnings.h"
 
@@ -68,9 +71,11 @@ CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nMTPCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
+bool fMTPStore = DEFAULT_MTPSTORE;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -142,6 +147,8 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** First block file whose blocks were written without their MTP proofs (-mtpstore), -1 if none */
+    std::atomic<int> nMTPStoreFile(-1);
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -450,15 +457,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -514,10 +521,11 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     unsigned int nSigOps = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        int nVersion;
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i], nVersion);
-        if (prevout.scriptPubKey.IsPayToScriptHash(nVersion))
-            nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig, nVersion);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
+        if (prevout.scriptPubKey.IsPayToScriptHash(coin.nVersion))
+            nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig, coin.nVersion);
     }
     return nSigOps;
 }
@@ -535,7 +543,9 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         nSigOps += CountWitnessSigOps(tx.vin[i].scriptSig, prevout.scriptPubKey, &tx.vin[i].scriptWitness, flags, tx.nVersion);
     }
     return nSigOps;
@@ -609,9 +619,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -638,7 +648,7 @@ static bool IsCurrentForFeeEstimation()
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache, bool fRandPayCheck)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, bool fRandPayCheck)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -743,30 +753,30 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(hash, out);
+            bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!had_coin_in_cache) {
+                    coins_to_uncache.push_back(outpoint);
+                }
+                return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                if (pfMissingInputs) {
                     *pfMissingInputs = true;
+                }
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -810,8 +820,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1080,10 +1090,10 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee, bool fRandPayCheck)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache, fRandPayCheck);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache, fRandPayCheck);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
@@ -1116,17 +1126,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
+            if (!ReadTxFromDisk(postx, txOut, header))
+                return false;
             hashBlock = header.GetHash();
             if (txOut->GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
@@ -1137,10 +1139,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1167,16 +1168,8 @@ bool GetTransaction(const CDiskTxPos& postx, CTransactionRef &txOut)
     if (!fTxIndex)
         return false;
 
-    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
     CBlockHeader header;
-    try {
-        file >> header;
-        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-        file >> txOut;
-    } catch (std::exception& e) {
-        return error("%s() : deserialize or I/O error\n%s", __PRETTY_FUNCTION__, e.what());
-    }
-    return true;
+    return ReadTxFromDisk(postx, txOut, header);
 }
 
 
@@ -1192,7 +1185,7 @@ bool GetTransaction(const CDiskTxPos& postx, CTransactionRef &txOut)
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    CAutoFile fileout(OpenBlockFile(pos), GetBlockFileSerType(pos.nFile), CLIENT_VERSION);
     if (fileout.IsNull())
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
@@ -1215,7 +1208,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     block.SetNull();
 
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CAutoFile filein(OpenBlockFile(pos, true), GetBlockFileSerType(pos.nFile), CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
@@ -1227,8 +1220,8 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
-    // MTP
-    if (block.IsProofOfWork() && !CheckMerkleTreeProof(block, consensusParams)){
+    // MTP, unless the proof lives in mtp?????.dat and was not read
+    if (block.IsProofOfWork() && !(filein.GetType() & SER_NOMTP) && !CheckMerkleTreeProof(block, consensusParams)){
     	return error("ReadBlockFromDisk: CheckMerkleTreeProof: Errors in block header at %s", pos.ToString());
     }
 
@@ -1239,13 +1232,64 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fReadMTP)
 {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    if (fReadMTP && (pindex->nStatus & BLOCK_HAVE_MTP)) {
+        if (!ReadMTPFromDisk(block, pindex->GetMTPPos()))
+            return false;
+        if (!CheckMerkleTreeProof(block, consensusParams))
+            return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): CheckMerkleTreeProof: Errors in MTP proof at %s", pindex->GetMTPPos().ToString());
+    }
+    return true;
+}
+
+bool WriteMTPToDisk(const CBlockHeader& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Open proof file to append; it is not pre-allocated, so the end of the file is the end of the data
+    CAutoFile fileout(OpenMTPFile(pos), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("WriteMTPToDisk: OpenMTPFile failed");
+    if (fseek(fileout.Get(), 0, SEEK_END))
+        return error("WriteMTPToDisk: fseek failed");
+
+    // Write index header; the block hash lets a reindex find the proof again
+    uint256 hash = block.GetHash();
+    unsigned int nSize = GetSerializeSize(fileout, hash) + GetSerializeSize(fileout, *block.mtpHashData);
+    fileout << FLATDATA(messageStart) << nSize;
+
+    // Write proof
+    long fileOutPos = ftell(fileout.Get());
+    if (fileOutPos < 0)
+        return error("WriteMTPToDisk: ftell failed");
+    pos.nPos = (unsigned int)fileOutPos;
+    fileout << hash << *block.mtpHashData;
+
+    return true;
+}
+
+bool ReadMTPFromDisk(CBlockHeader& block, const CDiskBlockPos& pos)
+{
+    CAutoFile filein(OpenMTPFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadMTPFromDisk: OpenMTPFile failed for %s", pos.ToString());
+
+    uint256 hash;
+    std::shared_ptr<CMTPHashData> mtpHashData = std::make_shared<CMTPHashData>();
+    try {
+        filein >> hash >> *mtpHashData;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    if (hash != block.GetHash())
+        return error("ReadMTPFromDisk: proof at %s belongs to block %s", pos.ToString(), hash.ToString());
+    block.mtpHashData = mtpHashData;
     return true;
 }
 
@@ -1447,26 +1491,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
             if (txin.prevout.hash == randpaytx)
                 continue;
 
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-                undo.fCoinStake = coins->fCoinStake;  // ppcoin
-                undo.nTime = coins->nTime;            // ppcoin
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1508,26 +1539,26 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
-               const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const COutPoint &prevout = tx.vin[i].prevout;
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
                 // mfcoin: at some point we changed coinbase maturity from 12 to 32
                 int cnbMaturity = nSpendHeight > 193912 ? ::Params().GetConsensus().nCoinbaseMaturity : ::Params().GetConsensus().nCoinbaseMaturityOld;
-                if (nSpendHeight - coins->nHeight < cnbMaturity)
+                if (nSpendHeight - coin.nHeight < cnbMaturity)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase/coinstake",
-                        strprintf("tried to spend coinbase/coinstake at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase/coinstake at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // ppcoin: check transaction timestamp
-            if (coins->nTime > tx.nTime)
+            if (coin.nTime > tx.nTime)
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-spent-too-early", false, strprintf("%s : transaction timestamp earlier than input transaction", __func__));
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1586,8 +1617,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             int32_t nRandPayPos = -1;
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // mfcoin: skip randpay check to do it as a last step
                 if (fRandPayLast && prevout.hash == randpaytx) {
@@ -1596,7 +1627,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 }
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1608,7 +1639,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1627,16 +1658,16 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (fRandPayLast && nRandPayPos != -1) {
                 unsigned int i = nRandPayPos;
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_RANDPAY, strprintf("randpay: non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1679,6 +1710,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1706,6 +1739,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1727,36 +1762,34 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-        coins->fCoinStake = undo.fCoinStake; // ppcoin
-        coins->nTime = undo.nTime;           // ppcoin
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height, coinbase/coinstake, time and version). Older
+        // versions included this information only in undo records for the last spend
+        // of a transactions' outputs. This implies that it must be present for some
+        // other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+        undo.fCoinStake = alternate.fCoinStake;
+        undo.nTime = alternate.nTime;
+        undo.nVersion = alternate.nVersion;
+    }
+    view.AddCoin(out, std::move(undo), undo.fCoinBase);
 
     return fClean;
 }
@@ -1788,21 +1821,15 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || (uint32_t)pindex->nHeight != coin.nHeight ||
+                        tx.IsCoinBase() != coin.IsCoinBase() || tx.IsCoinStake() != coin.IsCoinStake() || tx.nTime != coin.nTime)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // UTXO
@@ -1812,7 +1839,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // restore inputs
         if (i > nNonCBIdx) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             // mfcoin: skip special randpay utxo, because we don't record undo information for it
             vector<reference_wrapper<const CTxIn>> vinWithoutRandpay;
             vinWithoutRandpay.reserve(tx.vin.size());
@@ -1825,8 +1852,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
             for (unsigned int j = vinWithoutRandpay.size(); j-- > 0;) {
                 const COutPoint &out = vinWithoutRandpay[j].get().prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
             }
         }
@@ -1873,6 +1899,14 @@ void static FlushBlockFile(bool fFinalize = false)
         FileCommit(fileOld);
         fclose(fileOld);
     }
+
+    if (GetBlockFileSerType(nLastBlockFile) & SER_NOMTP) {
+        fileOld = OpenMTPFile(posOld);
+        if (fileOld) {
+            FileCommit(fileOld);
+            fclose(fileOld);
+        }
+    }
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
@@ -1884,6 +1918,28 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CMTPCheckQueue mtpcheckqueue(MAX_MTPCHECK_PENDING);
+
+void ThreadMTPCheck() {
+    RenameThread("mfcoin-mtpcheck");
+    mtpcheckqueue.Thread();
+}
+
+void QueueMerkleTreeProofCheck(const CBlock& block, const Consensus::Params& consensusParams)
+{
+    if (nMTPCheckThreads && block.IsProofOfWork())
+        mtpcheckqueue.Push(block, consensusParams);
+}
+
+/** CheckMerkleTreeProof, reusing the result of a background check queued for this block if there is one */
+static bool CheckBlockMerkleTreeProof(const CBlock& block, const Consensus::Params& consensusParams)
+{
+    bool fValid;
+    if (mtpcheckqueue.Join(block, fValid))
+        return fValid;
+    return CheckMerkleTreeProof(block, consensusParams);
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -2041,10 +2097,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
@@ -2117,7 +2175,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -2327,16 +2385,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 64 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(64 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        // mfcoin: name index is committed at the same chainstate
+        if (pnameindex && !pnameindex->Flush(pcoinsTip->GetBestBlock()))
+            return AbortNode(state, "Failed to write to name index");
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2364,6 +2425,7 @@ void PruneAndFlush() {
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    UpdateStakeModifierIndex();
 
     // New best block
     mempool.AddTransactionsUpdated(1);
@@ -2492,7 +2554,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     if (!pblock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
-        if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
+        if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus(), true))
             return AbortNode(state, "Failed to read block");
     } else {
         connectTrace.blocksConnected.emplace_back(pindexNew, pblock);
@@ -2983,6 +3045,25 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+int GetBlockFileSerType(int nFile)
+{
+    int nStoreFile = nMTPStoreFile;
+    return (nStoreFile >= 0 && nFile >= nStoreFile) ? (SER_DISK | SER_NOMTP) : SER_DISK;
+}
+
+/** Record that blocks in nFile and later files are stored without their MTP proofs. */
+static void SetMTPStoreFile(int nFile)
+{
+    LOCK(cs_LastBlockFile);
+    if (nMTPStoreFile >= 0 && nMTPStoreFile <= nFile)
+        return;
+    nMTPStoreFile = nFile;
+    fMTPStore = true;
+    if (!pblocktree->WriteMTPStoreFile(nFile))
+        AbortNode("Failed to write to block index database");
+    LogPrintf("Storing MTP proofs separately starting with blk%05u.dat\n", nFile);
+}
+
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
@@ -2992,6 +3073,17 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         vinfoBlockFile.resize(nFile + 1);
     }
 
+    // mfcoin: a block file has either the full layout or the -mtpstore one, start a new file when switching
+    if (!fKnown && fMTPStore && nMTPStoreFile < 0) {
+        if (vinfoBlockFile[nFile].nSize > 0) {
+            nFile++;
+            if (vinfoBlockFile.size() <= nFile) {
+                vinfoBlockFile.resize(nFile + 1);
+            }
+        }
+        SetMTPStoreFile(nFile);
+    }
+
     if (!fKnown) {
         while (vinfoBlockFile[nFile].nSize + nAddSize >= MAX_BLOCKFILE_SIZE) {
             nFile++;
@@ -3105,7 +3197,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-duplicate", true, "duplicate transaction");
 
         // MTP
-        if (block.IsProofOfWork() && !CheckMerkleTreeProof(block, consensusParams))
+        if (block.IsProofOfWork() && !CheckBlockMerkleTreeProof(block, consensusParams))
             return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, "incorrect proof of work");
     }
 
@@ -3504,7 +3596,23 @@ bool ProcessNewBlockHeaders(int32_t& nPoSTemperature, const uint256& lastAccepte
 }
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, bool fCheckPoS=true)
+/** Store the MTP proof of a block that went to a -mtpstore block file, dbpMTP is where it already is on disk, if known. */
+static bool ReceivedBlockMTP(const CBlock& block, CValidationState& state, CBlockIndex* pindex, const CDiskBlockPos& blockPos, const CDiskBlockPos* dbpMTP, const CChainParams& chainparams)
+{
+    if (!block.mtpHashData || !(GetBlockFileSerType(blockPos.nFile) & SER_NOMTP))
+        return true;
+
+    CDiskBlockPos mtpPos(blockPos.nFile, 0);
+    if (dbpMTP != NULL && dbpMTP->nFile == blockPos.nFile)
+        mtpPos = *dbpMTP;
+    else if (!WriteMTPToDisk(block, mtpPos, chainparams.MessageStart()))
+        return AbortNode(state, "Failed to write MTP proof");
+    pindex->nMTPPos = mtpPos.nPos;
+    pindex->nStatus |= BLOCK_HAVE_MTP;
+    return true;
+}
+
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, bool fCheckPoS=true, const CDiskBlockPos* dbpMTP=NULL)
 {
     const CBlock& block = *pblock;
 
@@ -3581,110 +3689,51 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     int nHeight = pindex->nHeight;
     if (isForkBlock(nHeight)) {
         //if block is in forking region validate it agains file records
-        std::string utxo_file_path = GetUTXOFileName(nHeight);
-        if (!utxo_file_path.empty()) {
-            std::ifstream if_utxo(utxo_file_path, std::ios::binary | std::ios::in);
-            if (!if_utxo.is_open()) {
-                LogPrintf("AcceptBlock(): FORK Block - Cannot open UTXO file - %s\n", utxo_file_path);
-            } else {
-                LogPrintf("AcceptBlock(): FORK Block - Validating block - %u / %s  with UTXO file - %s\n",
-                          nHeight, block.GetHash().ToString(), utxo_file_path);
-
-                // amount, script, timestamp
-                vector<tuple<uint64_t, CScript, uint32_t> > txFromFile;
-                txFromFile.reserve(forkCBPerBlock);
-                int recs = 0;
-
-                while (if_utxo && recs < forkCBPerBlock) {
-                    char term = 0;
-                    char coin[8] = {};
-                    if (!if_utxo.read(coin, 8)) {
-                        LogPrintf("AcceptBlock(): FORK Block - No more data in the file \n");
-                        break;
-                    }
-                    uint64_t amount = bytes2uint64(coin);
-
-                    char pubkeysize[8] = {};
-                    if (!if_utxo.read(pubkeysize, 8)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Not more data (PubKeyScript size)\n");
-                        break;
-                    }
-                    int pbsize = bytes2uint64(pubkeysize);
-                    if (pbsize == 0) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Warning! PubKeyScript size = 0\n");
-                        //but proceed
-                    }
-                    std::unique_ptr<char[]> pubKeyScript(new char[pbsize]);
-                    if (!if_utxo.read(&pubKeyScript[0], pbsize)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Not more data (PubKeyScript)\n");
-                        break;
-                    }
-                    unsigned char* pks = (unsigned char*)pubKeyScript.get();
-                    CScript script = CScript(pks, pks+pbsize);
-
-
-                    char timestamp_bytes[8] = {};
-                    if (!if_utxo.read(timestamp_bytes, 8)) {
-                        LogPrintf("ERROR: AddUtxoTransactions(): UTXO file corrupted? - Not more data (Timestamp)\n");
-                        break;
-                    }
-
-                    uint64_t timestamp = bytes2uint64(timestamp_bytes);
-
-                    txFromFile.push_back(make_tuple(amount, script, timestamp));
+        std::shared_ptr<const CUtxoSnapshotFile> utxoFile = GetUTXOSnapshot(nHeight);
+        if (!utxoFile) {
+            LogPrintf("AcceptBlock(): FORK Block - Cannot open UTXO file - %s\n", GetUTXOFileName(nHeight));
+        } else {
+            LogPrintf("AcceptBlock(): FORK Block - Validating block - %u / %s  with UTXO file - %s\n",
+                      nHeight, block.GetHash().ToString(), utxoFile->GetPath());
+
+            size_t nRecords = std::min(utxoFile->vRecords.size(), (size_t)forkCBPerBlock);
+            LogPrintf("AcceptBlock(): FORK Block - %d records read from UTXO file\n", nRecords);
+
+            // a last record without separator was never counted, so no block matched such a file
+            bool fMissingSeparator = utxoFile->fMissingSeparator && utxoFile->vRecords.size() <= (size_t)forkCBPerBlock;
+            if (fMissingSeparator || nRecords + 1 != block.vtx.size()) {
+                state.DoS(100, error("AcceptBlock(): Number of file records - %d doesn't match number of transcations in block - %d\n", nRecords, block.vtx.size()),
+                          REJECT_INVALID, "bad-fork-block");
+                pindex->nStatus |= BLOCK_FAILED_VALID;
+                setDirtyBlockIndex.insert(pindex);
+                return false;
+            }
 
-                    if (!if_utxo.read(&term, 1)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - No more data (record separator)\n");
-                        break;
-                    }
-                    if (term != '\n') {
-                        //This maybe not an error, but warning none the less
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Warning! No record separator ('0xA') was found\n");
-                        if_utxo.seekg(-1, ios_base::cur); //move one char back - if it is not a separator, maybe there is not separators at all
-                    }
-                    recs++;
-                }
-                LogPrintf("AcceptBlock(): FORK Block - %d records read from UTXO file\n", recs);
+            for (size_t i = 0; i < nRecords; i++) {
+                const CUtxoSnapshotRecord& rec = utxoFile->vRecords[i];
+                const CTransaction& tx = *block.vtx[i + 1];
 
-                if (txFromFile.size() + 1 != block.vtx.size() ||
-                    recs + 1 != block.vtx.size()){
-                    state.DoS(100, error("AcceptBlock(): Number of file records - %d doesn't match number of transcations in block - %d\n", recs, block.vtx.size()),
+                if (rec.nValue != (uint64_t)tx.vout[0].nValue ||
+                    !rec.IsScript(tx.vout[0].scriptPubKey) ||
+                    rec.nTime != tx.nTime)
+                {
+                    LogPrintf("AcceptBlock(): FORK Block - Error: Transaction (%d) mismatch\n", i);
+                    LogPrintf("AcceptBlock(): Transaction: Amount: %d; scriptPubKey: %s; nTime: %d\n", tx.vout[0].nValue, HexStr(tx.vout[0].scriptPubKey), tx.nTime);
+                    LogPrintf("AcceptBlock(): File Record: Amount: %d; scriptPubKey: %s; nTime: %d \n", rec.nValue, HexStr(rec.pScript, rec.pScript + rec.nScriptSize), rec.nTime);
+                    state.DoS(100, error("AcceptBlock(): FORK Block - Transaction (%d) doesn't match record in the UTXO file", i),
                               REJECT_INVALID, "bad-fork-block");
                     pindex->nStatus |= BLOCK_FAILED_VALID;
                     setDirtyBlockIndex.insert(pindex);
                     return false;
                 }
-
-                int txid = 0;
-                typedef boost::tuple<pair<uint64_t, CScript>&, const CTransaction&> fork_cmp_tuple;
-                auto it1 = txFromFile.begin();
-                auto it2 = block.vtx.begin() + 1;
-                for (; it1 != txFromFile.end() && it2 != block.vtx.end(); ++it1, ++it2) {
-                                tuple<uint64_t, CScript, uint32_t>& rec = *it1;
-                                const CTransaction& tx = *it2->get();
-
-                                if (get<0>(rec) != tx.vout[0].nValue ||
-                                    get<1>(rec) != tx.vout[0].scriptPubKey ||
-                                    get<2>(rec) != tx.nTime)
-                                {
-                                    LogPrintf("AcceptBlock(): FORK Block - Error: Transaction (%d) mismatch\n", txid);
-                                    LogPrintf("AcceptBlock(): Transaction: Amount: %d; scriptPubKey: %s; nTime: %d\n", tx.vout[0].nValue, tx.vout[0].scriptPubKey.data(), tx.nTime);
-                                    LogPrintf("AcceptBlock(): File Record: Amount: %d; scriptPubKey: %s; nTime: %d \n", get<0>(rec), get<1>(rec).data(), get<2>(rec));
-                                    state.DoS(100, error("AcceptBlock(): FORK Block - Transaction (%d) doesn't match record in the UTXO file", txid),
-                                              REJECT_INVALID, "bad-fork-block");
-                                    pindex->nStatus |= BLOCK_FAILED_VALID;
-                                    setDirtyBlockIndex.insert(pindex);
-                                    return false;
-                                }
-                            }
-                txid++;
             }
         }
     }
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        int nSerType = dbp != NULL ? GetBlockFileSerType(dbp->nFile) : (fMTPStore ? SER_DISK | SER_NOMTP : SER_DISK);
+        unsigned int nBlockSize = ::GetSerializeSize(block, nSerType, CLIENT_VERSION);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
@@ -3693,6 +3742,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
         if (dbp == NULL)
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
+        if (!ReceivedBlockMTP(block, state, pindex, blockPos, dbpMTP, chainparams))
+            return false;
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
     } catch (const std::runtime_error& e) {
@@ -3803,9 +3854,11 @@ void PruneOneBlockFile(const int fileNumber)
         if (pindex->nFile == fileNumber) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nStatus &= ~BLOCK_HAVE_MTP;
             pindex->nFile = 0;
             pindex->nDataPos = 0;
             pindex->nUndoPos = 0;
+            pindex->nMTPPos = 0;
             setDirtyBlockIndex.insert(pindex);
 
             // Prune from mapBlocksUnlinked -- any block we prune would have
@@ -3832,9 +3885,11 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        TxReaderForgetFile(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
-        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "mtp"));
+        LogPrintf("Prune: %s deleted blk/rev/mtp (%05u)\n", __func__, *it);
     }
 }
 
@@ -3957,6 +4012,10 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+FILE* OpenMTPFile(const CDiskBlockPos &pos, bool fReadOnly) {
+    return OpenDiskFile(pos, "mtp", fReadOnly);
+}
+
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
@@ -4090,11 +4149,21 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether MTP proofs have been stored separately; block files written that way stay that way
+    int nStoreFile;
+    if (pblocktree->ReadMTPStoreFile(nStoreFile)) {
+        nMTPStoreFile = nStoreFile;
+        if (!fMTPStore)
+            LogPrintf("%s: MTP proofs are stored separately since blk%05u.dat, -mtpstore stays enabled\n", __func__, nStoreFile);
+        fMTPStore = true;
+    }
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    UpdateStakeModifierIndex();
 
     PruneBlockIndexCandidates();
 
@@ -4156,7 +4225,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         }
         CBlock block;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus(), true))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
         if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
@@ -4197,7 +4266,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
             pindex = chainActive.Next(pindex);
             CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus(), true))
                 return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             if (!ConnectBlock(block, state, pindex, coins, chainparams))
                 return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4257,11 +4326,12 @@ bool RewindBlockIndex(const CChainParams& params)
             // Reduce validity
             pindexIter->nStatus = std::min<unsigned int>(pindexIter->nStatus & BLOCK_VALID_MASK, BLOCK_VALID_TREE) | (pindexIter->nStatus & ~BLOCK_VALID_MASK);
             // Remove have-data flags.
-            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO | BLOCK_HAVE_MTP);
             // Remove storage location.
             pindexIter->nFile = 0;
             pindexIter->nDataPos = 0;
             pindexIter->nUndoPos = 0;
+            pindexIter->nMTPPos = 0;
             // Remove various other things
             pindexIter->nTx = 0;
             pindexIter->nChainTx = 0;
@@ -4307,12 +4377,14 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    UnloadStakeModifierIndex();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    nMTPStoreFile = -1;
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
@@ -4450,7 +4522,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            unsigned int nBlockSize = ::GetSerializeSize(block, fMTPStore ? SER_DISK | SER_NOMTP : SER_DISK, CLIENT_VERSION);
             CDiskBlockPos blockPos;
             CValidationState state;
             if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
@@ -4458,6 +4530,8 @@ bool InitBlockIndex(const CChainParams& chainparams)
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block, false);
+            if (!ReceivedBlockMTP(block, state, pindex, blockPos, NULL, chainparams))
+                return error("LoadBlockIndex(): writing genesis MTP proof to disk failed");
             // mfcoin: calculate pindex->nFlags for genesis block before doing FlushStateToDisk()
             ppcoinContextualBlockChecks(block, state, pindex, false);
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
@@ -4490,16 +4564,51 @@ checkpoint_key_init:
     return true;
 }
 
+/** Find the MTP proofs in mtp?????.dat by block hash, for reindexing the matching block file. */
+static void LoadMTPFilePositions(const CChainParams& chainparams, int nFile, std::map<uint256, CDiskBlockPos>& mapMTPPos)
+{
+    CAutoFile filein(OpenMTPFile(CDiskBlockPos(nFile, 0), true), SER_DISK, CLIENT_VERSION);
+    while (!filein.IsNull()) {
+        try {
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            unsigned int nSize = 0;
+            uint256 hash;
+            filein >> FLATDATA(buf) >> nSize;
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                break;
+            long nPos = ftell(filein.Get());
+            filein >> hash;
+            if (nPos < 0 || fseek(filein.Get(), nPos + nSize, SEEK_SET))
+                break;
+            mapMTPPos[hash] = CDiskBlockPos(nFile, (unsigned int)nPos);
+        } catch (const std::exception&) {
+            // end of file, or a record cut short by a crash
+            break;
+        }
+    }
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    // Disk positions of the MTP proofs of those blocks, if stored separately
+    static std::map<uint256, CDiskBlockPos> mapUnknownParentMTPPos;
     int64_t nStart = GetTimeMillis();
 
+    // Block files written with -mtpstore have their proofs in the matching mtp?????.dat
+    int nSerType = SER_DISK;
+    std::map<uint256, CDiskBlockPos> mapMTPPos;
+    if (dbp && ((GetBlockFileSerType(dbp->nFile) & SER_NOMTP) || boost::filesystem::exists(GetBlockPosFilename(*dbp, "mtp")))) {
+        SetMTPStoreFile(dbp->nFile);
+        nSerType = GetBlockFileSerType(dbp->nFile);
+        LoadMTPFilePositions(chainparams, dbp->nFile, mapMTPPos);
+    }
+
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, nSerType, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
@@ -4536,21 +4645,29 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
+                std::map<uint256, CDiskBlockPos>::const_iterator itMTP = mapMTPPos.find(hash);
+                const CDiskBlockPos* dbpMTP = itMTP != mapMTPPos.end() ? &itMTP->second : NULL;
+
+                // detect out of order blocks, and store them for later
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
-                    if (dbp)
+                    if (dbp) {
                         mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                        if (dbpMTP)
+                            mapUnknownParentMTPPos[hash] = *dbpMTP;
+                    }
                     continue;
                 }
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                    if (dbpMTP && !ReadMTPFromDisk(block, *dbpMTP))
+                        dbpMTP = NULL;
                     LOCK(cs_main);
                     CValidationState state;
-                    if (AcceptBlock(pblock, state, chainparams, NULL, true, dbp, NULL, false))
+                    if (AcceptBlock(pblock, state, chainparams, NULL, true, dbp, NULL, false, dbpMTP))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -4582,9 +4699,16 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                         {
                             LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
                                     head.ToString());
+                            CDiskBlockPos posMTP;
+                            std::map<uint256, CDiskBlockPos>::iterator itMTP = mapUnknownParentMTPPos.find(pblockrecursive->GetHash());
+                            if (itMTP != mapUnknownParentMTPPos.end()) {
+                                if (ReadMTPFromDisk(*pblockrecursive, itMTP->second))
+                                    posMTP = itMTP->second;
+                                mapUnknownParentMTPPos.erase(itMTP);
+                            }
                             LOCK(cs_main);
                             CValidationState dummy;
-                            if (AcceptBlock(pblockrecursive, dummy, chainparams, NULL, true, &it->second, NULL, false))
+                            if (AcceptBlock(pblockrecursive, dummy, chainparams, NULL, true, &it->second, NULL, false, posMTP.IsNull() ? NULL : &posMTP))
                             {
                                 nLoaded++;
                                 queue.push_back(pblockrecursive->GetHash());
@@ -4961,11 +5085,11 @@ bool GetMfc7POSReward(const CTransaction& tx, const CCoinsViewCache &view, CAmou
     {
         // First try finding the previous transaction in database
         const COutPoint &prevout = txin.prevout;
-        CCoins coins;
+        Coin coin;
 
-        if (!view.GetCoins(prevout.hash, coins))
+        if (!view.GetCoin(prevout, coin))
             continue;  // previous transaction not in main chain
-        if (tx.nTime < coins.nTime)
+        if (tx.nTime < coin.nTime)
             return false;  // Transaction timestamp violation
 
         // Transaction index is required to get to block header
@@ -4976,15 +5100,9 @@ bool GetMfc7POSReward(const CTransaction& tx, const CCoinsViewCache &view, CAmou
         CTransactionRef txPrev;
         if (pblocktree->ReadTxIndex(prevout.hash, postx))
         {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txPrev;
-            } catch (std::exception &e) {
+            if (!ReadTxFromDisk(postx, txPrev, header))
                 return error("%s() : deserialize or I/O error in GetCoinAge()", __PRETTY_FUNCTION__);
-            }
             if (txPrev->GetHash() != prevout.hash)
                 return error("%s() : txid mismatch in GetCoinAge()", __PRETTY_FUNCTION__);
 
@@ -577,6 +577,37 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::IndexStakeCoins(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fStakeCoinsIndexed)
+        return;
+
+    auto indexOutputs = [this](const CWalletTx& wtxOut) {
+        const uint256& hash = wtxOut.GetHash();
+        for (unsigned int i = 0; i < wtxOut.tx->vout.size(); i++)
+        {
+            const CTxOut& txout = wtxOut.tx->vout[i];
+            // ignore namecoin TxOut
+            if (wtxOut.tx->nVersion == NAMECOIN_TX_VERSION && hooks->IsNameScript(txout.scriptPubKey))
+                continue;
+            if (txout.nValue > 0 && (IsMine(txout) & ISMINE_SPENDABLE) != ISMINE_NO)
+                mapStakeCoins.insert(make_pair(COutPoint(hash, i), CStakeCoin()));
+        }
+    };
+
+    indexOutputs(wtx);
+
+    // AvailableStakeCoins() drops outputs once they are spent in the main
+    // chain; bring them back in case wtx was disconnected or abandoned.
+    BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
+    {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end())
+            indexOutputs(mi->second);
+    }
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -980,6 +1011,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     // Break debit/credit balance caches:
     wtx.MarkDirty();
 
+    IndexStakeCoins(wtx);
+    if (fInsertedNew)
+        IndexNameTx(wtx);
+
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -1004,6 +1039,7 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
+    IndexNameTx(wtx);
     BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -2159,6 +2195,105 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
+void CWallet::IndexNameTx(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    NameTxInfo nti;
+    if (!DecodeNameTx(wtx.tx, nti))
+        return;
+
+    setNameTx.insert(nti.name);
+}
+
+void CWallet::AvailableStakeCoins(vector<COutput>& vCoins, uint32_t nSpendTime)
+{
+    vCoins.clear();
+    time_t cur_time = time(NULL);
+    LOCK2(cs_main, cs_wallet);
+
+    if (!fStakeCoinsIndexed)
+    {
+        fStakeCoinsIndexed = true;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            IndexStakeCoins(it->second);
+        LogPrintf("%s: indexed %u outputs for staking\n", __func__, mapStakeCoins.size());
+    }
+
+    g_RandPayLockUTXO.Set(mapWallet.size() << 1); // Reenter is OK, just ignored
+    LOCK(cs_g_RandPayLockUTXO);
+    map<COutPoint, CStakeCoin>::iterator it = mapStakeCoins.begin();
+    while (it != mapStakeCoins.end())
+    {
+        const COutPoint& outpoint = it->first;
+        CStakeCoin& coin = it->second;
+
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+        if (mi == mapWallet.end())
+        {
+            it = mapStakeCoins.erase(it); // zapped from the wallet
+            continue;
+        }
+        const CWalletTx* pcoin = &mi->second;
+
+        // Same as IsSpent(), but forget outputs spent in the main chain
+        bool fSpent = false, fSpentInChain = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+        for (TxSpends::const_iterator sit = range.first; sit != range.second; ++sit)
+        {
+            map<uint256, CWalletTx>::const_iterator smi = mapWallet.find(sit->second);
+            if (smi != mapWallet.end()) {
+                int depth = smi->second.GetDepthInMainChain();
+                fSpentInChain |= depth > 0;
+                fSpent |= depth > 0 || (depth == 0 && !smi->second.isAbandoned());
+            }
+        }
+        if (fSpentInChain)
+        {
+            it = mapStakeCoins.erase(it);
+            continue;
+        }
+
+        // The checks of AvailableCoins() for confirmed outputs
+        int nDepth = pcoin->GetDepthInMainChain();
+        if (fSpent || nDepth < 1 || !CheckFinalTx(*pcoin) ||
+            (nSpendTime > 0 && pcoin->tx->nTime > nSpendTime) ||
+            ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0 && !isForkBlock(chainActive.Height())) ||
+            IsLockedCoin(outpoint.hash, outpoint.n))
+        {
+            ++it;
+            continue;
+        }
+
+        uint256 rpLockTXkey(outpoint.hash);
+        ((uint32_t*)rpLockTXkey.GetDataPtr())[0] += outpoint.n;
+        uint256HashMap<time_t>::Data *p = g_RandPayLockUTXO.Search(rpLockTXkey);
+        if (p) {
+            if (p->value > cur_time) {
+                ++it;
+                continue;
+            }
+            g_RandPayLockUTXO.MarkDel(p);
+        }
+
+        // Look up the block data the kernel hashes once per block the tx is in
+        if (coin.nTxOffset == 0 || coin.hashBlock != pcoin->hashBlock)
+        {
+            CDiskTxPos postx;
+            if (!pblocktree->ReadTxIndex(outpoint.hash, postx))
+            {
+                ++it;
+                continue;
+            }
+            coin.hashBlock = pcoin->hashBlock;
+            coin.nBlockTime = mapBlockIndex[pcoin->hashBlock]->GetBlockTime();
+            coin.nTxOffset = postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+        }
+
+        vCoins.push_back(COutput(pcoin, outpoint.n, nDepth, true, true));
+        ++it;
+    }
+}
+
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
 vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
@@ -2808,7 +2943,7 @@ bool CWallet::CreateNameTx(const CRecipient& recipient, const CWalletTx& wtxName
 
 // ppcoin: create coin stake transaction
 typedef std::vector<unsigned char> valtype;
-bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, bool fV7Enabled, int nHeight)
+bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, CBlockIndex* pindexPrev, bool fV7Enabled, int nHeight)
 {
     // Transaction index is required to get to block header
     if (!fTxIndex)
@@ -2818,12 +2953,8 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     // The following split & combine thresholds are important to security
     // Should not be adjusted if you don't understand the consequences
     static unsigned int nStakeSplitAge = (60 * 60 * 24 * 90);
-    LOCK2(cs_main, cs_wallet);
-    CAmount nPoWReward = GetProofOfWorkReward(GetLastBlockIndex(chainActive.Tip(), false)->nBits, fV7Enabled, nHeight);
-    CAmount nCombineThreshold = nPoWReward / 3;
-
-    arith_uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    static int nMaxStakeSearchInterval = 60;
+    unsigned int nSearchSteps = max((int64_t)0, min(nSearchInterval, (int64_t)nMaxStakeSearchInterval));
 
     txNew.vin.clear();
     txNew.vout.clear();
@@ -2831,129 +2962,212 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     CScript scriptEmpty;
     scriptEmpty.clear();
     txNew.vout.push_back(CTxOut(0, scriptEmpty));
-    // Choose coins to use
-    CAmount nBalance = GetBalance();
     CAmount nReserveBalance = 0;
     if (IsArgSet("-reservebalance") && !ParseMoney(GetArg("-reservebalance", ""), nReserveBalance))
         return error("CreateCoinStake : invalid reserve balance amount");
-    if (nBalance <= nReserveBalance)
-        return false;
-    set<pair<const CWalletTx*,unsigned int> > setCoins;
-    vector<const CWalletTx*> vwtxPrev;
-    CAmount nValueIn = 0;
-    std::vector<COutput> vAvailableCoins;
-    AvailableCoins(vAvailableCoins, true, nullptr, false, txNew.nTime);
-    if (!SelectCoins(vAvailableCoins, nBalance - nReserveBalance, setCoins, nValueIn))
-        return false;
-    if (setCoins.empty())
-        return false;
+
+    // mfcoin: the kernel search runs without cs_main and cs_wallet, on a
+    // snapshot of the selected coins and of the stake modifiers taken here
+    struct StakeCandidate
+    {
+        COutPoint prevout;
+        CTransactionRef tx;
+        CStakeCoin coin;
+    };
+    vector<StakeCandidate> vCandidates;
+    vector<pair<bool, uint64_t> > vStakeModifiers(nSearchSteps); // for txNew.nTime - n, if any
+    bool fV05 = IsProtocolV05(txNew.nTime - nMaxStakeSearchInterval, Params());
+    CAmount nPoWReward;
+    CAmount nBalance;
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (chainActive.Tip() != pindexPrev)
+            return false;
+        nPoWReward = GetProofOfWorkReward(GetLastBlockIndex(pindexPrev, false)->nBits, fV7Enabled, nHeight);
+
+        // Choose coins to use
+        nBalance = GetBalance();
+        if (nBalance <= nReserveBalance)
+            return false;
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        CAmount nValueIn = 0;
+        std::vector<COutput> vAvailableCoins;
+        AvailableStakeCoins(vAvailableCoins, txNew.nTime);
+        if (!SelectCoins(vAvailableCoins, nBalance - nReserveBalance, setCoins, nValueIn))
+            return false;
+        if (setCoins.empty())
+            return false;
+
+        for (const auto& pcoin : setCoins)
+        {
+            // Block time and offset come from the staking index
+            COutPoint prevout(pcoin.first->GetHash(), pcoin.second);
+            StakeCandidate candidate = { prevout, pcoin.first->tx, mapStakeCoins[prevout] };
+            vCandidates.push_back(candidate);
+        }
+
+        // Since protocol v0.5 the modifier only depends on pindexPrev and the kernel time
+        for (unsigned int n = 0; fV05 && n < nSearchSteps; n++)
+        {
+            int nStakeModifierHeight = 0;
+            int64_t nStakeModifierTime = 0;
+            vStakeModifiers[n].first = GetKernelStakeModifier(pindexPrev, uint256(), txNew.nTime - n,
+                vStakeModifiers[n].second, nStakeModifierHeight, nStakeModifierTime, false);
+        }
+    }
+
+    CAmount nCombineThreshold = nPoWReward / 3;
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
-
-    static map<uint256, pair<shared_ptr<CBlockHeader>, uint32_t>> CacheBlockOffset;
-    uint256 offsetKey;
+    CScript scriptPubKeyOut;
+    const StakeCandidate* pkernel = nullptr;
+    unsigned int nKernelStep = 0;
 
     int nSplitPos = GetArg("-splitpos", 1); // 0=No Split, 1=RandSplit before 90d, -1=Principal+Reward
 
-    for (const auto& pcoin : setCoins)
+    // Found a kernel for candidate at step n: check that we can sign with it
+    auto acceptKernel = [&](const StakeCandidate& candidate, unsigned int n) -> bool
     {
-        uint256 tx_hash = pcoin.first->GetHash();
-
-        decltype(CacheBlockOffset)::mapped_type& pbo = CacheBlockOffset[tx_hash];
-        if (pbo.first == nullptr) {
-            CDiskTxPos postx;
-            shared_ptr<CBlockHeader> pheader(make_shared<CBlockHeader>());
-            if (pblocktree->ReadTxIndex(tx_hash, postx)) {
-                // Read block header
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                try {
-                    pheader->SerializationOp(file, CBlockHeader::CReadBlockHeader());
-                } catch (std::exception &e) {
-                    pheader.reset();
-                }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : kernel found\n");
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        scriptPubKeyKernel = candidate.tx->vout[candidate.prevout.n].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
+        {
+            if (fDebug && GetBoolArg("-printcoinstake", false))
+                LogPrintf("CreateCoinStake : failed to parse kernel type=%d\n", whichType);
+            return false;
+        }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
+        {
+            if (fDebug && GetBoolArg("-printcoinstake", false))
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            return false;  // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            // convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key))
+            {
+                if (fDebug && GetBoolArg("-printcoinstake", false))
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                return false;  // unable to find corresponding public key
             }
-            if (!pheader)
-                continue;
-            pbo = {pheader, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE};
+            scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
         }
-        offsetKey = tx_hash;
-
-        CBlockHeader& header = *pbo.first;
-        unsigned int offset = pbo.second;
+        else
+            scriptPubKeyOut = scriptPubKeyKernel;
 
-        static int nMaxStakeSearchInterval = 60;
-        if (pcoin.first->tx->nTime + params.nStakeMinAge > txNew.nTime - nMaxStakeSearchInterval)
-            continue; // only count coins meeting min age requirement
+        pkernel = &candidate;
+        nKernelStep = n;
+        return true;
+    };
 
-        bool fKernelFound = false;
-        for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound; n++)
+    if (fV05)
+    {
+        // mfcoin: queue every (coin, step) kernel and hash them in batches,
+        // in the same coin-major, step-minor order as the scalar search
+        vector<CStakeKernelV05> vKernels;
+        vector<pair<size_t, unsigned int> > vKernelPos; // candidate index and step of each kernel
+        vKernels.reserve(vCandidates.size() * nSearchSteps);
+        vKernelPos.reserve(vCandidates.size() * nSearchSteps);
+        for (size_t i = 0; i < vCandidates.size(); i++)
         {
+            const StakeCandidate& candidate = vCandidates[i];
+            if (candidate.tx->nTime + params.nStakeMinAge > txNew.nTime - nMaxStakeSearchInterval)
+                continue; // only count coins meeting min age requirement
+
             // Search backward in time from the given txNew timestamp
             // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            uint256 hashProofOfStake = uint256();
-            COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            if (CheckStakeKernelHash(nBits, chainActive.Tip(), header, offset, pcoin.first->tx, prevoutStake, txNew.nTime - n, hashProofOfStake))
+            for (unsigned int n = 0; n < nSearchSteps; n++)
             {
-                // Found a kernel
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : kernel found\n");
-                vector<valtype> vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
-                if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-                {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to parse kernel type=%d\n", whichType);
-                    break;
-                }
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
-                {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address
-                }
-                if (whichType == TX_PUBKEYHASH) // pay to address type
+                CStakeKernelV05 kernel;
+                if (!vStakeModifiers[n].first ||
+                    !GetStakeKernelV05(nBits, vStakeModifiers[n].second, candidate.coin.nBlockTime, candidate.coin.nTxOffset, candidate.tx, candidate.prevout, txNew.nTime - n, kernel))
+                    continue;
+                vKernels.push_back(kernel);
+                vKernelPos.push_back(make_pair(i, n));
+            }
+        }
+
+        uint256 hashProofOfStake;
+        size_t nNext = 0;
+        while ((nNext = CheckStakeKernelHashesV05(vKernels, nNext, hashProofOfStake)) < vKernels.size())
+        {
+            size_t nCandidate = vKernelPos[nNext].first;
+            if (acceptKernel(vCandidates[nCandidate], vKernelPos[nNext].second))
+                break;
+            // unusable kernel coin, go on with the next one
+            while (nNext < vKernels.size() && vKernelPos[nNext].first == nCandidate)
+                nNext++;
+        }
+    }
+    else
+    {
+        for (const StakeCandidate& candidate : vCandidates)
+        {
+            if (candidate.tx->nTime + params.nStakeMinAge > txNew.nTime - nMaxStakeSearchInterval)
+                continue; // only count coins meeting min age requirement
+
+            for (unsigned int n=0; n<nSearchSteps && !pkernel; n++)
+            {
+                // Search backward in time from the given txNew timestamp
+                // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
+                uint256 hashProofOfStake = uint256();
+                bool fKernel;
                 {
-                    // convert to pay to public key type
-                    CKey key;
-                    if (!keystore.GetKey(uint160(vSolutions[0]), key))
-                    {
-                        if (fDebug && GetBoolArg("-printcoinstake", false))
-                            LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-                    scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+                    LOCK(cs_main);
+                    fKernel = CheckStakeKernelHash(nBits, pindexPrev, candidate.coin.hashBlock, candidate.coin.nBlockTime, candidate.coin.nTxOffset, candidate.tx, candidate.prevout, txNew.nTime - n, hashProofOfStake);
                 }
-                else
-                    scriptPubKeyOut = scriptPubKeyKernel;
-
-                txNew.nTime -= n;
-                txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-                nCredit += pcoin.first->tx->vout[pcoin.second].nValue;
-                vwtxPrev.push_back(pcoin.first);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
-                if ((nSplitPos < 0) || (nSplitPos && header.GetBlockTime() + nStakeSplitAge > txNew.nTime && nCredit > nPoWReward))
-                    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake if (age < 90 && value > POW)
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-                fKernelFound = true;
-                break;
+                if (fKernel && !acceptKernel(candidate, n))
+                    break;
             }
+            if (pkernel)
+                break; // if kernel is found stop searching
         }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
     }
+    if (!pkernel)
+        return false;
+
+    // Build the coinstake, with the locks held again
+    LOCK2(cs_main, cs_wallet);
+    if (chainActive.Tip() != pindexPrev)
+        return false;
+
+    vector<const CWalletTx*> vwtxPrev;
+    auto addInput = [&](const StakeCandidate& candidate) {
+        // The coins may have been spent or locked while the locks were released
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(candidate.prevout.hash);
+        if (mi == mapWallet.end() || IsSpent(candidate.prevout.hash, candidate.prevout.n) || IsLockedCoin(candidate.prevout.hash, candidate.prevout.n))
+            return false;
+        txNew.vin.push_back(CTxIn(candidate.prevout));
+        nCredit += candidate.tx->vout[candidate.prevout.n].nValue;
+        vwtxPrev.push_back(&mi->second);
+        return true;
+    };
+
+    txNew.nTime -= nKernelStep;
+    if (!addInput(*pkernel))
+        return false;
+    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+    if ((nSplitPos < 0) || (nSplitPos && pkernel->coin.nBlockTime + nStakeSplitAge > txNew.nTime && nCredit > nPoWReward))
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake if (age < 90 && value > POW)
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : added kernel\n");
+
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
-    BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins)
+    for (const StakeCandidate& candidate : vCandidates)
     {
+        const CTxOut& txout = candidate.tx->vout[candidate.prevout.n];
         // Attempt to add more inputs
         // Only add coins of the same key/address as kernel
-        if (txNew.vout.size() == 2 && ((pcoin.first->tx->vout[pcoin.second].scriptPubKey == scriptPubKeyKernel || pcoin.first->tx->vout[pcoin.second].scriptPubKey == txNew.vout[1].scriptPubKey))
-            && pcoin.first->GetHash() != txNew.vin[0].prevout.hash)
+        if (txNew.vout.size() == 2 && ((txout.scriptPubKey == scriptPubKeyKernel || txout.scriptPubKey == txNew.vout[1].scriptPubKey))
+            && candidate.prevout.hash != txNew.vin[0].prevout.hash)
         {
             // Stop adding more inputs if already too many inputs
             if (txNew.vin.size() >= 100)
@@ -2962,17 +3176,15 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             if (nCredit > nCombineThreshold)
                 break;
             // Stop adding inputs if reached reserve limit
-            if (nCredit + pcoin.first->tx->vout[pcoin.second].nValue > nBalance - nReserveBalance)
+            if (nCredit + txout.nValue > nBalance - nReserveBalance)
                 break;
             // Do not add additional significant input
-            if (pcoin.first->tx->vout[pcoin.second].nValue > nCombineThreshold)
+            if (txout.nValue > nCombineThreshold)
                 continue;
             // Do not add input that is still too young
-            if (pcoin.first->tx->nTime + params.nStakeMaxAge > txNew.nTime)
+            if (candidate.tx->nTime + params.nStakeMaxAge > txNew.nTime)
                 continue;
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->tx->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
+            addInput(candidate);
         }
     }
     // Calculate coin age reward
@@ -3033,9 +3245,6 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     }
 
     // Successfully generated coinstake
-    // Remove block reference from the cache
-    CacheBlockOffset.erase(offsetKey);
-    offsetKey.SetNull();
     return true;
 }
 
@@ -3177,6 +3386,15 @@ DBErrors CWallet::ZapSelectTx(vector<uint256>& vHashIn, vector<uint256>& vHashOu
     if (nZapSelectTxRet != DB_LOAD_OK)
         return nZapSelectTxRet;
 
+    if (!vHashOut.empty())
+    {
+        // the removed transactions may have been the only ones of their names
+        LOCK(cs_wallet);
+        setNameTx.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            IndexNameTx(it->second);
+    }
+
     MarkDirty();
 
     return DB_LOAD_OK;
@@ -456,6 +456,16 @@ public:
     std::string ToString() const;
 };
 
+/** What the stake kernel hashes about a wallet output, cached by the staking index */
+struct CStakeCoin
+{
+    uint256 hashBlock;       //!< block the fields below were looked up for
+    unsigned int nBlockTime; //!< time of that block
+    unsigned int nTxOffset;  //!< kernel offset of the tx in that block, 0 if not looked up yet
+
+    CStakeCoin() : nBlockTime(0), nTxOffset(0) {}
+};
+
 
 
 
@@ -612,6 +622,21 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Staking index: the spendable outputs of wallet transactions that may be
+     * used as stake kernels, with their block data cached. It is built on the
+     * first stake attempt and then kept up to date by AddToWallet(), so that
+     * minting neither walks mapWallet nor reads block files.
+     */
+    std::map<COutPoint, CStakeCoin> mapStakeCoins;
+    bool fStakeCoinsIndexed;
+
+    /* Add the outputs of a wallet transaction that can stake to the staking index */
+    void IndexStakeCoins(const CWalletTx& wtx);
+
+    /* Record the name operated on by a wallet transaction in setNameTx */
+    void IndexNameTx(const CWalletTx& wtx);
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
@@ -695,11 +720,19 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fStakeCoinsIndexed = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
     std::list<CAccountingEntry> laccentries;
 
+    /**
+     * Name index: every name operated on by a wallet transaction. Kept up to
+     * date by AddToWallet() and LoadToWallet(), so that listing the wallet's
+     * names does not walk mapWallet.
+     */
+    std::set<CNameVal> setNameTx;
+
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
@@ -723,6 +756,12 @@ public:
      */
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, uint32_t nSpendTime = 0) const;
 
+    /**
+     * populate vCoins with the confirmed outputs that can stake at nSpendTime,
+     * taken from the staking index, whose block data is looked up if needed.
+     */
+    void AvailableStakeCoins(std::vector<COutput>& vCoins, uint32_t nSpendTime);
+
     /**
      * Shuffle and select coins until nTargetValue is reached while avoiding
      * small change; This method is stochastic for some inputs and upon
@@ -824,7 +863,7 @@ public:
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
     bool CreateNameTx(const CRecipient& recipient, const CWalletTx& wtxNameIn, const CAmount& nFeeInput, CWalletTx& wtxNew, CReserveKey& reservekey,
                       CAmount& nFeeRet, int& nChangePosInOut, std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
-    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction &txNew, bool fV7Enabled, int nHeight);
+    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction &txNew, CBlockIndex* pindexPrev, bool fV7Enabled, int nHeight);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state);
 
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries);